@@ -0,0 +1,225 @@
+#include <stddef.h>
+
+#include "aesni.h"
+#include "cipher.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <wmmintrin.h>
+
+/* Only these functions get compiled with the AES instructions enabled */
+#define AESNI_FN __attribute__((target("aes,sse2")))
+
+/* Number of blocks kept in flight to hide the aesenc latency */
+#define AESNI_LANES 8
+
+/**
+ * Checks CPUID for AES-NI
+ * Returns 0 if the instructions are available
+ */
+static int aesni_setup () {
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return -1;
+    }
+    return (ecx & bit_AES) ? 0 : -1;
+}
+
+/**
+ * One key expansion step
+ * Spreads the previous key words across the words of key and adds the
+ * word picked out of the aeskeygenassist result kg
+ */
+AESNI_FN static __m128i aesni_expand_step (__m128i key, __m128i kg) {
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, kg);
+}
+
+/* The round constant has to be an immediate */
+#define EXPAND(I,RCON) do { \
+        k = aesni_expand_step(k, _mm_shuffle_epi32( \
+            _mm_aeskeygenassist_si128(k, RCON), 0xff)); \
+        _mm_storeu_si128((__m128i *) (sched + ((I) * BLOCK_SIZE)), k); \
+    } while (0)
+
+/**
+ * Two AES-256 expansion steps
+ * The first half of each pair is rotated, substituted and round constant
+ * added like AES-128, the second only substituted
+ */
+#define EXPAND256(I,RCON) do { \
+        k = aesni_expand_step(k, _mm_shuffle_epi32( \
+            _mm_aeskeygenassist_si128(k2, RCON), 0xff)); \
+        _mm_storeu_si128((__m128i *) (sched + ((I) * BLOCK_SIZE)), k); \
+        if ((I) + 1 <= 14) { \
+            k2 = aesni_expand_step(k2, _mm_shuffle_epi32( \
+                _mm_aeskeygenassist_si128(k, 0x00), 0xaa)); \
+            _mm_storeu_si128((__m128i *) (sched + (((I) + 1) * BLOCK_SIZE)), \
+                             k2); \
+        } \
+    } while (0)
+
+/**
+ * Expands a key with aeskeygenassist, same schedule as key_expand
+ * AES-192 round keys straddle the 16 byte registers, and as keys are
+ * expanded once and cached that size is left to expand_key
+ * ctx: context to fill the schedule of
+ * key: pointer to unsigned char[nk * BPW]
+ * nk: length of the key in words
+ */
+AESNI_FN static void aesni_expand (struct aes_ctx_s *ctx,
+                                   const unsigned char *key,
+                                   unsigned int nk) {
+    unsigned char *sched = CTX_SCHED(ctx);
+    __m128i k = _mm_loadu_si128((const __m128i *) key);
+    __m128i k2;
+
+    if (nk == 6) {
+        expand_key(ctx, key, nk);
+        return;
+    }
+    ctx->nk = nk;
+    ctx->nr = nk + 6;
+    _mm_storeu_si128((__m128i *) sched, k);
+
+    if (nk == 8) {
+        k2 = _mm_loadu_si128((const __m128i *) (key + BLOCK_SIZE));
+        _mm_storeu_si128((__m128i *) (sched + BLOCK_SIZE), k2);
+        EXPAND256(2, 0x01);
+        EXPAND256(4, 0x02);
+        EXPAND256(6, 0x04);
+        EXPAND256(8, 0x08);
+        EXPAND256(10, 0x10);
+        EXPAND256(12, 0x20);
+        EXPAND256(14, 0x40);
+        return;
+    }
+
+    EXPAND(1, 0x01);
+    EXPAND(2, 0x02);
+    EXPAND(3, 0x04);
+    EXPAND(4, 0x08);
+    EXPAND(5, 0x10);
+    EXPAND(6, 0x20);
+    EXPAND(7, 0x40);
+    EXPAND(8, 0x80);
+    EXPAND(9, 0x1b);
+    EXPAND(10, 0x36);
+}
+
+/* Encryption and decryption written out for every key size */
+#define AESNI_NR 10
+#define AESNI_NAME(N) N ## _128
+#include "aesni_kern.h"
+#undef AESNI_NAME
+#undef AESNI_NR
+
+#define AESNI_NR 12
+#define AESNI_NAME(N) N ## _192
+#include "aesni_kern.h"
+#undef AESNI_NAME
+#undef AESNI_NR
+
+#define AESNI_NR 14
+#define AESNI_NAME(N) N ## _256
+#include "aesni_kern.h"
+#undef AESNI_NAME
+#undef AESNI_NR
+
+/**
+ * Encrypts blocks with the code for the key size of the schedule
+ */
+static void aesni_encrypt (const struct aes_ctx_s *ctx, unsigned char *out,
+                           const unsigned char *in, size_t blocks) {
+    switch (ctx->nr) {
+    case 12:
+        aesni_enc_192(CTX_SCHED(ctx), out, in, blocks);
+        break;
+    case 14:
+        aesni_enc_256(CTX_SCHED(ctx), out, in, blocks);
+        break;
+    default:
+        aesni_enc_128(CTX_SCHED(ctx), out, in, blocks);
+        break;
+    }
+}
+
+/**
+ * Derives the equivalent inverse cipher schedule with aesimc
+ * ctx: context with an expanded schedule, fills its dec_schedule
+ */
+AESNI_FN static void aesni_expand_dec (struct aes_ctx_s *ctx) {
+    const unsigned char *sched = CTX_SCHED(ctx);
+    unsigned char *dec = CTX_DEC_SCHED(ctx);
+    unsigned int nr = ctx->nr;
+    __m128i k;
+    unsigned int round;
+
+    _mm_storeu_si128((__m128i *) dec,
+                     _mm_loadu_si128((const __m128i *)
+                                     (sched + (nr * BLOCK_SIZE))));
+    for (round = 1; round < nr; round++) {
+        k = _mm_loadu_si128((const __m128i *)
+                            (sched + ((nr - round) * BLOCK_SIZE)));
+        _mm_storeu_si128((__m128i *) (dec + (round * BLOCK_SIZE)),
+                         _mm_aesimc_si128(k));
+    }
+    _mm_storeu_si128((__m128i *) (dec + (nr * BLOCK_SIZE)),
+                     _mm_loadu_si128((const __m128i *) sched));
+}
+
+/**
+ * Decrypts blocks with the code for the key size of the schedule
+ */
+static void aesni_decrypt (const struct aes_ctx_s *ctx, unsigned char *out,
+                           const unsigned char *in, size_t blocks) {
+    switch (ctx->nr) {
+    case 12:
+        aesni_dec_192(CTX_DEC_SCHED(ctx), out, in, blocks);
+        break;
+    case 14:
+        aesni_dec_256(CTX_DEC_SCHED(ctx), out, in, blocks);
+        break;
+    default:
+        aesni_dec_128(CTX_DEC_SCHED(ctx), out, in, blocks);
+        break;
+    }
+}
+
+/* Hardware engine */
+const struct engine_s aesni_engine = {
+    "aesni",
+    aesni_setup,
+    aesni_expand,
+    aesni_encrypt,
+    aesni_expand_dec,
+    aesni_decrypt
+};
+
+#else
+
+/**
+ * Not an x86 machine, never available
+ */
+static int aesni_setup () {
+    return -1;
+}
+
+/* Placeholder so the engine list stays the same on every machine */
+const struct engine_s aesni_engine = {
+    "aesni",
+    aesni_setup,
+    0,
+    0,
+    0,
+    0
+};
+
+#endif
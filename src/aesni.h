@@ -0,0 +1,8 @@
+#ifndef AESNI_H_20261017_104810
+#define AESNI_H_20261017_104810
+
+#include "cipher.h"
+
+extern const struct engine_s aesni_engine;
+
+#endif /* AESNI_H_20261017_104810 */
@@ -0,0 +1,113 @@
+/**
+ * AES-NI encryption and decryption, included by aesni.c once per key size
+ * The includer defines AESNI_NR (number of rounds as a literal) and
+ * AESNI_NAME (suffix for every name defined here). Every round is written
+ * out, so nothing loops over rounds or looks at the key size
+ */
+
+#define aesni_enc AESNI_NAME(aesni_enc)
+#define aesni_dec AESNI_NAME(aesni_dec)
+
+/* One full round on every lane and on a single block */
+#define LANES_ENC(R) \
+    for (cx = 0; cx < AESNI_LANES; cx++) { \
+        *(b + cx) = _mm_aesenc_si128(*(b + cx), *(rk + (R))); \
+    }
+#define BLOCK_ENC(R) *b = _mm_aesenc_si128(*b, *(rk + (R)));
+#define LANES_DEC(R) \
+    for (cx = 0; cx < AESNI_LANES; cx++) { \
+        *(b + cx) = _mm_aesdec_si128(*(b + cx), *(rk + (R))); \
+    }
+#define BLOCK_DEC(R) *b = _mm_aesdec_si128(*b, *(rk + (R)));
+
+/**
+ * Encrypts blocks with aesenc/aesenclast
+ * Works on AESNI_LANES independent blocks at a time, then one at a time
+ * for the rest
+ * sched: pointer to unsigned char[(AESNI_NR + 1) * BLOCK_SIZE]
+ */
+AESNI_FN static void aesni_enc (const unsigned char *sched,
+                                unsigned char *out, const unsigned char *in,
+                                size_t blocks) {
+    __m128i rk [AESNI_NR + 1];
+    __m128i b [AESNI_LANES];
+    unsigned int round;
+    unsigned int cx;
+
+    for (round = 0; round < AESNI_NR + 1; round++) {
+        *(rk + round) = _mm_loadu_si128((const __m128i *)
+                                        (sched + (round * BLOCK_SIZE)));
+    }
+
+    for (; blocks >= AESNI_LANES; blocks -= AESNI_LANES) {
+        for (cx = 0; cx < AESNI_LANES; cx++) {
+            *(b + cx) = _mm_xor_si128(
+                _mm_loadu_si128((const __m128i *) (in + (cx * BLOCK_SIZE))),
+                *rk);
+        }
+        FULL_ROUNDS(AESNI_NR)(LANES_ENC)
+        for (cx = 0; cx < AESNI_LANES; cx++) {
+            _mm_storeu_si128((__m128i *) (out + (cx * BLOCK_SIZE)),
+                             _mm_aesenclast_si128(*(b + cx),
+                                                  *(rk + AESNI_NR)));
+        }
+        in += AESNI_LANES * BLOCK_SIZE;
+        out += AESNI_LANES * BLOCK_SIZE;
+    }
+
+    for (; blocks > 0; blocks--, in += BLOCK_SIZE, out += BLOCK_SIZE) {
+        *b = _mm_xor_si128(_mm_loadu_si128((const __m128i *) in), *rk);
+        FULL_ROUNDS(AESNI_NR)(BLOCK_ENC)
+        _mm_storeu_si128((__m128i *) out,
+                         _mm_aesenclast_si128(*b, *(rk + AESNI_NR)));
+    }
+}
+
+/**
+ * Decrypts blocks with aesdec/aesdeclast, interleaved like encryption
+ * dec: pointer to unsigned char[(AESNI_NR + 1) * BLOCK_SIZE]
+ */
+AESNI_FN static void aesni_dec (const unsigned char *dec,
+                                unsigned char *out, const unsigned char *in,
+                                size_t blocks) {
+    __m128i rk [AESNI_NR + 1];
+    __m128i b [AESNI_LANES];
+    unsigned int round;
+    unsigned int cx;
+
+    for (round = 0; round < AESNI_NR + 1; round++) {
+        *(rk + round) = _mm_loadu_si128((const __m128i *)
+                                        (dec + (round * BLOCK_SIZE)));
+    }
+
+    for (; blocks >= AESNI_LANES; blocks -= AESNI_LANES) {
+        for (cx = 0; cx < AESNI_LANES; cx++) {
+            *(b + cx) = _mm_xor_si128(
+                _mm_loadu_si128((const __m128i *) (in + (cx * BLOCK_SIZE))),
+                *rk);
+        }
+        FULL_ROUNDS(AESNI_NR)(LANES_DEC)
+        for (cx = 0; cx < AESNI_LANES; cx++) {
+            _mm_storeu_si128((__m128i *) (out + (cx * BLOCK_SIZE)),
+                             _mm_aesdeclast_si128(*(b + cx),
+                                                  *(rk + AESNI_NR)));
+        }
+        in += AESNI_LANES * BLOCK_SIZE;
+        out += AESNI_LANES * BLOCK_SIZE;
+    }
+
+    for (; blocks > 0; blocks--, in += BLOCK_SIZE, out += BLOCK_SIZE) {
+        *b = _mm_xor_si128(_mm_loadu_si128((const __m128i *) in), *rk);
+        FULL_ROUNDS(AESNI_NR)(BLOCK_DEC)
+        _mm_storeu_si128((__m128i *) out,
+                         _mm_aesdeclast_si128(*b, *(rk + AESNI_NR)));
+    }
+}
+
+#undef LANES_ENC
+#undef BLOCK_ENC
+#undef LANES_DEC
+#undef BLOCK_DEC
+
+#undef aesni_enc
+#undef aesni_dec
@@ -4,10 +4,10 @@
 const unsigned int BPW = 4;
 /* Block size in words */
 const unsigned int NB = 4;
-/* Length of the key in words */
-const unsigned int NK = 4;
-/* Number of rounds */
-const unsigned int NR = 10;
+/* Length of the key in words, set by set_key_size */
+unsigned int NK = 4;
+/* Number of rounds, set by set_key_size */
+unsigned int NR = 10;
 
 /* The S-box, 16x16 with one column for null terminator */
 const char SBOX [16][17] = {
@@ -29,7 +29,33 @@ const char SBOX [16][17] = {
     "\x8c\xa1\x89\x0d\xbf\xe6\x42\x68\x41\x99\x2d\x0f\xb0\x54\xbb\x16"
 };
 
-/* The AES state */
-char **state = 0;
-/* The AES key schedule */
-char **schedule = 0;
+/**
+ * Sets the key size the step by step operations work with
+ * nk: length of the key in words, 4, 6 or 8
+ */
+void set_key_size (unsigned int nk) {
+    NK = nk;
+    NR = nk + 6;
+}
+
+/* The inverse S-box, generated from SBOX by gen_inv_sbox */
+char INV_SBOX [16][16];
+
+/**
+ * Fills INV_SBOX by inverting SBOX
+ * Cheap and idempotent, every user of INV_SBOX calls it first
+ */
+void gen_inv_sbox () {
+    static int done = 0;
+    unsigned int cx;
+    unsigned char s;
+
+    if (done) {
+        return;
+    }
+    for (cx = 0; cx < 256; cx++) {
+        s = (unsigned char) *(*(SBOX + (cx >> 4)) + (cx & 0x0f));
+        *(*(INV_SBOX + (s >> 4)) + (s & 0x0f)) = (char) cx;
+    }
+    done = 1;
+}
@@ -3,12 +3,37 @@
 
 extern const unsigned int BPW;
 extern const unsigned int NB;
-extern const unsigned int NK;
-extern const unsigned int NR;
+extern unsigned int NK;
+extern unsigned int NR;
 
 extern const char SBOX [16][17];
+extern char INV_SBOX [16][16];
 
-extern char **state;
-extern char **schedule;
+/**
+ * Everything a single AES computation works on
+ * Kept in one cache line aligned block so the ops never chase pointers
+ * and many contexts can sit side by side in an array
+ */
+struct aes_ctx_s {
+    /**
+     * The AES key schedule, NB * (NR + 1) words of BPW bytes, room for
+     * the 60 words of AES-256
+     */
+    char schedule [60][4];
+    /**
+     * Schedule for the equivalent inverse cipher, round keys in the
+     * order decryption uses them with inverse mix columns applied to
+     * all but the first and last
+     */
+    char dec_schedule [60][4];
+    /* The AES state, indexed by row then column */
+    char state [4][4];
+    /* Key length in words and number of rounds of the schedule */
+    unsigned int nk;
+    unsigned int nr;
+} __attribute__((aligned(64)));
+
+void set_key_size (unsigned int nk);
+void gen_inv_sbox ();
 
 #endif /* AESVARS_H_20200520_202935 */
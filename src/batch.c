@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "aesvars.h"
+#include "batch.h"
+#include "cipher.h"
+#include "hex.h"
+#include "keycache.h"
+#include "stats.h"
+
+/* Longest line accepted, key and plaintext with some slack */
+#define BATCH_LINE_LEN 256
+/* Output line standing in for a malformed input line */
+#define BATCH_BAD_LINE "error\n"
+
+/**
+ * Splits the next whitespace separated field off a line
+ * p: pointer to the position in the line, moved past the field
+ * len: set to the length of the field
+ * Returns the start of the field
+ */
+static const char *next_field (const char **p, size_t *len) {
+    const char *start = *p + strspn(*p, " \t\r\n");
+
+    *len = strcspn(start, " \t\r\n");
+    *p = start + *len;
+    return start;
+}
+
+/**
+ * Encrypts or decrypts one block per line
+ * Every line holds a hex key of 32, 48 or 64 characters and a hex block
+ * of 32, separated by whitespace, and produces one line of hex output.
+ * Keys go through the key cache, so repeated keys are expanded once.
+ * Output line n always belongs to input line n, so the output can be
+ * pasted next to the input. Blank lines give blank lines. Malformed
+ * lines, including ones with anything but hex digits in the fields or
+ * longer than BATCH_LINE_LEN, are reported on stderr and give
+ * BATCH_BAD_LINE.
+ * eng: engine to encrypt with
+ * in: input stream
+ * out: output stream
+ * decrypt: nonzero to decrypt ciphertext instead of encrypting
+ * Returns the number of malformed lines, or -1 on I/O errors
+ */
+int batch_encrypt (const struct engine_s *eng, FILE *in, FILE *out,
+                   int decrypt) {
+    char line [BATCH_LINE_LEN];
+    char hex [BLOCK_SIZE * 2 + 1];
+    const char *p;
+    const char *keystr;
+    const char *blockstr;
+    size_t keylen;
+    size_t blocklen;
+    size_t restlen;
+    unsigned char key [KEY_SIZE_MAX];
+    unsigned char block [BLOCK_SIZE];
+    const struct aes_ctx_s *ctx;
+    unsigned long lineno = 0;
+    unsigned int nk;
+    int bad = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        lineno++;
+        if (!strchr(line, '\n') && !feof(in)) {
+            /* Longer than any valid line, drop all of it as one line */
+            fprintf(stderr, "Line %lu: line too long\n", lineno);
+            bad++;
+            fputs(BATCH_BAD_LINE, out);
+            while (fgets(line, sizeof(line), in) && !strchr(line, '\n'));
+            continue;
+        }
+        p = line;
+        keystr = next_field(&p, &keylen);
+        if (keylen == 0) {
+            fputc('\n', out);
+            continue;
+        }
+        blockstr = next_field(&p, &blocklen);
+        next_field(&p, &restlen);
+        nk = (keylen % 2) ? 0 : key_words(keylen / 2);
+        if (!nk || blocklen != BLOCK_SIZE * 2 || restlen) {
+            fprintf(stderr, "Line %lu: expected key and %s\n", lineno,
+                    decrypt ? "ciphertext" : "plaintext");
+            bad++;
+            fputs(BATCH_BAD_LINE, out);
+            continue;
+        }
+        if (hex_decode(key, keystr, nk * BPW)
+            || hex_decode(block, blockstr, BLOCK_SIZE)) {
+            fprintf(stderr, "Line %lu: invalid hex digit\n", lineno);
+            bad++;
+            fputs(BATCH_BAD_LINE, out);
+            continue;
+        }
+
+        if (decrypt) {
+            ctx = keycache_get_dec(eng, key, nk);
+            STATS_BEGIN();
+            eng->decrypt(ctx, block, block, 1);
+        } else {
+            ctx = keycache_get(eng, key, nk);
+            STATS_BEGIN();
+            eng->encrypt(ctx, block, block, 1);
+        }
+        STATS_END(STATS_ENGINE_BLOCKS, 0);
+
+        hex_encode(hex, block, BLOCK_SIZE);
+        *(hex + (BLOCK_SIZE * 2)) = '\n';
+        fwrite(hex, 1, sizeof(hex), out);
+    }
+
+    if (ferror(in) || ferror(out) || fflush(out)) {
+        return -1;
+    }
+    return bad;
+}
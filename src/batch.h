@@ -0,0 +1,11 @@
+#ifndef BATCH_H_20261017_141920
+#define BATCH_H_20261017_141920
+
+#include <stdio.h>
+
+#include "cipher.h"
+
+int batch_encrypt (const struct engine_s *eng, FILE *in, FILE *out,
+                   int decrypt);
+
+#endif /* BATCH_H_20261017_141920 */
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "aesvars.h"
+#include "cipher.h"
+#include "gcm.h"
+#include "hex.h"
+#include "ops.h"
+
+/* String of available options */
+const char *optstring = ":hjr:";
+
+/* Blocks per call for the bulk engine cases */
+#define BENCH_BULK_BLOCKS 256
+/* Samples are grown until they take at least this long */
+#define BENCH_SAMPLE_NS 200000
+/* Samples thrown away before measuring */
+#define BENCH_WARMUP 5
+/* Upper limit on the samples per case */
+#define BENCH_MAX_SAMPLES 10000
+
+/* A benchmark case */
+struct bench_s {
+    /* Name reported in the results */
+    const char *name;
+    /* Bytes one operation works on, for cycles per byte */
+    size_t bytes;
+    /* Runs the operation iters times */
+    void (*run) (const struct bench_s *b, size_t iters);
+    /* Engine, blocks per call and schedule for the engine cases */
+    const struct engine_s *eng;
+    size_t blocks;
+    struct aes_ctx_s *ctx;
+    /* GCM key for the GCM cases */
+    const struct gcm_s *gcm;
+};
+
+/* Results of one case, per operation */
+struct result_s {
+    size_t iters;
+    double ns_min;
+    double ns_median;
+    double ns_p90;
+    double ns_p99;
+    double cpb_median;
+};
+
+/* Keeps the compiler from throwing away results */
+volatile char sink;
+
+/* Context the primitives work on */
+struct aes_ctx_s bench_ctx;
+/* Contexts for the larger key sizes */
+struct aes_ctx_s bench_ctx_192;
+struct aes_ctx_s bench_ctx_256;
+/* Buffer for the engine cases */
+unsigned char bench_buf [BENCH_BULK_BLOCKS * BLOCK_SIZE];
+/* GCM keys, with and without the carry-less multiply for every engine */
+struct gcm_s bench_gcm [16];
+/* Hex digits of bench_buf for the codec cases */
+char bench_hex [BENCH_BULK_BLOCKS * BLOCK_SIZE * 2];
+
+/* Key for the key expansion cases */
+const char bench_key[] = "2b7e151628aed2a6abf7158809cf4f3c";
+
+void usage () {
+    printf("Usage: aes128-bench [options]\n");
+    printf("    -h          print this help\n");
+    printf("    -j          print JSON Lines instead of a table\n");
+    printf("    -r samples  timed samples per case, default 101\n");
+}
+
+/**
+ * Monotonic time in nanoseconds
+ */
+unsigned long long now_ns () {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Time stamp counter, 0 where there is none
+ */
+unsigned long long now_tsc () {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void run_poly_mult (const struct bench_s *b, size_t iters) {
+    char acc = 0x57;
+
+    (void) b;
+    for (; iters > 0; iters--) {
+        acc = poly_mult(acc, 0x13) ^ (char) iters;
+    }
+    sink = acc;
+}
+
+void run_xor_word (const struct bench_s *b, size_t iters) {
+    char w [4] = {0x01, 0x02, 0x03, 0x04};
+
+    (void) b;
+    for (; iters > 0; iters--) {
+        xor_word(*(bench_ctx.state), w);
+    }
+    sink = **bench_ctx.state;
+}
+
+void run_sub_byte (const struct bench_s *b, size_t iters) {
+    char acc = 0;
+
+    (void) b;
+    for (; iters > 0; iters--) {
+        acc = sub_byte(acc ^ (char) iters);
+    }
+    sink = acc;
+}
+
+void run_shift_row (const struct bench_s *b, size_t iters) {
+    (void) b;
+    for (; iters > 0; iters--) {
+        shift_row(*(bench_ctx.state + 1), 1);
+    }
+    sink = **(bench_ctx.state + 1);
+}
+
+void run_mix_col (const struct bench_s *b, size_t iters) {
+    (void) b;
+    for (; iters > 0; iters--) {
+        mix_col(&bench_ctx, iters & 3);
+    }
+    sink = **bench_ctx.state;
+}
+
+void run_inv_sub_byte (const struct bench_s *b, size_t iters) {
+    char acc = 0;
+
+    (void) b;
+    for (; iters > 0; iters--) {
+        acc = inv_sub_byte(acc ^ (char) iters);
+    }
+    sink = acc;
+}
+
+void run_inv_mix_col (const struct bench_s *b, size_t iters) {
+    (void) b;
+    for (; iters > 0; iters--) {
+        inv_mix_col(&bench_ctx, iters & 3);
+    }
+    sink = **bench_ctx.state;
+}
+
+void run_add_round_key (const struct bench_s *b, size_t iters) {
+    (void) b;
+    for (; iters > 0; iters--) {
+        add_round_key(&bench_ctx, iters % (NR + 1));
+    }
+    sink = **bench_ctx.state;
+}
+
+void run_key_expand (const struct bench_s *b, size_t iters) {
+    (void) b;
+    for (; iters > 0; iters--) {
+        key_expand(&bench_ctx, bench_key);
+    }
+    sink = **bench_ctx.schedule;
+}
+
+void run_engine_expand (const struct bench_s *b, size_t iters) {
+    for (; iters > 0; iters--) {
+        b->eng->expand(&bench_ctx, bench_buf, NK);
+        *bench_buf ^= **bench_ctx.schedule;
+    }
+    sink = *bench_buf;
+}
+
+void run_engine_encrypt (const struct bench_s *b, size_t iters) {
+    for (; iters > 0; iters--) {
+        b->eng->encrypt(b->ctx, bench_buf, bench_buf, b->blocks);
+    }
+    sink = *bench_buf;
+}
+
+void run_engine_decrypt (const struct bench_s *b, size_t iters) {
+    for (; iters > 0; iters--) {
+        b->eng->decrypt(b->ctx, bench_buf, bench_buf, b->blocks);
+    }
+    sink = *bench_buf;
+}
+
+void run_gcm_encrypt (const struct bench_s *b, size_t iters) {
+    unsigned char iv [GCM_IV_SIZE] = {0};
+    unsigned char tag [GCM_TAG_SIZE];
+
+    for (; iters > 0; iters--) {
+        gcm_encrypt(b->gcm, iv, sizeof(iv), 0, 0, bench_buf,
+                    b->blocks * BLOCK_SIZE, tag, sizeof(tag));
+        *iv ^= *tag;
+    }
+    sink = *bench_buf;
+}
+
+void run_hex_encode (const struct bench_s *b, size_t iters) {
+    (void) b;
+    for (; iters > 0; iters--) {
+        hex_encode(bench_hex, bench_buf, sizeof(bench_buf));
+        *bench_buf ^= *bench_hex;
+    }
+    sink = *bench_hex;
+}
+
+void run_hex_decode (const struct bench_s *b, size_t iters) {
+    (void) b;
+    for (; iters > 0; iters--) {
+        sink ^= hex_decode(bench_buf, bench_hex, sizeof(bench_buf));
+    }
+    sink ^= *bench_buf;
+}
+
+/**
+ * Compares doubles for qsort
+ */
+int cmp_double (const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Times a case
+ * Finds an iteration count that makes a sample take BENCH_SAMPLE_NS,
+ * warms up, then takes the given number of samples
+ * b: case to time
+ * samples: number of samples
+ * r: filled with the per operation figures
+ */
+void bench_case (const struct bench_s *b, unsigned int samples,
+                 struct result_s *r) {
+    double *ns = malloc(samples * sizeof(*ns));
+    double *cyc = malloc(samples * sizeof(*cyc));
+    unsigned long long t0;
+    unsigned long long c0;
+    size_t iters = 1;
+    unsigned int cx;
+
+    /* Calibrate */
+    for (;;) {
+        t0 = now_ns();
+        b->run(b, iters);
+        if (now_ns() - t0 >= BENCH_SAMPLE_NS || iters >= (1UL << 30)) {
+            break;
+        }
+        iters *= 2;
+    }
+    for (cx = 0; cx < BENCH_WARMUP; cx++) {
+        b->run(b, iters);
+    }
+
+    for (cx = 0; cx < samples; cx++) {
+        t0 = now_ns();
+        c0 = now_tsc();
+        b->run(b, iters);
+        *(cyc + cx) = (double) (now_tsc() - c0) / iters;
+        *(ns + cx) = (double) (now_ns() - t0) / iters;
+    }
+    qsort(ns, samples, sizeof(*ns), cmp_double);
+    qsort(cyc, samples, sizeof(*cyc), cmp_double);
+
+    r->iters = iters;
+    r->ns_min = *ns;
+    r->ns_median = *(ns + (samples / 2));
+    r->ns_p90 = *(ns + ((samples * 90) / 100));
+    r->ns_p99 = *(ns + ((samples * 99) / 100));
+    r->cpb_median = *(cyc + (samples / 2)) / b->bytes;
+
+    free(ns);
+    free(cyc);
+}
+
+/**
+ * Prints one result
+ * json: nonzero for a JSON Lines record, otherwise a table row
+ */
+void report (const struct bench_s *b, const struct result_s *r, int json) {
+    if (json) {
+        printf("{\"bench\":\"%s\",\"bytes\":%lu,\"iters\":%lu,"
+               "\"ns_min\":%.3f,\"ns_median\":%.3f,\"ns_p90\":%.3f,"
+               "\"ns_p99\":%.3f,\"cpb_median\":%.3f}\n",
+               b->name, (unsigned long) b->bytes, (unsigned long) r->iters,
+               r->ns_min, r->ns_median, r->ns_p90, r->ns_p99,
+               r->cpb_median);
+    } else {
+        printf("%-28s %6lu %12.2f %12.2f %12.2f %10.2f\n",
+               b->name, (unsigned long) b->bytes,
+               r->ns_median, r->ns_p90, r->ns_p99, r->cpb_median);
+    }
+    fflush(stdout);
+}
+
+/* Cases to run, room for the primitives plus seven per engine */
+struct bench_s cases [64];
+char case_names [64][40];
+unsigned int case_count = 0;
+
+/**
+ * Adds a case to the list, working on the AES-128 context
+ * name: printf format for the name, with an optional %s for the engine
+ * Returns the case so the caller can change the context
+ */
+struct bench_s *add_case (const char *name, size_t bytes,
+                          void (*run) (const struct bench_s *b,
+                                       size_t iters),
+                          const struct engine_s *eng, size_t blocks) {
+    struct bench_s *b = cases + case_count;
+
+    snprintf(*(case_names + case_count), sizeof(*case_names), name,
+             eng ? eng->name : "");
+    b->name = *(case_names + case_count);
+    b->bytes = bytes;
+    b->run = run;
+    b->eng = eng;
+    b->blocks = blocks;
+    b->ctx = &bench_ctx;
+    b->gcm = 0;
+    case_count++;
+    return b;
+}
+
+int main (int argc, char **argv) {
+    const struct engine_s **e;
+    struct gcm_s *g = bench_gcm;
+    struct result_s r;
+    unsigned int samples = 101;
+    unsigned int cx;
+    int json = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, optstring)) != -1) {
+        switch (opt) {
+        case 'j':
+            json = 1;
+            break;
+        case 'r':
+            samples = strtoul(optarg, 0, 10);
+            if (samples == 0 || samples > BENCH_MAX_SAMPLES) {
+                printf("Samples must be 1 to %u\n", BENCH_MAX_SAMPLES);
+                exit(1);
+            }
+            break;
+        case 'h':
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    /* Nothing records events, so only the primitives are timed */
+    key_expand(&bench_ctx, bench_key);
+    expand_dec_key(&bench_ctx);
+    expand_key(&bench_ctx_192, bench_buf, 6);
+    expand_key(&bench_ctx_256, bench_buf, 8);
+
+    /* The step by step primitives */
+    add_case("poly_mult", 1, run_poly_mult, 0, 0);
+    add_case("xor_word", BPW, run_xor_word, 0, 0);
+    add_case("sub_byte", 1, run_sub_byte, 0, 0);
+    add_case("shift_row", BPW, run_shift_row, 0, 0);
+    add_case("mix_col", BPW, run_mix_col, 0, 0);
+    add_case("inv_sub_byte", 1, run_inv_sub_byte, 0, 0);
+    add_case("inv_mix_col", BPW, run_inv_mix_col, 0, 0);
+    add_case("add_round_key", BLOCK_SIZE, run_add_round_key, 0, 0);
+    add_case("key_expand", BLOCK_SIZE, run_key_expand, 0, 0);
+    add_case("hex_encode", sizeof(bench_buf), run_hex_encode, 0, 0);
+    add_case("hex_decode", sizeof(bench_buf), run_hex_decode, 0, 0);
+
+    /* Key expansion, one block and bulk both ways for every engine */
+    for (e = engines; *e; e++) {
+        if ((*e)->setup()) {
+            continue;
+        }
+        add_case("expand/%s", BLOCK_SIZE, run_engine_expand, *e, 0);
+        add_case("block/%s", BLOCK_SIZE, run_engine_encrypt, *e, 1);
+        add_case("bulk256/%s", BENCH_BULK_BLOCKS * BLOCK_SIZE,
+                 run_engine_encrypt, *e, BENCH_BULK_BLOCKS);
+        add_case("block-dec/%s", BLOCK_SIZE, run_engine_decrypt, *e, 1);
+        add_case("bulk256-dec/%s", BENCH_BULK_BLOCKS * BLOCK_SIZE,
+                 run_engine_decrypt, *e, BENCH_BULK_BLOCKS);
+        add_case("bulk256-k192/%s", BENCH_BULK_BLOCKS * BLOCK_SIZE,
+                 run_engine_encrypt, *e, BENCH_BULK_BLOCKS)->ctx
+            = &bench_ctx_192;
+        add_case("bulk256-k256/%s", BENCH_BULK_BLOCKS * BLOCK_SIZE,
+                 run_engine_encrypt, *e, BENCH_BULK_BLOCKS)->ctx
+            = &bench_ctx_256;
+
+        /* GCM against bulk256, the tables only show where they differ */
+        gcm_init(g, *e, &bench_ctx);
+        add_case("gcm256/%s", BENCH_BULK_BLOCKS * BLOCK_SIZE,
+                 run_gcm_encrypt, *e, BENCH_BULK_BLOCKS)->gcm = g;
+        if (g->clmul) {
+            *(g + 1) = *g;
+            (g + 1)->clmul = 0;
+            add_case("gcm256-tables/%s", BENCH_BULK_BLOCKS * BLOCK_SIZE,
+                     run_gcm_encrypt, *e, BENCH_BULK_BLOCKS)->gcm = g + 1;
+        }
+        g += 2;
+    }
+
+    if (!json) {
+        printf("%-28s %6s %12s %12s %12s %10s\n", "case", "bytes",
+               "ns/op med", "ns/op p90", "ns/op p99", "cyc/B med");
+    }
+    for (cx = 0; cx < case_count; cx++) {
+        bench_case(cases + cx, samples, &r);
+        report(cases + cx, &r, json);
+    }
+    return 0;
+}
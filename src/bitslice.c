@@ -0,0 +1,176 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bitslice.h"
+#include "cipher.h"
+
+/* Rows of both columns in a half */
+#define ROW0 0x000000ff000000ffULL
+#define ROW1 0x0000ff000000ff00ULL
+#define ROW2 0x00ff000000ff0000ULL
+#define ROW3 0xff000000ff000000ULL
+
+/* Row r of a column takes row r + 1 / r + 2 of the same column */
+#define COL_ROT1(X) ((((X) >> 8) & 0x00ffffff00ffffffULL) \
+                   | (((X) << 24) & 0xff000000ff000000ULL))
+#define COL_ROT2(X) ((((X) >> 16) & 0x0000ffff0000ffffULL) \
+                   | (((X) << 16) & 0xffff0000ffff0000ULL))
+
+/* The same in the narrow layout, where a column is a nybble */
+#define NIB_ROT1(X) ((((X) >> 1) & 0x7777777777777777ULL) \
+                   | (((X) << 3) & 0x8888888888888888ULL))
+#define NIB_ROT2(X) ((((X) >> 2) & 0x3333333333333333ULL) \
+                   | (((X) << 2) & 0xccccccccccccccccULL))
+
+/* Little endian load and store, a single instruction on x86 */
+#define LOAD64(P) ((uint64_t) *(P) \
+                 | ((uint64_t) *((P) + 1) << 8) \
+                 | ((uint64_t) *((P) + 2) << 16) \
+                 | ((uint64_t) *((P) + 3) << 24) \
+                 | ((uint64_t) *((P) + 4) << 32) \
+                 | ((uint64_t) *((P) + 5) << 40) \
+                 | ((uint64_t) *((P) + 6) << 48) \
+                 | ((uint64_t) *((P) + 7) << 56))
+#define STORE64(P,W) do { \
+        *(P) = (unsigned char) (W); \
+        *((P) + 1) = (unsigned char) ((W) >> 8); \
+        *((P) + 2) = (unsigned char) ((W) >> 16); \
+        *((P) + 3) = (unsigned char) ((W) >> 24); \
+        *((P) + 4) = (unsigned char) ((W) >> 32); \
+        *((P) + 5) = (unsigned char) ((W) >> 40); \
+        *((P) + 6) = (unsigned char) ((W) >> 48); \
+        *((P) + 7) = (unsigned char) ((W) >> 56); \
+    } while (0)
+
+/* Swaps the bits of a selected by mask << n with the bits of b in mask */
+#define SWAPMOVE(A,B,MASK,N) do { \
+        bs_word sm_ = (((A) >> (N)) ^ (B)) & (MASK); \
+        (B) ^= sm_; \
+        (A) ^= sm_ << (N); \
+    } while (0)
+
+/* 4 blocks per batch in plain 64 bit integers, for short calls and tails */
+#define BS_NARROW 1
+#define BS_ATTR
+#define BS_NAME(N) N ## _4
+#include "bitslice_kern.h"
+#undef BS_NAME
+#undef BS_ATTR
+#undef BS_NARROW
+
+/* 8 blocks per batch, SSE2 or plain 64 bit integers */
+#define BS_GROUPS 1
+#define BS_ATTR
+#define BS_NAME(N) N ## _8
+#include "bitslice_kern.h"
+#undef BS_NAME
+#undef BS_ATTR
+#undef BS_GROUPS
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BS_WIDE 1
+
+/* 16 blocks per batch with AVX2, picked at runtime */
+#define BS_GROUPS 2
+#define BS_ATTR __attribute__((target("avx2")))
+#define BS_NAME(N) N ## _16
+#include "bitslice_kern.h"
+#undef BS_NAME
+#undef BS_ATTR
+#undef BS_GROUPS
+#endif
+
+/* Kernels picked by bitslice_setup */
+static void (*bs_kernel) (unsigned char *out, const unsigned char *in,
+                          size_t blocks, const unsigned char *sched,
+                          unsigned int nr) = 0;
+static void (*bs_kernel_dec) (unsigned char *out, const unsigned char *in,
+                              size_t blocks, const unsigned char *dec,
+                              unsigned int nr) = 0;
+/* Blocks per batch of the picked kernels */
+static size_t bs_lanes = 8;
+
+/**
+ * Picks the widest kernel the CPU supports
+ * Returns 0, the 8 block kernel runs everywhere
+ */
+static int bitslice_setup () {
+    bs_kernel = bs_encrypt_8;
+    bs_kernel_dec = bs_decrypt_8;
+    bs_lanes = 8;
+#ifdef BS_WIDE
+    if (__builtin_cpu_supports("avx2")) {
+        bs_kernel = bs_encrypt_16;
+        bs_kernel_dec = bs_decrypt_16;
+        bs_lanes = 16;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Encrypts blocks in batches without any data dependent memory access
+ * or branches
+ * Whole batches go through the picked kernel and the rest through the
+ * narrowest kernel that takes it in one batch. A batch costs the same
+ * however few blocks it holds, and callers chaining blocks one at a time
+ * would otherwise pay for 16.
+ */
+static void bitslice_encrypt (const struct aes_ctx_s *ctx,
+                              unsigned char *out, const unsigned char *in,
+                              size_t blocks) {
+    size_t tail = blocks % bs_lanes;
+    size_t done = blocks - tail;
+
+    if (done) {
+        bs_kernel(out, in, done, CTX_SCHED(ctx), ctx->nr);
+    }
+    out += done * BLOCK_SIZE;
+    in += done * BLOCK_SIZE;
+    if (tail > 8) {
+        bs_kernel(out, in, tail, CTX_SCHED(ctx), ctx->nr);
+    } else if (tail > 4) {
+        bs_encrypt_8(out, in, tail, CTX_SCHED(ctx), ctx->nr);
+    } else if (tail) {
+        bs_encrypt_4(out, in, tail, CTX_SCHED(ctx), ctx->nr);
+    }
+}
+
+/**
+ * Decrypts blocks in batches, constant time and split up like
+ * bitslice_encrypt
+ */
+static void bitslice_decrypt (const struct aes_ctx_s *ctx,
+                              unsigned char *out, const unsigned char *in,
+                              size_t blocks) {
+    size_t tail = blocks % bs_lanes;
+    size_t done = blocks - tail;
+
+    if (done) {
+        bs_kernel_dec(out, in, done, CTX_DEC_SCHED(ctx), ctx->nr);
+    }
+    out += done * BLOCK_SIZE;
+    in += done * BLOCK_SIZE;
+    if (tail > 8) {
+        bs_kernel_dec(out, in, tail, CTX_DEC_SCHED(ctx), ctx->nr);
+    } else if (tail > 4) {
+        bs_decrypt_8(out, in, tail, CTX_DEC_SCHED(ctx), ctx->nr);
+    } else if (tail) {
+        bs_decrypt_4(out, in, tail, CTX_DEC_SCHED(ctx), ctx->nr);
+    }
+}
+
+/**
+ * Constant time bitsliced engine
+ * Shares expand_key with the other software engines, which still looks
+ * up the s-box by key bytes, but only once per key and not per block
+ */
+const struct engine_s bitslice_engine = {
+    "bitslice",
+    bitslice_setup,
+    expand_key,
+    bitslice_encrypt,
+    expand_dec_key,
+    bitslice_decrypt
+};
@@ -0,0 +1,8 @@
+#ifndef BITSLICE_H_20261017_113026
+#define BITSLICE_H_20261017_113026
+
+#include "cipher.h"
+
+extern const struct engine_s bitslice_engine;
+
+#endif /* BITSLICE_H_20261017_113026 */
@@ -0,0 +1,776 @@
+/**
+ * Bitsliced AES kernel, included by bitslice.c once per plane width
+ * The includer defines BS_GROUPS (groups of 8 blocks per plane) or
+ * BS_NARROW (4 blocks in plain 64 bit words), BS_ATTR (function
+ * attributes for the target) and BS_NAME (suffix for every name defined
+ * here)
+ */
+
+#define bs_word BS_NAME(bs_word)
+#define bs_state BS_NAME(bs_state)
+#define HALF_SWAP BS_NAME(HALF_SWAP)
+#define bs_transpose BS_NAME(bs_transpose)
+#define bs_pack BS_NAME(bs_pack)
+#define bs_unpack BS_NAME(bs_unpack)
+#define bs_key BS_NAME(bs_key)
+#define bs_sched_s BS_NAME(bs_sched_s)
+#define bs_enc_keys BS_NAME(bs_enc_keys)
+#define bs_dec_keys BS_NAME(bs_dec_keys)
+#define bs_keys BS_NAME(bs_keys)
+#define bs_sbox BS_NAME(bs_sbox)
+#define bs_shift_rows BS_NAME(bs_shift_rows)
+#define bs_mix_cols BS_NAME(bs_mix_cols)
+#define bs_add_key BS_NAME(bs_add_key)
+#define bs_encrypt BS_NAME(bs_encrypt)
+#define bs_inv_affine BS_NAME(bs_inv_affine)
+#define bs_inv_sbox BS_NAME(bs_inv_sbox)
+#define bs_inv_shift_rows BS_NAME(bs_inv_shift_rows)
+#define bs_xtime BS_NAME(bs_xtime)
+#define bs_inv_mix_cols BS_NAME(bs_inv_mix_cols)
+#define bs_decrypt BS_NAME(bs_decrypt)
+
+/* Helpers are always inlined so the vectors never cross a call */
+#define BS_INLINE static inline __attribute__((always_inline)) BS_ATTR
+
+#ifdef BS_NARROW
+
+/* Blocks encrypted together */
+#define BS_LANES 4
+/* Row r of a column takes row r + 1 / r + 2 */
+#define BS_ROT1(X) NIB_ROT1(X)
+#define BS_ROT2(X) NIB_ROT2(X)
+
+/**
+ * One bit plane of 4 blocks
+ * A batch costs the same operations however few of its blocks are used,
+ * so the last few blocks of a call take this layout rather than a
+ * padded batch of 8 or 16
+ */
+typedef uint64_t bs_word;
+
+/**
+ * Bitsliced state
+ * Plane k holds bit k of every byte, 16 bits per block with block b from
+ * bit 16b. Bit r + 4c of a block is row r of column c, the byte position,
+ * so a column is a nybble and rows move by shifts within a block
+ */
+typedef bs_word bs_state [8];
+
+/**
+ * Transposes the 8x8 bit matrix in a word, bit k of byte b swaps with
+ * bit b of byte k
+ * Turns 8 bytes of a block into a byte of each plane and back
+ */
+BS_INLINE uint64_t bs_transpose (uint64_t x) {
+    uint64_t t;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+/**
+ * Transposes up to BS_LANES blocks into bit planes, missing blocks are
+ * zero
+ * in: pointer to unsigned char[n * BLOCK_SIZE]
+ * n: number of blocks, at most BS_LANES
+ */
+BS_INLINE void bs_pack (bs_state q, const unsigned char *in, size_t n) {
+    uint64_t lo;
+    uint64_t hi;
+    unsigned int blk;
+    unsigned int k;
+
+    memset(q, 0, sizeof(bs_state));
+    for (blk = 0; blk < n; blk++) {
+        lo = bs_transpose(LOAD64(in));
+        hi = bs_transpose(LOAD64(in + 8));
+        for (k = 0; k < 8; k++) {
+            *(q + k) |= (((lo >> (8 * k)) & 0xff)
+                         | (((hi >> (8 * k)) & 0xff) << 8)) << (16 * blk);
+        }
+        in += BLOCK_SIZE;
+    }
+}
+
+/**
+ * Transposes bit planes back into blocks, the inverse of bs_pack
+ * out: pointer to unsigned char[n * BLOCK_SIZE]
+ * n: number of blocks, at most BS_LANES
+ */
+BS_INLINE void bs_unpack (unsigned char *out, bs_state q, size_t n) {
+    uint64_t lo;
+    uint64_t hi;
+    unsigned int blk;
+    unsigned int k;
+
+    for (blk = 0; blk < n; blk++) {
+        lo = 0;
+        hi = 0;
+        for (k = 0; k < 8; k++) {
+            lo |= ((*(q + k) >> (16 * blk)) & 0xff) << (8 * k);
+            hi |= ((*(q + k) >> ((16 * blk) + 8)) & 0xff) << (8 * k);
+        }
+        STORE64(out, bs_transpose(lo));
+        STORE64(out + 8, bs_transpose(hi));
+        out += BLOCK_SIZE;
+    }
+}
+
+/**
+ * Spreads a round key over all the blocks
+ * rk: pointer to unsigned char[BLOCK_SIZE]
+ */
+BS_INLINE void bs_key (bs_state q, const unsigned char *rk) {
+    unsigned int pos;
+    unsigned int k;
+
+    memset(q, 0, sizeof(bs_state));
+    for (pos = 0; pos < BLOCK_SIZE; pos++) {
+        for (k = 0; k < 8; k++) {
+            *(q + k) |= (uint64_t) ((*(rk + pos) >> k) & 1) << pos;
+        }
+    }
+    for (k = 0; k < 8; k++) {
+        *(q + k) |= *(q + k) << 16;
+        *(q + k) |= *(q + k) << 32;
+    }
+}
+
+/**
+ * Shifts the rows, row r of column c takes row r of column c + r
+ * Row r of columns below 4 - r comes 4r bits down, the rest wraps
+ * around 16 - 4r bits up, never leaving the block
+ */
+BS_INLINE void bs_shift_rows (bs_state q) {
+    unsigned int k;
+    bs_word x;
+
+    for (k = 0; k < 8; k++) {
+        x = *(q + k);
+        *(q + k) = (x & 0x1111111111111111ULL)
+                 | ((x >> 4) & 0x0222022202220222ULL)
+                 | ((x << 12) & 0x2000200020002000ULL)
+                 | ((x >> 8) & 0x0044004400440044ULL)
+                 | ((x << 8) & 0x4400440044004400ULL)
+                 | ((x >> 12) & 0x0008000800080008ULL)
+                 | ((x << 4) & 0x8880888088808880ULL);
+    }
+}
+
+/**
+ * Inverse shift rows, row r of column c takes row r of column c - r
+ */
+BS_INLINE void bs_inv_shift_rows (bs_state q) {
+    unsigned int k;
+    bs_word x;
+
+    for (k = 0; k < 8; k++) {
+        x = *(q + k);
+        *(q + k) = (x & 0x1111111111111111ULL)
+                 | ((x << 4) & 0x2220222022202220ULL)
+                 | ((x >> 12) & 0x0002000200020002ULL)
+                 | ((x >> 8) & 0x0044004400440044ULL)
+                 | ((x << 8) & 0x4400440044004400ULL)
+                 | ((x << 12) & 0x8000800080008000ULL)
+                 | ((x >> 4) & 0x0888088808880888ULL);
+    }
+}
+
+#else
+
+/* Blocks encrypted together */
+#define BS_LANES (8 * BS_GROUPS)
+/* Row r of a column takes row r + 1 / r + 2 */
+#define BS_ROT1(X) COL_ROT1(X)
+#define BS_ROT2(X) COL_ROT2(X)
+
+/**
+ * One bit plane, two 64 bit halves per group of 8 blocks
+ * GCC turns the operators on this into vector instructions of the
+ * target, 128 bit wide for one group and 256 bit wide for two
+ */
+typedef uint64_t bs_word __attribute__((vector_size(16 * BS_GROUPS)));
+
+/**
+ * Bitsliced state
+ * Plane k holds bit k of every byte, one byte of the plane per byte
+ * position with bit b of it from block b of the group. Byte positions
+ * 0-7 (columns 0 and 1) of group g live in element 2g, 8-15 (columns 2
+ * and 3) in element 2g + 1, so every transformation is a fixed sequence
+ * of word operations
+ */
+typedef bs_word bs_state [8];
+
+/* Swaps the two halves of every group */
+static const bs_word HALF_SWAP = {
+#if BS_GROUPS == 1
+    1, 0
+#elif BS_GROUPS == 2
+    1, 0, 3, 2
+#else
+#error "BS_GROUPS must be 1 or 2"
+#endif
+};
+
+/**
+ * Transposes the 8x8 bit matrix in every byte lane, bit k of word b
+ * swaps with bit b of word k
+ * Turns 8 blocks into 8 bit planes and back
+ */
+BS_INLINE void bs_transpose (bs_state q) {
+    SWAPMOVE(*(q + 0), *(q + 1), 0x5555555555555555ULL, 1);
+    SWAPMOVE(*(q + 2), *(q + 3), 0x5555555555555555ULL, 1);
+    SWAPMOVE(*(q + 4), *(q + 5), 0x5555555555555555ULL, 1);
+    SWAPMOVE(*(q + 6), *(q + 7), 0x5555555555555555ULL, 1);
+    SWAPMOVE(*(q + 0), *(q + 2), 0x3333333333333333ULL, 2);
+    SWAPMOVE(*(q + 1), *(q + 3), 0x3333333333333333ULL, 2);
+    SWAPMOVE(*(q + 4), *(q + 6), 0x3333333333333333ULL, 2);
+    SWAPMOVE(*(q + 5), *(q + 7), 0x3333333333333333ULL, 2);
+    SWAPMOVE(*(q + 0), *(q + 4), 0x0f0f0f0f0f0f0f0fULL, 4);
+    SWAPMOVE(*(q + 1), *(q + 5), 0x0f0f0f0f0f0f0f0fULL, 4);
+    SWAPMOVE(*(q + 2), *(q + 6), 0x0f0f0f0f0f0f0f0fULL, 4);
+    SWAPMOVE(*(q + 3), *(q + 7), 0x0f0f0f0f0f0f0f0fULL, 4);
+}
+
+/**
+ * Transposes up to BS_LANES blocks into bit planes, missing blocks are
+ * zero
+ * Block b of group g is loaded into word b, element 2g and 2g + 1,
+ * then bit k of every byte is gathered into word k
+ * in: pointer to unsigned char[n * BLOCK_SIZE]
+ * n: number of blocks, at most BS_LANES
+ */
+BS_INLINE void bs_pack (bs_state q, const unsigned char *in, size_t n) {
+    unsigned char buf [BS_LANES * BLOCK_SIZE];
+    unsigned int grp;
+    unsigned int blk;
+
+    /* Only a short final batch goes through the bounce buffer */
+    if (n < BS_LANES) {
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, in, n * BLOCK_SIZE);
+        in = buf;
+    }
+    for (grp = 0; grp < BS_GROUPS; grp++) {
+        for (blk = 0; blk < 8; blk++) {
+            q[blk][2 * grp] = LOAD64(in);
+            q[blk][(2 * grp) + 1] = LOAD64(in + 8);
+            in += BLOCK_SIZE;
+        }
+    }
+    bs_transpose(q);
+}
+
+/**
+ * Transposes bit planes back into blocks, the inverse of bs_pack
+ * out: pointer to unsigned char[n * BLOCK_SIZE]
+ * n: number of blocks, at most BS_LANES
+ */
+BS_INLINE void bs_unpack (unsigned char *out, bs_state q, size_t n) {
+    unsigned char buf [BS_LANES * BLOCK_SIZE];
+    unsigned char *dst = (n < BS_LANES) ? buf : out;
+    unsigned int grp;
+    unsigned int blk;
+
+    bs_transpose(q);
+    for (grp = 0; grp < BS_GROUPS; grp++) {
+        for (blk = 0; blk < 8; blk++) {
+            STORE64(dst, q[blk][2 * grp]);
+            STORE64(dst + 8, q[blk][(2 * grp) + 1]);
+            dst += BLOCK_SIZE;
+        }
+    }
+    if (n < BS_LANES) {
+        memcpy(out, buf, n * BLOCK_SIZE);
+    }
+}
+
+/**
+ * Spreads a round key over all the blocks, every bit becomes a full byte
+ * rk: pointer to unsigned char[BLOCK_SIZE]
+ */
+BS_INLINE void bs_key (bs_state q, const unsigned char *rk) {
+    unsigned int grp;
+    unsigned int pos;
+    unsigned int k;
+    uint64_t bit;
+
+    memset(q, 0, sizeof(bs_state));
+    for (pos = 0; pos < BLOCK_SIZE; pos++) {
+        for (k = 0; k < 8; k++) {
+            /* 0x00 or 0xff without branching on the key */
+            bit = (*(rk + pos) >> k) & 1;
+            bit = ((uint64_t) 0 - bit) & (0xffULL << (8 * (pos & 7)));
+            for (grp = 0; grp < BS_GROUPS; grp++) {
+                q[k][(2 * grp) + (pos >> 3)] |= bit;
+            }
+        }
+    }
+}
+
+/**
+ * Shifts the rows, row r of column c takes row r of column c + r
+ * Columns c + 1 and c + 3 are in the other half for one of the two
+ * columns in a half, so rows 1 and 3 rotate each group's 128 bits by a
+ * column and row 2 swaps the halves
+ */
+BS_INLINE void bs_shift_rows (bs_state q) {
+    unsigned int k;
+    bs_word x;
+    bs_word sw;
+
+    for (k = 0; k < 8; k++) {
+        x = *(q + k);
+        sw = __builtin_shuffle(x, HALF_SWAP);
+        *(q + k) = (x & ROW0)
+                 | (((x >> 32) | (sw << 32)) & ROW1)
+                 | (sw & ROW2)
+                 | (((x << 32) | (sw >> 32)) & ROW3);
+    }
+}
+
+/**
+ * Inverse shift rows, row r of column c takes row r of column c - r
+ * Same as bs_shift_rows with rows 1 and 3 trading places
+ */
+BS_INLINE void bs_inv_shift_rows (bs_state q) {
+    unsigned int k;
+    bs_word x;
+    bs_word sw;
+
+    for (k = 0; k < 8; k++) {
+        x = *(q + k);
+        sw = __builtin_shuffle(x, HALF_SWAP);
+        *(q + k) = (x & ROW0)
+                 | (((x << 32) | (sw >> 32)) & ROW1)
+                 | (sw & ROW2)
+                 | (((x >> 32) | (sw << 32)) & ROW3);
+    }
+}
+
+#endif /* BS_NARROW */
+
+/* Round keys bitsliced for a schedule */
+struct bs_sched_s {
+    bs_state rk [15];
+    /* Schedule they were bitsliced from, nr is 0 before the first */
+    unsigned char raw [SCHED_SIZE];
+    unsigned int nr;
+};
+
+/**
+ * Last round keys bitsliced by each thread, one set for encryption and
+ * one for decryption. Callers mostly encrypt under one key in many
+ * calls of a block or a few, where bitslicing the schedule every time
+ * costs more than the blocks themselves
+ */
+static __thread struct bs_sched_s bs_enc_keys;
+static __thread struct bs_sched_s bs_dec_keys;
+
+/**
+ * Gets the bitsliced round keys of a schedule, bitslicing them only if
+ * the schedule isn't the one the cache holds
+ * The schedules are compared without an early exit, how far two keys
+ * match doesn't show in the time taken
+ * c: pointer to the bs_sched_s of this thread to use
+ * sched: pointer to unsigned char[(nr + 1) * BLOCK_SIZE]
+ * nr: number of rounds of the schedule
+ * Returns the nr + 1 bitsliced round keys
+ */
+static BS_ATTR const bs_state *bs_keys (struct bs_sched_s *c,
+                                        const unsigned char *sched,
+                                        unsigned int nr) {
+    size_t len = (nr + 1) * BLOCK_SIZE;
+    uint64_t diff = c->nr ^ nr;
+    unsigned int round;
+    size_t cx;
+
+    for (cx = 0; cx < len; cx += 8) {
+        diff |= LOAD64(c->raw + cx) ^ LOAD64(sched + cx);
+    }
+    if (diff) {
+        for (round = 0; round < nr + 1; round++) {
+            bs_key(*(c->rk + round), sched + (round * BLOCK_SIZE));
+        }
+        memcpy(c->raw, sched, len);
+        c->nr = nr;
+    }
+    return (const bs_state *) c->rk;
+}
+
+/**
+ * The s-box as a boolean circuit on all of the planes
+ * Boyar and Peralta, "A new combinational logic minimization technique
+ * with applications to cryptology", inputs and outputs numbered from the
+ * high bit
+ */
+BS_INLINE void bs_sbox (bs_state q) {
+    bs_word x0, x1, x2, x3, x4, x5, x6, x7;
+    bs_word y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11;
+    bs_word y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+    bs_word z0, z1, z2, z3, z4, z5, z6, z7, z8;
+    bs_word z9, z10, z11, z12, z13, z14, z15, z16, z17;
+    bs_word t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    bs_word t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    bs_word t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+    bs_word t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    bs_word t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+    bs_word t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    bs_word t60, t61, t62, t63, t64, t65, t66, t67;
+    bs_word s0, s1, s2, s3, s4, s5, s6, s7;
+
+    x0 = *(q + 7);
+    x1 = *(q + 6);
+    x2 = *(q + 5);
+    x3 = *(q + 4);
+    x4 = *(q + 3);
+    x5 = *(q + 2);
+    x6 = *(q + 1);
+    x7 = *(q + 0);
+
+    /* Top linear transformation */
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    /* Non-linear section, inversion in GF(2^4)^2 */
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    /* Bottom linear transformation */
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    s0 = t59 ^ t63;
+    s6 = t56 ^ ~t62;
+    s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    s3 = t53 ^ t66;
+    s4 = t51 ^ t66;
+    s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;
+    s2 = t55 ^ ~t67;
+
+    *(q + 7) = s0;
+    *(q + 6) = s1;
+    *(q + 5) = s2;
+    *(q + 4) = s3;
+    *(q + 3) = s4;
+    *(q + 2) = s5;
+    *(q + 1) = s6;
+    *(q + 0) = s7;
+}
+
+/**
+ * Mixes the columns
+ * s'r = {02}(sr ^ sr+1) ^ sr+1 ^ sr+2 ^ sr+3, with the multiplication by
+ * {02} moving every plane up one bit and folding bit 7 back in as {1b}
+ */
+BS_INLINE void bs_mix_cols (bs_state q) {
+    bs_word r1 [8];
+    bs_word b [8];
+    unsigned int k;
+
+    for (k = 0; k < 8; k++) {
+        *(r1 + k) = BS_ROT1(*(q + k));
+        *(b + k) = *(q + k) ^ *(r1 + k);
+    }
+    *q = *r1 ^ BS_ROT2(*b);
+    for (k = 1; k < 8; k++) {
+        *(q + k) = *(r1 + k) ^ BS_ROT2(*(b + k)) ^ *(b + k - 1);
+    }
+    /* Reduction, {1b} has bits 0, 1, 3 and 4 set */
+    *(q + 0) ^= *(b + 7);
+    *(q + 1) ^= *(b + 7);
+    *(q + 3) ^= *(b + 7);
+    *(q + 4) ^= *(b + 7);
+}
+
+/**
+ * Adds a bitsliced round key
+ */
+BS_INLINE void bs_add_key (bs_state q, const bs_word *rk) {
+    unsigned int k;
+
+    for (k = 0; k < 8; k++) {
+        *(q + k) ^= *(rk + k);
+    }
+}
+
+/**
+ * The inverse of the s-box affine transformation, constant included
+ * b'k = bk+2 ^ bk+5 ^ bk+7 ^ {05}k
+ */
+BS_INLINE void bs_inv_affine (bs_state q) {
+    bs_word t [8];
+    unsigned int k;
+
+    for (k = 0; k < 8; k++) {
+        *(t + k) = *(q + ((k + 2) & 7)) ^ *(q + ((k + 5) & 7))
+                 ^ *(q + ((k + 7) & 7));
+    }
+    for (k = 0; k < 8; k++) {
+        *(q + k) = *(t + k);
+    }
+    *(q + 0) = ~*(q + 0);
+    *(q + 2) = ~*(q + 2);
+}
+
+/**
+ * The inverse s-box without a second circuit
+ * The s-box is the affine transformation of the field inverse, so the
+ * inverse affine transformation of an s-box output is the field inverse
+ * of its input. Hence inv_sbox(y) = inv_affine(sbox(inv_affine(y)))
+ */
+BS_INLINE void bs_inv_sbox (bs_state q) {
+    bs_inv_affine(q);
+    bs_sbox(q);
+    bs_inv_affine(q);
+}
+
+/**
+ * Multiplies every byte of a set of planes by {02}
+ */
+BS_INLINE void bs_xtime (bs_word *b) {
+    bs_word hi = *(b + 7);
+    unsigned int k;
+
+    for (k = 7; k > 0; k--) {
+        *(b + k) = *(b + k - 1);
+    }
+    *(b + 0) = hi;
+    *(b + 1) ^= hi;
+    *(b + 3) ^= hi;
+    *(b + 4) ^= hi;
+}
+
+/**
+ * Inverse mix columns
+ * Multiplying a column by {04}x^2 + {05} turns inverse mix columns into
+ * mix columns, which adds {04}(sr ^ sr+2) to every row
+ */
+BS_INLINE void bs_inv_mix_cols (bs_state q) {
+    bs_word d [8];
+    unsigned int k;
+
+    for (k = 0; k < 8; k++) {
+        *(d + k) = *(q + k) ^ BS_ROT2(*(q + k));
+    }
+    bs_xtime(d);
+    bs_xtime(d);
+    for (k = 0; k < 8; k++) {
+        *(q + k) ^= *(d + k);
+    }
+    bs_mix_cols(q);
+}
+
+/* One full round, mix columns included */
+#define BS_ENC_ROUND(R) \
+    bs_sbox(q); \
+    bs_shift_rows(q); \
+    bs_mix_cols(q); \
+    bs_add_key(q, *(rk + (R)));
+#define BS_DEC_ROUND(R) \
+    bs_inv_sbox(q); \
+    bs_inv_shift_rows(q); \
+    bs_inv_mix_cols(q); \
+    bs_add_key(q, *(rk + (R)));
+
+/* Encryption and decryption written out for every key size */
+#define BS_NR 10
+#define BS_RNAME(N) BS_NAME(N ## _128)
+#include "bitslice_rounds.h"
+#undef BS_RNAME
+#undef BS_NR
+
+#define BS_NR 12
+#define BS_RNAME(N) BS_NAME(N ## _192)
+#include "bitslice_rounds.h"
+#undef BS_RNAME
+#undef BS_NR
+
+#define BS_NR 14
+#define BS_RNAME(N) BS_NAME(N ## _256)
+#include "bitslice_rounds.h"
+#undef BS_RNAME
+#undef BS_NR
+
+#undef BS_ENC_ROUND
+#undef BS_DEC_ROUND
+
+/**
+ * Encrypts blocks with the code for the key size of the schedule
+ * nr: number of rounds of the schedule
+ */
+static BS_ATTR void bs_encrypt (unsigned char *out, const unsigned char *in,
+                                size_t blocks, const unsigned char *sched,
+                                unsigned int nr) {
+    const bs_state *rk = bs_keys(&bs_enc_keys, sched, nr);
+
+    switch (nr) {
+    case 12:
+        BS_NAME(bs_enc_rounds_192)(out, in, blocks, rk);
+        break;
+    case 14:
+        BS_NAME(bs_enc_rounds_256)(out, in, blocks, rk);
+        break;
+    default:
+        BS_NAME(bs_enc_rounds_128)(out, in, blocks, rk);
+        break;
+    }
+}
+
+/**
+ * Decrypts blocks with the code for the key size of the schedule
+ * nr: number of rounds of the schedule
+ */
+static BS_ATTR void bs_decrypt (unsigned char *out, const unsigned char *in,
+                                size_t blocks, const unsigned char *dec,
+                                unsigned int nr) {
+    const bs_state *rk = bs_keys(&bs_dec_keys, dec, nr);
+
+    switch (nr) {
+    case 12:
+        BS_NAME(bs_dec_rounds_192)(out, in, blocks, rk);
+        break;
+    case 14:
+        BS_NAME(bs_dec_rounds_256)(out, in, blocks, rk);
+        break;
+    default:
+        BS_NAME(bs_dec_rounds_128)(out, in, blocks, rk);
+        break;
+    }
+}
+
+#undef BS_INLINE
+#undef BS_LANES
+#undef BS_ROT1
+#undef BS_ROT2
+
+#undef bs_word
+#undef bs_state
+#undef HALF_SWAP
+#undef bs_transpose
+#undef bs_pack
+#undef bs_unpack
+#undef bs_key
+#undef bs_sched_s
+#undef bs_enc_keys
+#undef bs_dec_keys
+#undef bs_keys
+#undef bs_sbox
+#undef bs_shift_rows
+#undef bs_mix_cols
+#undef bs_add_key
+#undef bs_encrypt
+#undef bs_inv_affine
+#undef bs_inv_sbox
+#undef bs_inv_shift_rows
+#undef bs_xtime
+#undef bs_inv_mix_cols
+#undef bs_decrypt
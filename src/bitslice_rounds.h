@@ -0,0 +1,63 @@
+/**
+ * Bitsliced encryption and decryption for one key size, included by
+ * bitslice_kern.h once per key size
+ * The includer defines BS_NR (number of rounds as a literal) and BS_RNAME
+ * (suffix for every name defined here). Every round is written out, so
+ * nothing loops over rounds or looks at the key size
+ */
+
+#define bs_enc_rounds BS_RNAME(bs_enc_rounds)
+#define bs_dec_rounds BS_RNAME(bs_dec_rounds)
+
+/**
+ * Encrypts blocks BS_LANES at a time without any data dependent memory
+ * access or branches, a short final batch is packed with zero blocks
+ * rk: pointer to bs_state[BS_NR + 1], the bitsliced schedule
+ */
+static BS_ATTR void bs_enc_rounds (unsigned char *out, const unsigned char *in,
+                                   size_t blocks, const bs_state *rk) {
+    bs_state q;
+    size_t n;
+
+    while (blocks > 0) {
+        n = (blocks < BS_LANES) ? blocks : BS_LANES;
+        bs_pack(q, in, n);
+        bs_add_key(q, *rk);
+        FULL_ROUNDS(BS_NR)(BS_ENC_ROUND)
+        bs_sbox(q);
+        bs_shift_rows(q);
+        bs_add_key(q, *(rk + BS_NR));
+        bs_unpack(out, q, n);
+        in += n * BLOCK_SIZE;
+        out += n * BLOCK_SIZE;
+        blocks -= n;
+    }
+}
+
+/**
+ * Decrypts blocks BS_LANES at a time with the equivalent inverse cipher,
+ * just as constant time as bs_enc_rounds
+ * rk: pointer to bs_state[BS_NR + 1], the bitsliced inverse schedule
+ */
+static BS_ATTR void bs_dec_rounds (unsigned char *out, const unsigned char *in,
+                                   size_t blocks, const bs_state *rk) {
+    bs_state q;
+    size_t n;
+
+    while (blocks > 0) {
+        n = (blocks < BS_LANES) ? blocks : BS_LANES;
+        bs_pack(q, in, n);
+        bs_add_key(q, *rk);
+        FULL_ROUNDS(BS_NR)(BS_DEC_ROUND)
+        bs_inv_sbox(q);
+        bs_inv_shift_rows(q);
+        bs_add_key(q, *(rk + BS_NR));
+        bs_unpack(out, q, n);
+        in += n * BLOCK_SIZE;
+        out += n * BLOCK_SIZE;
+        blocks -= n;
+    }
+}
+
+#undef bs_enc_rounds
+#undef bs_dec_rounds
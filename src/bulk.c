@@ -0,0 +1,948 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bulk.h"
+#include "cipher.h"
+#include "gcm.h"
+#include "modes.h"
+
+/* Size of the I/O buffer per thread, a multiple of BLOCK_SIZE */
+#define BULK_BUF_SIZE (1 << 20)
+/* Buffers in the streaming ring, one in hand per stage and one spare */
+#define STREAM_SLOTS 4
+
+/**
+ * Fills a buffer from a stream, retrying short reads
+ * Returns the number of bytes read, less than len only at EOF or on error
+ */
+static size_t fill_buf (unsigned char *buf, size_t len, FILE *in) {
+    size_t got = 0;
+    size_t ret;
+
+    while (got < len) {
+        ret = fread(buf + got, 1, len - got, in);
+        if (ret == 0) {
+            break;
+        }
+        got += ret;
+    }
+    return got;
+}
+
+/**
+ * Encrypts everything from in and writes the raw ciphertext to out
+ * In ECB and CBC the final block is padded with PKCS#7, so the output is
+ * always a whole number of blocks and one block longer if the input
+ * already was. CTR is a stream mode and the output is as long as the
+ * input.
+ * eng: engine to encrypt with
+ * ctx: context holding the schedule
+ * in: input stream
+ * out: output stream
+ * mode: mode of operation, MODE_ECB, MODE_CBC or MODE_CTR
+ * iv: pointer to unsigned char[BLOCK_SIZE], the initialization vector
+ *     for MODE_CBC and the initial counter block for MODE_CTR
+ * threads: number of threads for MODE_CTR
+ * Returns 0 on success, -1 on I/O errors
+ */
+int bulk_encrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  FILE *in, FILE *out, enum mode_e mode,
+                  const unsigned char *iv, unsigned int threads) {
+    unsigned char *buf;
+    unsigned char chain [BLOCK_SIZE];
+    size_t bufsize = BULK_BUF_SIZE;
+    size_t len;
+    size_t whole;
+    int ret = 0;
+
+    /* Give every counter mode thread a full buffer's worth */
+    if (mode == MODE_CTR && threads > 1) {
+        bufsize *= (threads < CTR_MAX_THREADS) ? threads : CTR_MAX_THREADS;
+    }
+    /* Extra block so the padding always fits */
+    buf = malloc(bufsize + BLOCK_SIZE);
+    if (!buf) {
+        return -1;
+    }
+    if (iv) {
+        memcpy(chain, iv, BLOCK_SIZE);
+    } else {
+        memset(chain, 0, BLOCK_SIZE);
+    }
+
+    do {
+        len = fill_buf(buf, bufsize, in);
+        if (ferror(in)) {
+            ret = -1;
+            break;
+        }
+
+        /* Pad the last block once the input is exhausted */
+        whole = len - (len % BLOCK_SIZE);
+        if (mode == MODE_CTR) {
+            whole = len;
+        } else if (len < bufsize) {
+            whole += pkcs7_pad(buf + whole, len - whole);
+        }
+
+        switch (mode) {
+        case MODE_ECB:
+            ecb_encrypt(eng, ctx, buf, buf, whole / BLOCK_SIZE);
+            break;
+        case MODE_CBC:
+            cbc_encrypt(eng, ctx, buf, buf, whole / BLOCK_SIZE, chain);
+            break;
+        case MODE_CTR:
+            ctr_encrypt(eng, ctx, buf, buf, whole, chain, threads);
+            break;
+        default:
+            break;
+        }
+
+        if (fwrite(buf, 1, whole, out) != whole) {
+            ret = -1;
+            break;
+        }
+    } while (len == bufsize);
+
+    if (fflush(out)) {
+        ret = -1;
+    }
+    free(buf);
+    return ret;
+}
+
+/**
+ * Decrypts raw ciphertext from in and writes the plaintext to out
+ * In ECB and CBC the input must be a whole number of blocks and the
+ * PKCS#7 padding is checked and stripped from the final block. CTR is
+ * its own inverse and goes through bulk_encrypt.
+ * Arguments are the same as for bulk_encrypt, ctx must also hold the
+ * decryption schedule for ECB and CBC
+ * Returns 0 on success, -1 on I/O errors, -2 if the input is not a
+ * whole number of blocks or the padding is invalid
+ */
+int bulk_decrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  FILE *in, FILE *out, enum mode_e mode,
+                  const unsigned char *iv, unsigned int threads) {
+    unsigned char *buf;
+    unsigned char chain [BLOCK_SIZE];
+    size_t len;
+    long keep;
+    int last;
+    int c;
+    int ret = 0;
+
+    if (mode == MODE_CTR) {
+        return bulk_encrypt(eng, ctx, in, out, mode, iv, threads);
+    }
+
+    buf = malloc(BULK_BUF_SIZE);
+    if (!buf) {
+        return -1;
+    }
+    if (iv) {
+        memcpy(chain, iv, BLOCK_SIZE);
+    } else {
+        memset(chain, 0, BLOCK_SIZE);
+    }
+
+    do {
+        len = fill_buf(buf, BULK_BUF_SIZE, in);
+        if (ferror(in)) {
+            ret = -1;
+            break;
+        }
+
+        /* A full buffer is only the last one if nothing follows it */
+        last = (len < BULK_BUF_SIZE);
+        if (!last) {
+            c = getc(in);
+            last = (c == EOF);
+            if (!last) {
+                ungetc(c, in);
+            }
+        }
+        if (len % BLOCK_SIZE || (last && len == 0)) {
+            ret = -2;
+            break;
+        }
+
+        if (mode == MODE_ECB) {
+            ecb_decrypt(eng, ctx, buf, buf, len / BLOCK_SIZE);
+        } else {
+            cbc_decrypt(eng, ctx, buf, buf, len / BLOCK_SIZE, chain);
+        }
+
+        keep = len;
+        if (last) {
+            keep = pkcs7_unpad(buf, len);
+            if (keep < 0) {
+                ret = -2;
+                break;
+            }
+        }
+        if (fwrite(buf, 1, keep, out) != (size_t) keep) {
+            ret = -1;
+            break;
+        }
+    } while (!last);
+
+    if (fflush(out)) {
+        ret = -1;
+    }
+    free(buf);
+    return ret;
+}
+
+/**
+ * Checks and decrypts GCM input that is a regular file through a
+ * mapping, so nothing is held in memory but a buffer
+ * The tag is checked in a first pass that only hashes, and the second
+ * pass decrypts, so no plaintext gets out before the check
+ * s: stream set up for the key, nonce and additional data
+ * fd: file descriptor of the input, at its start
+ * size: size of the input file
+ * Returns 0 on success, -1 on I/O errors, -2 if the input is too short
+ * for a tag or the tag does not match
+ */
+static int gcm_map_decrypt (struct gcm_stream_s *s, int fd, FILE *out,
+                            off_t size) {
+    struct gcm_stream_s dec = *s;
+    unsigned char *src;
+    unsigned char *buf;
+    size_t len;
+    size_t off;
+    size_t n;
+    int ret = 0;
+
+    if (size < GCM_TAG_SIZE) {
+        return -2;
+    }
+    len = size - GCM_TAG_SIZE;
+    src = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (src == MAP_FAILED) {
+        return -1;
+    }
+    buf = malloc(BULK_BUF_SIZE);
+    if (!buf) {
+        munmap(src, size);
+        return -1;
+    }
+    madvise(src, size, MADV_SEQUENTIAL);
+
+    /* Finished chunks are dropped so memory use stays flat */
+    for (off = 0; off < len; off += n) {
+        n = (len - off < BULK_BUF_SIZE) ? len - off : BULK_BUF_SIZE;
+        gcm_hash(s, src + off, n);
+        madvise(src + off, n, MADV_DONTNEED);
+    }
+    if (gcm_check(s, src + len, GCM_TAG_SIZE)) {
+        ret = -2;
+    }
+    for (off = 0; !ret && off < len; off += n) {
+        n = (len - off < BULK_BUF_SIZE) ? len - off : BULK_BUF_SIZE;
+        memcpy(buf, src + off, n);
+        gcm_crypt(&dec, buf, n);
+        if (fwrite(buf, 1, n, out) != n) {
+            ret = -1;
+        }
+        madvise(src + off, n, MADV_DONTNEED);
+    }
+
+    free(buf);
+    munmap(src, size);
+    return ret;
+}
+
+/**
+ * Encrypts everything from in with AES-GCM and writes the ciphertext
+ * followed by the GCM_TAG_SIZE byte tag to out, or checks and decrypts
+ * such input
+ * Encryption streams through a buffer like bulk_encrypt. Decryption must
+ * not let any plaintext out before the tag has been checked, so a
+ * regular input file is mapped and hashed before it is decrypted, and
+ * anything else is read into memory first.
+ * eng: engine to encrypt with
+ * ctx: context holding the schedule
+ * in: input stream
+ * out: output stream
+ * iv: pointer to unsigned char[iv_len], the nonce
+ * iv_len: nonce length in bytes
+ * aad: pointer to unsigned char[aad_len], additional authenticated data
+ * decrypt: nonzero to decrypt
+ * Returns 0 on success, -1 on I/O errors, -2 if the input is too short
+ * for a tag or the tag does not match
+ */
+int bulk_gcm (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+              FILE *in, FILE *out, const unsigned char *iv, size_t iv_len,
+              const unsigned char *aad, size_t aad_len, int decrypt) {
+    struct gcm_s g;
+    struct gcm_stream_s s;
+    struct stat st;
+    unsigned char *buf = 0;
+    unsigned char *grown;
+    size_t size = 0;
+    size_t len = 0;
+    int last;
+    int ret = 0;
+
+    gcm_init(&g, eng, ctx);
+    gcm_start(&s, &g, iv, iv_len, aad, aad_len);
+
+    if (decrypt && !fstat(fileno(in), &st) && S_ISREG(st.st_mode)
+        && ftell(in) == 0) {
+        ret = gcm_map_decrypt(&s, fileno(in), out, st.st_size);
+        if (!ret && fflush(out)) {
+            ret = -1;
+        }
+        return ret;
+    }
+
+    if (!decrypt) {
+        /* Room for the tag after the last piece */
+        buf = malloc(BULK_BUF_SIZE + GCM_TAG_SIZE);
+        if (!buf) {
+            return -1;
+        }
+        do {
+            len = fill_buf(buf, BULK_BUF_SIZE, in);
+            if (ferror(in)) {
+                ret = -1;
+                break;
+            }
+            gcm_update(&s, buf, len, 0);
+            last = (len < BULK_BUF_SIZE);
+            if (last) {
+                gcm_finish(&s, buf + len, GCM_TAG_SIZE);
+                len += GCM_TAG_SIZE;
+            }
+            if (fwrite(buf, 1, len, out) != len) {
+                ret = -1;
+                break;
+            }
+        } while (!last);
+        if (fflush(out)) {
+            ret = -1;
+        }
+        free(buf);
+        return ret;
+    }
+
+    do {
+        size = size ? size * 2 : BULK_BUF_SIZE;
+        grown = realloc(buf, size);
+        if (!grown) {
+            free(buf);
+            return -1;
+        }
+        buf = grown;
+        len += fill_buf(buf + len, size - len, in);
+    } while (len == size);
+    if (ferror(in)) {
+        free(buf);
+        return -1;
+    }
+
+    if (len < GCM_TAG_SIZE) {
+        ret = -2;
+    } else {
+        len -= GCM_TAG_SIZE;
+        if (gcm_decrypt(&g, iv, iv_len, aad, aad_len, buf, len, buf + len,
+                        GCM_TAG_SIZE)) {
+            ret = -2;
+        }
+    }
+
+    if (!ret && (fwrite(buf, 1, len, out) != len || fflush(out))) {
+        ret = -1;
+    }
+    free(buf);
+    return ret;
+}
+
+/**
+ * Checks the padding of mapped ciphertext before anything is decrypted,
+ * so a bad file is left alone even when decrypting in place
+ * eng: engine to decrypt with
+ * ctx: context holding the decryption schedule
+ * mode: MODE_ECB or MODE_CBC
+ * src: pointer to unsigned char[len], the ciphertext
+ * len: number of bytes, a nonzero multiple of BLOCK_SIZE
+ * iv: pointer to unsigned char[BLOCK_SIZE], the initialization vector
+ * Returns the length of the plaintext, -1 if the padding is invalid
+ */
+static long map_unpad (const struct engine_s *eng,
+                       const struct aes_ctx_s *ctx, enum mode_e mode,
+                       const unsigned char *src, size_t len,
+                       const unsigned char *iv) {
+    unsigned char last [BLOCK_SIZE];
+    const unsigned char *prev = iv;
+    unsigned int cx;
+    long keep;
+
+    eng->decrypt(ctx, last, src + len - BLOCK_SIZE, 1);
+    if (mode == MODE_CBC) {
+        if (len > BLOCK_SIZE) {
+            prev = src + len - (2 * BLOCK_SIZE);
+        }
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            *(last + cx) ^= *(prev + cx);
+        }
+    }
+    keep = pkcs7_unpad(last, BLOCK_SIZE);
+    return (keep < 0) ? -1 : (long) (len - BLOCK_SIZE) + keep;
+}
+
+/**
+ * Encrypts or decrypts whole blocks in any mode
+ * out: pointer to unsigned char[len], may equal in
+ * in: pointer to unsigned char[len]
+ * len: number of bytes, whole blocks except at the end in MODE_CTR
+ * chain: chaining value or counter block, updated
+ */
+static void mode_run (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                      enum mode_e mode, int decrypt, unsigned char *out,
+                      const unsigned char *in, size_t len,
+                      unsigned char *chain, unsigned int threads) {
+    switch (mode) {
+    case MODE_ECB:
+        if (decrypt) {
+            ecb_decrypt(eng, ctx, out, in, len / BLOCK_SIZE);
+        } else {
+            ecb_encrypt(eng, ctx, out, in, len / BLOCK_SIZE);
+        }
+        break;
+    case MODE_CBC:
+        if (decrypt) {
+            cbc_decrypt(eng, ctx, out, in, len / BLOCK_SIZE, chain);
+        } else {
+            cbc_encrypt(eng, ctx, out, in, len / BLOCK_SIZE, chain);
+        }
+        break;
+    case MODE_CTR:
+        ctr_encrypt(eng, ctx, out, in, len, chain, threads);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Runs the mode over the mapped data a chunk at a time
+ * The next chunk of the input is prefetched while the current one is
+ * worked on, and finished chunks are dropped from the mappings so memory
+ * use stays flat however large the file is. Out of place the cipher
+ * reads the input mapping and writes the output mapping directly.
+ * Arguments are those of bulk_map, chain is updated
+ * src: pointer to unsigned char[len], the input mapping
+ * dst: pointer to unsigned char[len], the output mapping, may equal src
+ * len: number of bytes to process, whole blocks except for MODE_CTR
+ * chunk: bytes per step, a multiple of the page size
+ */
+static void map_run (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                     enum mode_e mode, int decrypt, const unsigned char *src,
+                     unsigned char *dst, size_t len, size_t chunk,
+                     unsigned char *chain, unsigned int threads) {
+    size_t off;
+    size_t n;
+
+    for (off = 0; off < len; off += n) {
+        n = (len - off < chunk) ? len - off : chunk;
+        if (off + n < len) {
+            madvise((void *) (src + off + n),
+                    (len - off - n < chunk) ? len - off - n : chunk,
+                    MADV_WILLNEED);
+        }
+        mode_run(eng, ctx, mode, decrypt, dst + off, src + off, n, chain,
+                 threads);
+
+        /* Dirty pages of the output stay in the page cache */
+        madvise((void *) (src + off), n, MADV_DONTNEED);
+        if (dst != src) {
+            madvise(dst + off, n, MADV_DONTNEED);
+        }
+    }
+}
+
+/**
+ * Encrypts or decrypts a file through memory mappings, without going
+ * through stdio buffers
+ * The output is the same as from bulk_encrypt and bulk_decrypt. In place
+ * the file grows by the padding on encryption and loses it on
+ * decryption, and is left untouched if the padding is found invalid.
+ * eng: engine to encrypt with
+ * ctx: context holding the schedule, and the decryption schedule for
+ *      decrypting in ECB and CBC
+ * in_path: regular file to read
+ * out_path: file to write, null or the same file as in_path to work in
+ *           place
+ * mode: mode of operation, MODE_ECB, MODE_CBC or MODE_CTR
+ * iv: pointer to unsigned char[BLOCK_SIZE] as for bulk_encrypt
+ * threads: number of threads for MODE_CTR
+ * decrypt: nonzero to decrypt
+ * Returns 0 on success, -1 on I/O errors with errno set, -2 if the input
+ * is not a whole number of blocks or the padding is invalid
+ */
+int bulk_map (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+              const char *in_path, const char *out_path, enum mode_e mode,
+              const unsigned char *iv, unsigned int threads, int decrypt) {
+    unsigned char chain [BLOCK_SIZE];
+    unsigned char *src = 0;
+    unsigned char *dst = 0;
+    struct stat in_st;
+    struct stat out_st;
+    size_t chunk = BULK_BUF_SIZE;
+    size_t len;
+    size_t out_len;
+    size_t whole;
+    long keep = 0;
+    int in_fd;
+    int out_fd = -1;
+    int ret = -1;
+
+    /* Counter mode is its own inverse */
+    if (mode == MODE_CTR) {
+        decrypt = 0;
+        if (threads > 1) {
+            chunk *= (threads < CTR_MAX_THREADS) ? threads : CTR_MAX_THREADS;
+        }
+    }
+    if (iv) {
+        memcpy(chain, iv, BLOCK_SIZE);
+    } else {
+        memset(chain, 0, BLOCK_SIZE);
+    }
+
+    /* Writing over the input is working in place, truncating it is not */
+    if (stat(in_path, &in_st)) {
+        return -1;
+    }
+    if (out_path && !stat(out_path, &out_st) && in_st.st_dev == out_st.st_dev
+        && in_st.st_ino == out_st.st_ino) {
+        out_path = 0;
+    }
+    if (!S_ISREG(in_st.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    in_fd = open(in_path, out_path ? O_RDONLY : O_RDWR);
+    if (in_fd < 0) {
+        return -1;
+    }
+    if (fstat(in_fd, &in_st)) {
+        goto done;
+    }
+    len = in_st.st_size;
+    if (mode == MODE_CTR) {
+        out_len = len;
+    } else if (decrypt) {
+        if (len == 0 || len % BLOCK_SIZE) {
+            ret = -2;
+            goto done;
+        }
+        out_len = len;
+    } else {
+        /* Room for a whole block of padding */
+        out_len = len - (len % BLOCK_SIZE) + BLOCK_SIZE;
+    }
+
+    if (out_path) {
+        out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (out_fd < 0) {
+            goto done;
+        }
+    } else {
+        out_fd = in_fd;
+    }
+    /* Reserve the blocks now, a full disk would fault the mapping later */
+    if (out_len > 0 && (out_len > len || out_fd != in_fd)) {
+        errno = posix_fallocate(out_fd, 0, out_len);
+        if (errno) {
+            goto done;
+        }
+    }
+
+    if (len > 0) {
+        src = mmap(0, out_fd == in_fd ? out_len : len,
+                   PROT_READ | (out_fd == in_fd ? PROT_WRITE : 0), MAP_SHARED,
+                   in_fd, 0);
+        if (src == MAP_FAILED) {
+            src = 0;
+            goto done;
+        }
+        madvise(src, len, MADV_SEQUENTIAL);
+    }
+    if (out_fd == in_fd) {
+        dst = src;
+    } else if (out_len > 0) {
+        dst = mmap(0, out_len, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+        if (dst == MAP_FAILED) {
+            dst = 0;
+            goto done;
+        }
+        madvise(dst, out_len, MADV_SEQUENTIAL);
+    }
+    /* An empty file mapped in place needs a mapping for the padding */
+    if (!dst && out_len > 0) {
+        dst = mmap(0, out_len, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+        if (dst == MAP_FAILED) {
+            dst = 0;
+            goto done;
+        }
+        src = dst;
+    }
+
+    if (decrypt) {
+        keep = map_unpad(eng, ctx, mode, src, len, chain);
+        if (keep < 0) {
+            ret = -2;
+            goto done;
+        }
+    }
+
+    whole = (mode == MODE_CTR || decrypt) ? len : len - (len % BLOCK_SIZE);
+    map_run(eng, ctx, mode, decrypt, src, dst, whole, chunk, chain, threads);
+
+    /* Pad and encrypt the last block */
+    if (mode != MODE_CTR && !decrypt) {
+        if (dst != src && len > whole) {
+            memcpy(dst + whole, src + whole, len - whole);
+        }
+        pkcs7_pad(dst + whole, len - whole);
+        mode_run(eng, ctx, mode, 0, dst + whole, dst + whole, BLOCK_SIZE,
+                 chain, threads);
+    }
+    ret = 0;
+
+done:
+    if (dst && dst != src) {
+        munmap(dst, out_len);
+    }
+    if (src) {
+        munmap(src, (out_fd == in_fd) ? out_len : len);
+    }
+    /* Drop the padding only once the mappings are gone */
+    if (ret == 0 && decrypt && ftruncate(out_fd, keep)) {
+        ret = -1;
+    }
+    if (out_fd >= 0 && out_fd != in_fd && close(out_fd)) {
+        ret = -1;
+    }
+    close(in_fd);
+    return ret;
+}
+
+/* A buffer of the streaming ring */
+struct stream_slot_s {
+    unsigned char *buf;
+    size_t len;
+    /* Set on the slot the input ends with */
+    int last;
+};
+
+/**
+ * A reader, the cipher and a writer passing buffers around a ring
+ * Slot n of the stream is slots[n % STREAM_SLOTS], every counter only
+ * ever catches up with the one before it, and the reader waits for the
+ * writer once the ring is full
+ */
+struct stream_s {
+    struct stream_slot_s slots [STREAM_SLOTS];
+    /* Data bytes per slot, each has a block more for the padding */
+    size_t cap;
+    int in_fd;
+    int out_fd;
+    /* Slots read, encrypted and written so far */
+    unsigned long read;
+    unsigned long crypted;
+    unsigned long written;
+    /* Set when a stage fails and everything stops, -1 for I/O errors */
+    int err;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/**
+ * Reads until a buffer is full or the input ends
+ * Returns the number of bytes read, -1 on errors
+ */
+static long read_full (int fd, unsigned char *buf, size_t len) {
+    size_t got = 0;
+    ssize_t ret;
+
+    while (got < len) {
+        ret = read(fd, buf + got, len - got);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            break;
+        }
+        got += ret;
+    }
+    return got;
+}
+
+/**
+ * Writes all of a buffer
+ * Returns 0 on success, -1 on errors
+ */
+static int write_full (int fd, const unsigned char *buf, size_t len) {
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, buf, len);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/**
+ * Stops every stage
+ * err: what went wrong
+ */
+static void stream_fail (struct stream_s *s, int err) {
+    pthread_mutex_lock(&s->lock);
+    if (!s->err) {
+        s->err = err;
+    }
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Waits for a slot to be handed over by the stage before
+ * done: counter of the stage before
+ * n: slot number the caller wants
+ * ahead: how far the caller may run ahead of that stage, STREAM_SLOTS
+ *        for the reader that goes ahead of the writer, 0 otherwise
+ * Returns 0 once the slot is ready, the error if the stream failed
+ */
+static int stream_wait (struct stream_s *s, const unsigned long *done,
+                        unsigned long n, unsigned long ahead) {
+    int err;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->err && *done + ahead <= n) {
+        pthread_cond_wait(&s->cond, &s->lock);
+    }
+    err = s->err;
+    pthread_mutex_unlock(&s->lock);
+    return err;
+}
+
+/**
+ * Hands a slot on to the next stage
+ * count: counter of the calling stage, incremented
+ */
+static void stream_done (struct stream_s *s, unsigned long *count) {
+    pthread_mutex_lock(&s->lock);
+    (*count)++;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Reader stage, fills free slots from the input
+ * A full slot is only handed on once the next one has data, so the slot
+ * the input ends in is always marked, even if it is full
+ */
+static void *stream_reader (void *arg) {
+    struct stream_s *s = arg;
+    struct stream_slot_s *cur;
+    struct stream_slot_s *next;
+    unsigned long n = 0;
+    long len;
+
+    if (stream_wait(s, &s->written, n, STREAM_SLOTS)) {
+        return 0;
+    }
+    cur = s->slots;
+    len = read_full(s->in_fd, cur->buf, s->cap);
+    for (;;) {
+        if (len < 0) {
+            stream_fail(s, -1);
+            return 0;
+        }
+        cur->len = len;
+        cur->last = (cur->len < s->cap);
+        if (cur->last) {
+            break;
+        }
+
+        if (stream_wait(s, &s->written, n + 1, STREAM_SLOTS)) {
+            return 0;
+        }
+        next = s->slots + ((n + 1) % STREAM_SLOTS);
+        len = read_full(s->in_fd, next->buf, s->cap);
+        if (len == 0) {
+            cur->last = 1;
+            break;
+        }
+        stream_done(s, &s->read);
+        cur = next;
+        n++;
+    }
+    stream_done(s, &s->read);
+    return 0;
+}
+
+/**
+ * Writer stage, writes out finished slots and frees them for the reader
+ */
+static void *stream_writer (void *arg) {
+    struct stream_s *s = arg;
+    struct stream_slot_s *slot;
+    unsigned long n;
+    int last = 0;
+
+    for (n = 0; !last; n++) {
+        if (stream_wait(s, &s->crypted, n, 0)) {
+            break;
+        }
+        slot = s->slots + (n % STREAM_SLOTS);
+        last = slot->last;
+        if (write_full(s->out_fd, slot->buf, slot->len)) {
+            stream_fail(s, -1);
+            break;
+        }
+        stream_done(s, &s->written);
+    }
+    return 0;
+}
+
+/**
+ * Encrypts or decrypts a stream with reading, the cipher and writing
+ * overlapped
+ * A reader and a writer thread pass a ring of STREAM_SLOTS buffers
+ * around the calling thread, which runs the cipher. Memory use is fixed
+ * by the ring, and a slow consumer stalls the reader once every slot is
+ * waiting to be written. The output is the same as from bulk_encrypt
+ * and bulk_decrypt.
+ * eng: engine to encrypt with
+ * ctx: context holding the schedule, and the decryption schedule for
+ *      decrypting in ECB and CBC
+ * in_fd: file descriptor to read
+ * out_fd: file descriptor to write
+ * mode: mode of operation, MODE_ECB, MODE_CBC or MODE_CTR
+ * iv: pointer to unsigned char[BLOCK_SIZE] as for bulk_encrypt
+ * threads: number of threads for MODE_CTR
+ * decrypt: nonzero to decrypt
+ * Returns 0 on success, -1 on I/O errors, -2 if the input is not a
+ * whole number of blocks or the padding is invalid
+ */
+int bulk_stream (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                 int in_fd, int out_fd, enum mode_e mode,
+                 const unsigned char *iv, unsigned int threads, int decrypt) {
+    struct stream_s s;
+    struct stream_slot_s *slot;
+    unsigned char chain [BLOCK_SIZE];
+    pthread_t reader;
+    pthread_t writer;
+    unsigned long n;
+    size_t whole;
+    long keep;
+    unsigned int cx;
+    int last = 0;
+    int ret = 0;
+
+    memset(&s, 0, sizeof(s));
+    s.cap = BULK_BUF_SIZE;
+    s.in_fd = in_fd;
+    s.out_fd = out_fd;
+    /* Counter mode is its own inverse */
+    if (mode == MODE_CTR) {
+        decrypt = 0;
+        if (threads > 1) {
+            s.cap *= (threads < CTR_MAX_THREADS) ? threads : CTR_MAX_THREADS;
+        }
+    }
+    if (iv) {
+        memcpy(chain, iv, BLOCK_SIZE);
+    } else {
+        memset(chain, 0, BLOCK_SIZE);
+    }
+    for (cx = 0; cx < STREAM_SLOTS; cx++) {
+        (s.slots + cx)->buf = malloc(s.cap + BLOCK_SIZE);
+        if (!(s.slots + cx)->buf) {
+            ret = -1;
+            goto done;
+        }
+    }
+
+    pthread_mutex_init(&s.lock, 0);
+    pthread_cond_init(&s.cond, 0);
+    if (pthread_create(&reader, 0, stream_reader, &s)) {
+        ret = -1;
+        goto destroy;
+    }
+    if (pthread_create(&writer, 0, stream_writer, &s)) {
+        stream_fail(&s, -1);
+        pthread_join(reader, 0);
+        ret = -1;
+        goto destroy;
+    }
+
+    for (n = 0; !last; n++) {
+        if (stream_wait(&s, &s.read, n, 0)) {
+            break;
+        }
+        slot = s.slots + (n % STREAM_SLOTS);
+        last = slot->last;
+
+        whole = slot->len - (slot->len % BLOCK_SIZE);
+        if (mode == MODE_CTR) {
+            whole = slot->len;
+        } else if (decrypt && (whole != slot->len || (last && whole == 0))) {
+            stream_fail(&s, -2);
+            break;
+        } else if (!decrypt && last) {
+            whole += pkcs7_pad(slot->buf + whole, slot->len - whole);
+        }
+        mode_run(eng, ctx, mode, decrypt, slot->buf, slot->buf, whole, chain,
+                 threads);
+
+        if (decrypt && last) {
+            keep = pkcs7_unpad(slot->buf, whole);
+            if (keep < 0) {
+                stream_fail(&s, -2);
+                break;
+            }
+            whole = keep;
+        }
+        slot->len = whole;
+        stream_done(&s, &s.crypted);
+    }
+
+    pthread_join(reader, 0);
+    pthread_join(writer, 0);
+    ret = s.err;
+
+destroy:
+    pthread_cond_destroy(&s.cond);
+    pthread_mutex_destroy(&s.lock);
+done:
+    for (cx = 0; cx < STREAM_SLOTS; cx++) {
+        free((s.slots + cx)->buf);
+    }
+    return ret;
+}
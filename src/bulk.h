@@ -0,0 +1,25 @@
+#ifndef BULK_H_20261017_093518
+#define BULK_H_20261017_093518
+
+#include <stdio.h>
+
+#include "cipher.h"
+#include "modes.h"
+
+int bulk_encrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  FILE *in, FILE *out, enum mode_e mode,
+                  const unsigned char *iv, unsigned int threads);
+int bulk_decrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  FILE *in, FILE *out, enum mode_e mode,
+                  const unsigned char *iv, unsigned int threads);
+int bulk_gcm (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+              FILE *in, FILE *out, const unsigned char *iv, size_t iv_len,
+              const unsigned char *aad, size_t aad_len, int decrypt);
+int bulk_map (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+              const char *in_path, const char *out_path, enum mode_e mode,
+              const unsigned char *iv, unsigned int threads, int decrypt);
+int bulk_stream (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                 int in_fd, int out_fd, enum mode_e mode,
+                 const unsigned char *iv, unsigned int threads, int decrypt);
+
+#endif /* BULK_H_20261017_093518 */
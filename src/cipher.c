@@ -0,0 +1,308 @@
+#include <string.h>
+
+#include "aesni.h"
+#include "aesvars.h"
+#include "bitslice.h"
+#include "cipher.h"
+#include "ttable.h"
+
+/**
+ * Multiplication by x in the finite field, without the visualizer baggage
+ */
+static unsigned char gf_xtime (unsigned char c) {
+    return (unsigned char) ((c << 1) ^ ((c & 0x80) ? 0x1b : 0x00));
+}
+
+/**
+ * S-box lookup on a byte
+ */
+static unsigned char gf_sbox (unsigned char c) {
+    return (unsigned char) *(*(SBOX + (c >> 4)) + (c & 0x0f));
+}
+
+/**
+ * Inverse s-box lookup on a byte
+ */
+static unsigned char gf_inv_sbox (unsigned char c) {
+    return (unsigned char) *(*(INV_SBOX + (c >> 4)) + (c & 0x0f));
+}
+
+/**
+ * Inverse mix columns on one column in input byte order
+ * Multiplying by {04}x^2 + {05} first turns it into mix columns, so
+ * only xtime is needed instead of the {0e}, {0b}, {0d}, {09} products
+ * col: pointer to unsigned char[4]
+ */
+static void gf_inv_mix (unsigned char *col) {
+    unsigned char s0 = *(col + 0);
+    unsigned char s1 = *(col + 1);
+    unsigned char s2 = *(col + 2);
+    unsigned char s3 = *(col + 3);
+    unsigned char u = gf_xtime(gf_xtime(s0 ^ s2));
+    unsigned char v = gf_xtime(gf_xtime(s1 ^ s3));
+    unsigned char all;
+
+    s0 ^= u;
+    s1 ^= v;
+    s2 ^= u;
+    s3 ^= v;
+    all = s0 ^ s1 ^ s2 ^ s3;
+    *(col + 0) = s0 ^ all ^ gf_xtime(s0 ^ s1);
+    *(col + 1) = s1 ^ all ^ gf_xtime(s1 ^ s2);
+    *(col + 2) = s2 ^ all ^ gf_xtime(s2 ^ s3);
+    *(col + 3) = s3 ^ all ^ gf_xtime(s3 ^ s0);
+}
+
+/**
+ * Number of words in a key
+ * len: length of the key in bytes
+ * Returns 4, 6 or 8, 0 if AES has no key of that length
+ */
+unsigned int key_words (size_t len) {
+    if (len == 16 || len == 24 || len == 32) {
+        return len / BPW;
+    }
+    return 0;
+}
+
+/**
+ * Expands a key into a schedule without any visualization
+ * Computes the same words as key_expand
+ * ctx: context to fill the schedule of
+ * key: pointer to unsigned char[nk * BPW]
+ * nk: length of the key in words, 4, 6 or 8
+ */
+void expand_key (struct aes_ctx_s *ctx, const unsigned char *key,
+                 unsigned int nk) {
+    unsigned char *sched = CTX_SCHED(ctx);
+    unsigned char rcon = 0x01;
+    unsigned char *w;
+    unsigned char *prev;
+    unsigned int cx;
+
+    ctx->nk = nk;
+    ctx->nr = nk + 6;
+    memcpy(sched, key, nk * BPW);
+
+    for (cx = nk; cx < NB * (ctx->nr + 1); cx++) {
+        w = sched + (cx * BPW);
+        prev = w - BPW;
+        if (cx % nk == 0) {
+            /* sub_word(shift_row(temp)) xor round_constant */
+            *(w + 0) = gf_sbox(*(prev + 1)) ^ rcon;
+            *(w + 1) = gf_sbox(*(prev + 2));
+            *(w + 2) = gf_sbox(*(prev + 3));
+            *(w + 3) = gf_sbox(*(prev + 0));
+            rcon = gf_xtime(rcon);
+        } else if (nk > 6 && cx % nk == 4) {
+            /* sub_word(temp) half way through an AES-256 key */
+            *(w + 0) = gf_sbox(*(prev + 0));
+            *(w + 1) = gf_sbox(*(prev + 1));
+            *(w + 2) = gf_sbox(*(prev + 2));
+            *(w + 3) = gf_sbox(*(prev + 3));
+        } else {
+            memcpy(w, prev, BPW);
+        }
+        /* schedule[cx] = schedule[cx-nk] xor temp */
+        *(w + 0) ^= *(w - (nk * BPW) + 0);
+        *(w + 1) ^= *(w - (nk * BPW) + 1);
+        *(w + 2) ^= *(w - (nk * BPW) + 2);
+        *(w + 3) ^= *(w - (nk * BPW) + 3);
+    }
+}
+
+/**
+ * Encrypts a single block without any visualization
+ * Does the same work as the round loop in main, but keeps the state in
+ * input byte order (column major) so no transposing is needed
+ * ctx: context holding the schedule
+ * out: pointer to unsigned char[BLOCK_SIZE], may be the same as in
+ * in: pointer to unsigned char[BLOCK_SIZE]
+ */
+void encrypt_block (const struct aes_ctx_s *ctx, unsigned char *out,
+                    const unsigned char *in) {
+    const unsigned char *sched = CTX_SCHED(ctx);
+    unsigned char s [BLOCK_SIZE];
+    unsigned char t [BLOCK_SIZE];
+    unsigned int round;
+    unsigned int cx;
+
+    /* Round 0 only adds key */
+    for (cx = 0; cx < BLOCK_SIZE; cx++) {
+        *(s + cx) = *(in + cx) ^ *(sched + cx);
+    }
+
+    for (round = 1; round <= ctx->nr; round++) {
+        /* Substitute bytes and shift rows in one pass */
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            unsigned int row = cx & 3;
+            unsigned int col = cx >> 2;
+            *(t + cx) = gf_sbox(*(s + ((((col + row) & 3) << 2) | row)));
+        }
+
+        /* Mix the columns except last round */
+        if (round != ctx->nr) {
+            for (cx = 0; cx < BLOCK_SIZE; cx += 4) {
+                unsigned char s0 = *(t + cx + 0);
+                unsigned char s1 = *(t + cx + 1);
+                unsigned char s2 = *(t + cx + 2);
+                unsigned char s3 = *(t + cx + 3);
+                unsigned char all = s0 ^ s1 ^ s2 ^ s3;
+
+                /* {02}a ^ {03}b == a ^ all ^ {02}(a ^ b) for a row pair */
+                *(t + cx + 0) = s0 ^ all ^ gf_xtime(s0 ^ s1);
+                *(t + cx + 1) = s1 ^ all ^ gf_xtime(s1 ^ s2);
+                *(t + cx + 2) = s2 ^ all ^ gf_xtime(s2 ^ s3);
+                *(t + cx + 3) = s3 ^ all ^ gf_xtime(s3 ^ s0);
+            }
+        }
+
+        /* Add the round key */
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            *(s + cx) = *(t + cx) ^ *(sched + (round * BLOCK_SIZE) + cx);
+        }
+    }
+
+    memcpy(out, s, BLOCK_SIZE);
+}
+
+/**
+ * Derives the schedule of the equivalent inverse cipher
+ * The round keys are reversed and all but the outer two go through
+ * inverse mix columns, so decryption has the same shape as encryption
+ * ctx: context with an expanded schedule, fills its dec_schedule
+ */
+void expand_dec_key (struct aes_ctx_s *ctx) {
+    const unsigned char *sched = CTX_SCHED(ctx);
+    unsigned char *dec = CTX_DEC_SCHED(ctx);
+    unsigned int round;
+    unsigned int cx;
+
+    memcpy(dec, sched + (ctx->nr * BLOCK_SIZE), BLOCK_SIZE);
+    for (round = 1; round < ctx->nr; round++) {
+        memcpy(dec + (round * BLOCK_SIZE),
+               sched + ((ctx->nr - round) * BLOCK_SIZE), BLOCK_SIZE);
+        for (cx = 0; cx < BLOCK_SIZE; cx += 4) {
+            gf_inv_mix(dec + (round * BLOCK_SIZE) + cx);
+        }
+    }
+    memcpy(dec + (ctx->nr * BLOCK_SIZE), sched, BLOCK_SIZE);
+}
+
+/**
+ * Decrypts a single block with the equivalent inverse cipher
+ * ctx: context holding the decryption schedule
+ * out: pointer to unsigned char[BLOCK_SIZE], may be the same as in
+ * in: pointer to unsigned char[BLOCK_SIZE]
+ */
+void decrypt_block (const struct aes_ctx_s *ctx, unsigned char *out,
+                    const unsigned char *in) {
+    const unsigned char *dec = CTX_DEC_SCHED(ctx);
+    unsigned char s [BLOCK_SIZE];
+    unsigned char t [BLOCK_SIZE];
+    unsigned int round;
+    unsigned int cx;
+
+    for (cx = 0; cx < BLOCK_SIZE; cx++) {
+        *(s + cx) = *(in + cx) ^ *(dec + cx);
+    }
+
+    for (round = 1; round <= ctx->nr; round++) {
+        /* Inverse substitute bytes and inverse shift rows in one pass */
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            unsigned int row = cx & 3;
+            unsigned int col = cx >> 2;
+            *(t + cx) = gf_inv_sbox(*(s + ((((col - row) & 3) << 2) | row)));
+        }
+
+        /* Inverse mix the columns except last round */
+        if (round != ctx->nr) {
+            for (cx = 0; cx < BLOCK_SIZE; cx += 4) {
+                gf_inv_mix(t + cx);
+            }
+        }
+
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            *(s + cx) = *(t + cx) ^ *(dec + (round * BLOCK_SIZE) + cx);
+        }
+    }
+
+    memcpy(out, s, BLOCK_SIZE);
+}
+
+/**
+ * Only the inverse s-box needs setting up for the reference engine
+ */
+static int ref_setup () {
+    gen_inv_sbox();
+    return 0;
+}
+
+/**
+ * Encrypts blocks one at a time with encrypt_block
+ */
+static void ref_encrypt (const struct aes_ctx_s *ctx, unsigned char *out,
+                         const unsigned char *in, size_t blocks) {
+    for (; blocks > 0; blocks--, in += BLOCK_SIZE, out += BLOCK_SIZE) {
+        encrypt_block(ctx, out, in);
+    }
+}
+
+/**
+ * Decrypts blocks one at a time with decrypt_block
+ */
+static void ref_decrypt (const struct aes_ctx_s *ctx, unsigned char *out,
+                         const unsigned char *in, size_t blocks) {
+    for (; blocks > 0; blocks--, in += BLOCK_SIZE, out += BLOCK_SIZE) {
+        decrypt_block(ctx, out, in);
+    }
+}
+
+/* Byte oriented reference engine */
+const struct engine_s ref_engine = {
+    "ref",
+    ref_setup,
+    expand_key,
+    ref_encrypt,
+    expand_dec_key,
+    ref_decrypt
+};
+
+/* Available engines, fastest first, null terminated */
+const struct engine_s *engines [] = {
+    &aesni_engine,
+    &ttable_engine,
+    &bitslice_engine,
+    &ref_engine,
+    0
+};
+
+/**
+ * Looks up an engine by name and sets it up
+ * name: name of the engine
+ * Returns null if there is no such engine or it can't run here
+ */
+const struct engine_s *engine_find (const char *name) {
+    const struct engine_s **e;
+
+    for (e = engines; *e; e++) {
+        if (!strcmp((*e)->name, name)) {
+            return ((*e)->setup()) ? 0 : *e;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Picks the fastest engine usable on this machine and sets it up
+ */
+const struct engine_s *engine_default () {
+    const struct engine_s **e;
+
+    for (e = engines; *e; e++) {
+        if (!(*e)->setup()) {
+            return *e;
+        }
+    }
+    return &ref_engine;
+}
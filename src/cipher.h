@@ -0,0 +1,70 @@
+#ifndef CIPHER_H_20261017_091204
+#define CIPHER_H_20261017_091204
+
+#include <stddef.h>
+
+#include "aesvars.h"
+
+/* Block size in bytes */
+#define BLOCK_SIZE 16
+/* Size of the largest key, AES-256, in bytes */
+#define KEY_SIZE_MAX 32
+/* Size of the largest key schedule, AES-256, in bytes */
+#define SCHED_SIZE (BLOCK_SIZE * 15)
+
+/**
+ * Calls X(r) for the full rounds 1 to NR - 1 of a key size, so code
+ * generated once per key size has every round written out
+ */
+#define FULL_ROUNDS_10(X) X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9)
+#define FULL_ROUNDS_12(X) FULL_ROUNDS_10(X) X(10) X(11)
+#define FULL_ROUNDS_14(X) FULL_ROUNDS_12(X) X(12) X(13)
+/* Picks FULL_ROUNDS_10, 12 or 14 by a literal number of rounds */
+#define FULL_ROUNDS(NR) FULL_ROUNDS_(NR)
+#define FULL_ROUNDS_(NR) FULL_ROUNDS_ ## NR
+
+/**
+ * The schedule of a context as flat bytes
+ * Round key r starts at byte r * BLOCK_SIZE and lines up with the input
+ */
+#define CTX_SCHED(C) ((unsigned char *) (C)->schedule)
+/* The decryption schedule of a context as flat bytes, same layout */
+#define CTX_DEC_SCHED(C) ((unsigned char *) (C)->dec_schedule)
+
+/* A non-visual implementation of the block cipher */
+struct engine_s {
+    /* Name used to select the engine */
+    const char *name;
+    /* One time setup, returns nonzero if unusable on this machine */
+    int (*setup) ();
+    /* Expands a raw key of nk words into the schedule of a context */
+    void (*expand) (struct aes_ctx_s *ctx, const unsigned char *key,
+                    unsigned int nk);
+    /**
+     * Encrypts blocks with the schedule of a context, picking the code
+     * for the key size once per call rather than per block or round
+     */
+    void (*encrypt) (const struct aes_ctx_s *ctx, unsigned char *out,
+                     const unsigned char *in, size_t blocks);
+    /* Derives the decryption schedule from the expanded schedule */
+    void (*expand_dec) (struct aes_ctx_s *ctx);
+    /* Decrypts blocks with the decryption schedule of a context */
+    void (*decrypt) (const struct aes_ctx_s *ctx, unsigned char *out,
+                     const unsigned char *in, size_t blocks);
+};
+
+extern const struct engine_s ref_engine;
+extern const struct engine_s *engines [];
+
+const struct engine_s *engine_find (const char *name);
+const struct engine_s *engine_default ();
+unsigned int key_words (size_t len);
+void expand_key (struct aes_ctx_s *ctx, const unsigned char *key,
+                 unsigned int nk);
+void encrypt_block (const struct aes_ctx_s *ctx, unsigned char *out,
+                    const unsigned char *in);
+void expand_dec_key (struct aes_ctx_s *ctx);
+void decrypt_block (const struct aes_ctx_s *ctx, unsigned char *out,
+                    const unsigned char *in);
+
+#endif /* CIPHER_H_20261017_091204 */
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesvars.h"
+#include "events.h"
+
+/* Events to start a log with, enough for a whole AES-128 block */
+#define EVENT_LOG_START 2048
+
+/* Log the primitives record into, null when nothing is recording */
+struct event_log_s *event_log = 0;
+
+/* Operation offsets */
+int NO_OP = -1;
+int COPY_INIT_KEY_OP = 0;
+int GET_PREV_KEY_OP = 1;
+int SHIFT_ROW_OP = 2;
+int SUB_ROW_OP = 3;
+int ADD_ROUND_CONST_OP = 4;
+int ADD_EQUIV_KEY_OP = 5;
+int SAVE_KEY_OP = 6;
+int COPY_INTO_STATE_OP = 7;
+int SUB_BYTES_OP = 8;
+int MIX_COLS_OP = 9;
+int ADD_ROUND_KEY_OP = 10;
+int INV_SHIFT_ROWS_OP = 11;
+int INV_SUB_BYTES_OP = 12;
+int INV_MIX_COLS_OP = 13;
+
+/**
+ * Initializes an empty event log
+ * log: pointer to an event_log_s
+ */
+void event_log_init (struct event_log_s *log) {
+    log->events = 0;
+    log->count = 0;
+    log->size = 0;
+}
+
+/**
+ * Frees the events of a log
+ * log: pointer to an event_log_s
+ */
+void event_log_free (struct event_log_s *log) {
+    free(log->events);
+    event_log_init(log);
+}
+
+/**
+ * Records an event in the current log
+ * type: kind of event
+ * a: first argument, meaning depends on the type
+ * b: second argument, meaning depends on the type
+ * v: pointer to char[4] or null
+ */
+void event_push (enum event_type_e type, unsigned int a, unsigned int b,
+                 const char *v) {
+    struct event_s *ev;
+
+    /* Grow the log by doubling */
+    if (event_log->count == event_log->size) {
+        size_t size = event_log->size ? event_log->size * 2 : EVENT_LOG_START;
+
+        ev = realloc(event_log->events, size * sizeof(*ev));
+        if (!ev) {
+            perror("event log");
+            exit(1);
+        }
+        event_log->events = ev;
+        event_log->size = size;
+    }
+
+    ev = event_log->events + event_log->count++;
+    ev->type = type;
+    ev->a = a;
+    ev->b = b;
+    if (v) {
+        memcpy(ev->v, v, sizeof(ev->v));
+    } else {
+        memset(ev->v, 0, sizeof(ev->v));
+    }
+}
+
+/**
+ * Finds where a round starts in a log
+ * log: pointer to an event_log_s
+ * round: round number
+ * Returns the index of the first event of the round, -1 if there is none
+ */
+long event_find_round (const struct event_log_s *log, unsigned int round) {
+    const struct event_s *ev;
+    size_t cx;
+
+    for (cx = 0; cx < log->count; cx++) {
+        ev = log->events + cx;
+        if (ev->type == EV_STEP && ev->a == STEP_ROUND && ev->b == round) {
+            /* Include clearing the description for the round */
+            if (cx > 0 && (ev - 1)->type == EV_DESC_CLEAR) {
+                cx--;
+            }
+            return cx;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Finds where the key expansion starts working on a schedule word
+ * log: pointer to an event_log_s
+ * word: index of the word in the schedule
+ * Returns the index of the first event for the word, -1 if there is none
+ */
+long event_find_word (const struct event_log_s *log, unsigned int word) {
+    const struct event_s *ev;
+    size_t start = 0;
+    size_t cx;
+
+    for (cx = 0; cx < log->count; cx++) {
+        ev = log->events + cx;
+        /* Words from the key are copied, the rest start from scratch */
+        if (ev->type == EV_STEP || ev->type == EV_DESC_CLEAR) {
+            start = cx;
+        } else if (word < NK && ev->type == EV_SCHED_WORD && ev->a == word) {
+            return (word == 0) ? start : cx;
+        } else if (word >= NK && ev->type == EV_PREV_WORD
+                   && ev->a == word - 1) {
+            return start;
+        }
+    }
+    return -1;
+}
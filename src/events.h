@@ -0,0 +1,107 @@
+#ifndef EVENTS_H_20261017_151822
+#define EVENTS_H_20261017_151822
+
+#include <stddef.h>
+
+/* Kinds of event the step by step cipher emits */
+enum event_type_e {
+    /* Step shown in the current step window, a: step_e, b: round */
+    EV_STEP,
+    /* Operation highlighted, a: operation number as a signed char */
+    EV_OP,
+    /* Description window cleared */
+    EV_DESC_CLEAR,
+    /* Word written on the next line of the description, v: word */
+    EV_DESC_WORD,
+    /* Word saved in the schedule, a: word index, v: word */
+    EV_SCHED_WORD,
+    /* Finished schedule shown from the top */
+    EV_SCHED_SHOW,
+    /* Previous schedule word fetched, a: word index, v: word */
+    EV_PREV_WORD,
+    /* Row shifted */
+    EV_ROW_SHIFT,
+    /* Word substitution started and finished */
+    EV_SUB_BEGIN,
+    EV_SUB_END,
+    /* S-box lookup, a: row, b: column */
+    EV_SBOX,
+    /* Byte of a word substituted, a: position, b: new byte */
+    EV_SUB_BYTE,
+    /* Round constant added, v: round constant word */
+    EV_RCON,
+    /* Round key word fetched, a: column of the round key, v: word */
+    EV_ROUND_KEY,
+    /* State row changed, a: row, v: row */
+    EV_STATE_ROW,
+    /* State column mixed, a: column, v: column top to bottom */
+    EV_MIX_COL,
+    /* State shown in the state window */
+    EV_STATE_SHOW,
+    /* Input copied into the state */
+    EV_INPUT,
+    /* Final state copied into the output */
+    EV_OUTPUT
+};
+
+/* Steps shown in the current step window */
+enum step_e {
+    STEP_KEY_EXPANSION,
+    STEP_COPY_INPUT,
+    STEP_ROUND,
+    STEP_OUTPUT
+};
+
+/* One event, small enough that a whole block is a few kilobytes */
+struct event_s {
+    unsigned char type;
+    unsigned char a;
+    unsigned char b;
+    char v [4];
+};
+
+/* A growable list of events */
+struct event_log_s {
+    struct event_s *events;
+    size_t count;
+    size_t size;
+};
+
+/* Log the primitives record into, null when nothing is recording */
+extern struct event_log_s *event_log;
+
+extern int NO_OP;
+extern int COPY_INIT_KEY_OP;
+extern int GET_PREV_KEY_OP;
+extern int SHIFT_ROW_OP;
+extern int SUB_ROW_OP;
+extern int ADD_ROUND_CONST_OP;
+extern int ADD_EQUIV_KEY_OP;
+extern int SAVE_KEY_OP;
+extern int COPY_INTO_STATE_OP;
+extern int SUB_BYTES_OP;
+extern int MIX_COLS_OP;
+extern int ADD_ROUND_KEY_OP;
+extern int INV_SHIFT_ROWS_OP;
+extern int INV_SUB_BYTES_OP;
+extern int INV_MIX_COLS_OP;
+
+void event_log_init (struct event_log_s *log);
+void event_log_free (struct event_log_s *log);
+void event_push (enum event_type_e type, unsigned int a, unsigned int b,
+                 const char *v);
+long event_find_round (const struct event_log_s *log, unsigned int round);
+long event_find_word (const struct event_log_s *log, unsigned int word);
+
+/**
+ * Records an event if anything is recording
+ * Inline so that without a log the primitives pay a single branch
+ */
+static inline void emit (enum event_type_e type, unsigned int a,
+                         unsigned int b, const char *v) {
+    if (event_log) {
+        event_push(type, a, b, v);
+    }
+}
+
+#endif /* EVENTS_H_20261017_151822 */
@@ -0,0 +1,529 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cipher.h"
+#include "gcm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define GCM_CLMUL 1
+/* Only these functions get compiled with the carry-less multiply enabled */
+#define CLMUL_FN __attribute__((target("pclmul,ssse3")))
+#endif
+
+/* Counter blocks encrypted per engine call */
+#define GCM_CTR_BATCH 64
+/* Bytes encrypted before they are hashed, small enough to stay in cache */
+#define GCM_CHUNK (GCM_CTR_BATCH * BLOCK_SIZE)
+
+/* Reduction of the 4 bits shifted out per step of the table multiply */
+static const uint64_t last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/**
+ * Loads 8 bytes as a big endian number
+ */
+static uint64_t load64_be (const unsigned char *p) {
+    uint64_t v = 0;
+    unsigned int cx;
+
+    for (cx = 0; cx < 8; cx++) {
+        v = (v << 8) | *(p + cx);
+    }
+    return v;
+}
+
+/**
+ * Stores a number as 8 big endian bytes
+ */
+static void store64_be (unsigned char *p, uint64_t v) {
+    unsigned int cx;
+
+    for (cx = 8; cx > 0; cx--, v >>= 8) {
+        *(p + cx - 1) = (unsigned char) v;
+    }
+}
+
+/**
+ * Multiplies x by H in place through the 4 bit tables
+ * x: pointer to unsigned char[BLOCK_SIZE]
+ */
+static void gf128_mul_table (const struct gcm_s *g, unsigned char *x) {
+    uint64_t zh;
+    uint64_t zl;
+    unsigned int lo;
+    unsigned int hi;
+    unsigned int rem;
+    int cx;
+
+    lo = *(x + 15) & 0x0f;
+    zh = *(g->hh + lo);
+    zl = *(g->hl + lo);
+    for (cx = 15; cx >= 0; cx--) {
+        lo = *(x + cx) & 0x0f;
+        hi = *(x + cx) >> 4;
+        if (cx != 15) {
+            rem = zl & 0x0f;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (*(last4 + rem) << 48);
+            zh ^= *(g->hh + lo);
+            zl ^= *(g->hl + lo);
+        }
+        rem = zl & 0x0f;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (*(last4 + rem) << 48);
+        zh ^= *(g->hh + hi);
+        zl ^= *(g->hl + hi);
+    }
+    store64_be(x, zh);
+    store64_be(x + 8, zl);
+}
+
+/**
+ * Hashes whole blocks into x with the tables
+ */
+static void ghash_table (const struct gcm_s *g, unsigned char *x,
+                         const unsigned char *data, size_t blocks) {
+    unsigned int cx;
+
+    for (; blocks > 0; blocks--, data += BLOCK_SIZE) {
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            *(x + cx) ^= *(data + cx);
+        }
+        gf128_mul_table(g, x);
+    }
+}
+
+#ifdef GCM_CLMUL
+
+/**
+ * Checks CPUID for PCLMULQDQ and the byte shuffle
+ * Returns nonzero if both are available
+ */
+static int clmul_usable () {
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+}
+
+/* GHASH works on bit reflected numbers, blocks are byte reversed first */
+CLMUL_FN static __m128i clmul_bswap (__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+                                            10, 11, 12, 13, 14, 15));
+}
+
+/**
+ * 256 bit carry-less product of a and b, added into lo and hi
+ * Products are summed before reducing, the reduction is linear
+ */
+CLMUL_FN static void clmul_wide (__m128i a, __m128i b, __m128i *lo,
+                                 __m128i *hi) {
+    __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10),
+                                _mm_clmulepi64_si128(a, b, 0x01));
+
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00),
+                                           _mm_slli_si128(mid, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11),
+                                           _mm_srli_si128(mid, 8)));
+}
+
+/**
+ * Reduces a 256 bit product modulo x^128 + x^7 + x^2 + x + 1
+ * The product of reflected numbers is one bit short, so it is shifted
+ * left by one first
+ */
+CLMUL_FN static __m128i clmul_reduce (__m128i lo, __m128i hi) {
+    __m128i t1 = _mm_srli_epi32(lo, 31);
+    __m128i t2 = _mm_srli_epi32(hi, 31);
+    __m128i t3 = _mm_srli_si128(t1, 12);
+
+    lo = _mm_or_si128(_mm_slli_epi32(lo, 1), _mm_slli_si128(t1, 4));
+    hi = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(hi, 1),
+                                   _mm_slli_si128(t2, 4)), t3);
+
+    t1 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31),
+                                     _mm_slli_epi32(lo, 30)),
+                       _mm_slli_epi32(lo, 25));
+    t2 = _mm_srli_si128(t1, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t1, 12));
+    t1 = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1),
+                                     _mm_srli_epi32(lo, 2)),
+                       _mm_xor_si128(_mm_srli_epi32(lo, 7), t2));
+    return _mm_xor_si128(hi, _mm_xor_si128(lo, t1));
+}
+
+/**
+ * Multiplies two byte reversed field elements
+ */
+CLMUL_FN static __m128i clmul_mul (__m128i a, __m128i b) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+
+    clmul_wide(a, b, &lo, &hi);
+    return clmul_reduce(lo, hi);
+}
+
+/**
+ * Fills in H^2 to H^4 from H in hpow
+ */
+CLMUL_FN static void clmul_powers (struct gcm_s *g) {
+    __m128i h = _mm_loadu_si128((const __m128i *) *g->hpow);
+    __m128i p = h;
+    unsigned int cx;
+
+    for (cx = 1; cx < 4; cx++) {
+        p = clmul_mul(p, h);
+        _mm_storeu_si128((__m128i *) *(g->hpow + cx), p);
+    }
+}
+
+/**
+ * Hashes whole blocks into x with the carry-less multiply
+ * Four blocks share one reduction: ((x + c1) H^4 + c2 H^3 + c3 H^2 +
+ * c4 H) is the same as four steps of (x + c) H
+ */
+CLMUL_FN static void ghash_clmul (const struct gcm_s *g, unsigned char *x,
+                                  const unsigned char *data, size_t blocks) {
+    __m128i h1 = _mm_loadu_si128((const __m128i *) *g->hpow);
+    __m128i h2 = _mm_loadu_si128((const __m128i *) *(g->hpow + 1));
+    __m128i h3 = _mm_loadu_si128((const __m128i *) *(g->hpow + 2));
+    __m128i h4 = _mm_loadu_si128((const __m128i *) *(g->hpow + 3));
+    __m128i acc = clmul_bswap(_mm_loadu_si128((const __m128i *) x));
+    __m128i lo;
+    __m128i hi;
+
+    for (; blocks >= 4; blocks -= 4, data += 4 * BLOCK_SIZE) {
+        lo = _mm_setzero_si128();
+        hi = _mm_setzero_si128();
+        clmul_wide(_mm_xor_si128(acc, clmul_bswap(
+                       _mm_loadu_si128((const __m128i *) data))),
+                   h4, &lo, &hi);
+        clmul_wide(clmul_bswap(_mm_loadu_si128(
+                       (const __m128i *) (data + BLOCK_SIZE))), h3, &lo, &hi);
+        clmul_wide(clmul_bswap(_mm_loadu_si128(
+                       (const __m128i *) (data + 2 * BLOCK_SIZE))),
+                   h2, &lo, &hi);
+        clmul_wide(clmul_bswap(_mm_loadu_si128(
+                       (const __m128i *) (data + 3 * BLOCK_SIZE))),
+                   h1, &lo, &hi);
+        acc = clmul_reduce(lo, hi);
+    }
+    for (; blocks > 0; blocks--, data += BLOCK_SIZE) {
+        acc = clmul_mul(_mm_xor_si128(acc, clmul_bswap(
+                            _mm_loadu_si128((const __m128i *) data))), h1);
+    }
+    _mm_storeu_si128((__m128i *) x, clmul_bswap(acc));
+}
+
+#endif
+
+/**
+ * Hashes data into x, a last partial block padded with zeros
+ * x: pointer to unsigned char[BLOCK_SIZE], the running hash
+ * data: pointer to unsigned char[len]
+ * len: number of bytes
+ */
+static void ghash (const struct gcm_s *g, unsigned char *x,
+                   const unsigned char *data, size_t len) {
+    unsigned char last [BLOCK_SIZE] = {0};
+    size_t blocks = len / BLOCK_SIZE;
+    size_t rest = len % BLOCK_SIZE;
+
+#ifdef GCM_CLMUL
+    if (g->clmul) {
+        ghash_clmul(g, x, data, blocks);
+        if (rest) {
+            memcpy(last, data + (blocks * BLOCK_SIZE), rest);
+            ghash_clmul(g, x, last, 1);
+        }
+        return;
+    }
+#endif
+    ghash_table(g, x, data, blocks);
+    if (rest) {
+        memcpy(last, data + (blocks * BLOCK_SIZE), rest);
+        ghash_table(g, x, last, 1);
+    }
+}
+
+/**
+ * Sets up GCM for a key
+ * g: GCM key to set up
+ * eng: engine to encrypt with
+ * ctx: context holding the expanded schedule, must outlive g
+ */
+void gcm_init (struct gcm_s *g, const struct engine_s *eng,
+               const struct aes_ctx_s *ctx) {
+    unsigned char h [BLOCK_SIZE] = {0};
+    uint64_t vh;
+    uint64_t vl;
+    uint64_t t;
+    unsigned int cx;
+    unsigned int cx2;
+
+    memset(g, 0, sizeof(*g));
+    g->eng = eng;
+    g->ctx = ctx;
+    eng->encrypt(ctx, h, h, 1);
+
+    /* H times 8, 4, 2 and 1 in the reflected order, the rest are sums */
+    vh = load64_be(h);
+    vl = load64_be(h + 8);
+    *(g->hh + 8) = vh;
+    *(g->hl + 8) = vl;
+    for (cx = 4; cx > 0; cx >>= 1) {
+        t = (vl & 1) ? 0xe100000000000000ULL : 0;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ t;
+        *(g->hh + cx) = vh;
+        *(g->hl + cx) = vl;
+    }
+    for (cx = 2; cx <= 8; cx <<= 1) {
+        for (cx2 = 1; cx2 < cx; cx2++) {
+            *(g->hh + cx + cx2) = *(g->hh + cx) ^ *(g->hh + cx2);
+            *(g->hl + cx + cx2) = *(g->hl + cx) ^ *(g->hl + cx2);
+        }
+    }
+
+#ifdef GCM_CLMUL
+    g->clmul = clmul_usable();
+    if (g->clmul) {
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            *(*g->hpow + cx) = *(h + BLOCK_SIZE - 1 - cx);
+        }
+        clmul_powers(g);
+    }
+#endif
+}
+
+/**
+ * Derives the pre-counter block J0 from the nonce
+ * j0: pointer to unsigned char[BLOCK_SIZE]
+ */
+static void gcm_j0 (const struct gcm_s *g, unsigned char *j0,
+                    const unsigned char *iv, size_t iv_len) {
+    unsigned char lens [BLOCK_SIZE] = {0};
+
+    memset(j0, 0, BLOCK_SIZE);
+    if (iv_len == GCM_IV_SIZE) {
+        memcpy(j0, iv, GCM_IV_SIZE);
+        *(j0 + BLOCK_SIZE - 1) = 1;
+        return;
+    }
+    ghash(g, j0, iv, iv_len);
+    store64_be(lens + 8, (uint64_t) iv_len * 8);
+    ghash(g, j0, lens, BLOCK_SIZE);
+}
+
+/**
+ * Stores a number as 4 big endian bytes
+ */
+static void store32_be (unsigned char *p, uint32_t v) {
+    *p = (unsigned char) (v >> 24);
+    *(p + 1) = (unsigned char) (v >> 16);
+    *(p + 2) = (unsigned char) (v >> 8);
+    *(p + 3) = (unsigned char) v;
+}
+
+/**
+ * Xors the key stream into buf, the counter only counts in its last 32
+ * bits as GCM has it
+ * ctr: counter block for the first block, advanced past buf
+ */
+static void gcm_ctr (const struct gcm_s *g, unsigned char *ctr,
+                     unsigned char *buf, size_t len) {
+    unsigned char ctrs [GCM_CTR_BATCH * BLOCK_SIZE];
+    uint32_t c = (uint32_t) load64_be(ctr + 8);
+    uint64_t a;
+    uint64_t b;
+    size_t n;
+    size_t cx;
+
+    while (len > 0) {
+        n = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (n > GCM_CTR_BATCH) {
+            n = GCM_CTR_BATCH;
+        }
+        for (cx = 0; cx < n; cx++, c++) {
+            memcpy(ctrs + (cx * BLOCK_SIZE), ctr, BLOCK_SIZE - 4);
+            store32_be(ctrs + (cx * BLOCK_SIZE) + 12, c);
+        }
+        g->eng->encrypt(g->ctx, ctrs, ctrs, n);
+
+        /* Whole words at a time, the compiler turns these into loads */
+        n *= BLOCK_SIZE;
+        if (n > len) {
+            n = len;
+        }
+        for (cx = 0; cx + 8 <= n; cx += 8) {
+            memcpy(&a, buf + cx, 8);
+            memcpy(&b, ctrs + cx, 8);
+            a ^= b;
+            memcpy(buf + cx, &a, 8);
+        }
+        for (; cx < n; cx++) {
+            *(buf + cx) ^= *(ctrs + cx);
+        }
+        buf += n;
+        len -= n;
+    }
+    store32_be(ctr + 12, c);
+}
+
+/**
+ * Starts GCM over data that comes a piece at a time
+ * s: stream to set up
+ * g: GCM key, must outlive s
+ * Other arguments are the same as for gcm_encrypt
+ */
+void gcm_start (struct gcm_stream_s *s, const struct gcm_s *g,
+                const unsigned char *iv, size_t iv_len,
+                const unsigned char *aad, size_t aad_len) {
+    memset(s, 0, sizeof(*s));
+    s->g = g;
+    gcm_j0(g, s->ctr, iv, iv_len);
+    /* The data starts at the counter after J0, E(J0) masks the tag */
+    gcm_ctr(g, s->ctr, s->mask, BLOCK_SIZE);
+    ghash(g, s->x, aad, aad_len);
+    s->aad_len = aad_len;
+}
+
+/**
+ * Encrypts or decrypts the next piece of data in place and hashes the
+ * ciphertext
+ * Every chunk is hashed while it is still in cache, after encrypting it
+ * or before decrypting it
+ * buf: pointer to unsigned char[len], a whole number of blocks unless it
+ *      is the last piece
+ * decrypt: nonzero if buf holds ciphertext
+ */
+void gcm_update (struct gcm_stream_s *s, unsigned char *buf, size_t len,
+                 int decrypt) {
+    size_t off;
+    size_t n;
+
+    for (off = 0; off < len; off += n) {
+        n = (len - off < GCM_CHUNK) ? len - off : GCM_CHUNK;
+        if (decrypt) {
+            ghash(s->g, s->x, buf + off, n);
+            gcm_ctr(s->g, s->ctr, buf + off, n);
+        } else {
+            gcm_ctr(s->g, s->ctr, buf + off, n);
+            ghash(s->g, s->x, buf + off, n);
+        }
+    }
+    s->len += len;
+}
+
+/**
+ * Hashes the next piece of ciphertext without decrypting it, to check
+ * the tag before any plaintext is made
+ * data: pointer to unsigned char[len], as for gcm_update
+ */
+void gcm_hash (struct gcm_stream_s *s, const unsigned char *data,
+               size_t len) {
+    ghash(s->g, s->x, data, len);
+    s->len += len;
+}
+
+/**
+ * Decrypts the next piece of ciphertext in place without hashing it,
+ * once the tag has been checked with gcm_hash
+ * buf: pointer to unsigned char[len], as for gcm_update
+ */
+void gcm_crypt (struct gcm_stream_s *s, unsigned char *buf, size_t len) {
+    gcm_ctr(s->g, s->ctr, buf, len);
+}
+
+/**
+ * Finishes the tag over everything hashed so far
+ * tag: pointer to unsigned char[tag_len], set to the tag
+ * tag_len: tag length in bytes, at most GCM_TAG_SIZE
+ */
+void gcm_finish (const struct gcm_stream_s *s, unsigned char *tag,
+                 size_t tag_len) {
+    unsigned char lens [BLOCK_SIZE];
+    unsigned char x [BLOCK_SIZE];
+    unsigned int cx;
+
+    memcpy(x, s->x, BLOCK_SIZE);
+    store64_be(lens, s->aad_len * 8);
+    store64_be(lens + 8, s->len * 8);
+    ghash(s->g, x, lens, BLOCK_SIZE);
+    for (cx = 0; cx < tag_len; cx++) {
+        *(tag + cx) = *(x + cx) ^ *(s->mask + cx);
+    }
+}
+
+/**
+ * Checks a tag against everything hashed so far, in constant time
+ * tag: pointer to unsigned char[tag_len], the tag to check
+ * Returns 0 if the tag matches, -1 otherwise
+ */
+int gcm_check (const struct gcm_stream_s *s, const unsigned char *tag,
+               size_t tag_len) {
+    unsigned char full [GCM_TAG_SIZE];
+    unsigned char diff = 0;
+    size_t cx;
+
+    gcm_finish(s, full, GCM_TAG_SIZE);
+    for (cx = 0; cx < tag_len; cx++) {
+        diff |= *(full + cx) ^ *(tag + cx);
+    }
+    return (diff || tag_len == 0) ? -1 : 0;
+}
+
+/**
+ * Encrypts and authenticates a buffer in place
+ * g: GCM key
+ * iv: pointer to unsigned char[iv_len], the nonce, never to be reused
+ *     with the same key
+ * iv_len: nonce length in bytes, GCM_IV_SIZE unless there is a reason
+ * aad: pointer to unsigned char[aad_len], authenticated but not
+ *      encrypted, may be null if aad_len is 0
+ * buf: pointer to unsigned char[len], plaintext in, ciphertext out
+ * tag: pointer to unsigned char[tag_len], set to the tag
+ * tag_len: tag length in bytes, at most GCM_TAG_SIZE
+ */
+void gcm_encrypt (const struct gcm_s *g, const unsigned char *iv,
+                  size_t iv_len, const unsigned char *aad, size_t aad_len,
+                  unsigned char *buf, size_t len, unsigned char *tag,
+                  size_t tag_len) {
+    struct gcm_stream_s s;
+
+    gcm_start(&s, g, iv, iv_len, aad, aad_len);
+    gcm_update(&s, buf, len, 0);
+    gcm_finish(&s, tag, tag_len);
+}
+
+/**
+ * Checks and decrypts a buffer in place
+ * Arguments are the same as for gcm_encrypt, with buf holding the
+ * ciphertext and tag the tag to check
+ * Returns 0 if the tag matches, -1 otherwise, buf is wiped then so no
+ * unauthenticated plaintext gets out
+ */
+int gcm_decrypt (const struct gcm_s *g, const unsigned char *iv,
+                 size_t iv_len, const unsigned char *aad, size_t aad_len,
+                 unsigned char *buf, size_t len, const unsigned char *tag,
+                 size_t tag_len) {
+    struct gcm_stream_s s;
+
+    gcm_start(&s, g, iv, iv_len, aad, aad_len);
+    gcm_update(&s, buf, len, 1);
+    if (gcm_check(&s, tag, tag_len)) {
+        memset(buf, 0, len);
+        return -1;
+    }
+    return 0;
+}
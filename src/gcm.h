@@ -0,0 +1,70 @@
+#ifndef GCM_H_20261017_183022
+#define GCM_H_20261017_183022
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cipher.h"
+
+/* Length of the recommended nonce, anything else goes through GHASH */
+#define GCM_IV_SIZE 12
+/* Length of a full tag, shorter ones are its leading bytes */
+#define GCM_TAG_SIZE 16
+
+/**
+ * A key set up for GCM
+ * Only read by gcm_encrypt and gcm_decrypt, so it can be shared between
+ * threads like the schedule it points to
+ */
+struct gcm_s {
+    const struct engine_s *eng;
+    const struct aes_ctx_s *ctx;
+    /* Set by gcm_init when PCLMULQDQ is usable, clear it to use the tables */
+    int clmul;
+    /* H to H^4 byte reversed, for four blocks per reduction */
+    unsigned char hpow [4][BLOCK_SIZE];
+    /* Multiples of H by every 4 bit value, low and high halves */
+    uint64_t hl [16];
+    uint64_t hh [16];
+};
+
+/**
+ * GCM over data that comes a piece at a time, every piece but the last
+ * a whole number of blocks
+ */
+struct gcm_stream_s {
+    const struct gcm_s *g;
+    /* Counter block of the next block of data */
+    unsigned char ctr [BLOCK_SIZE];
+    /* GHASH of everything so far */
+    unsigned char x [BLOCK_SIZE];
+    /* E(J0), masks the tag */
+    unsigned char mask [BLOCK_SIZE];
+    uint64_t aad_len;
+    uint64_t len;
+};
+
+void gcm_init (struct gcm_s *g, const struct engine_s *eng,
+               const struct aes_ctx_s *ctx);
+void gcm_encrypt (const struct gcm_s *g, const unsigned char *iv,
+                  size_t iv_len, const unsigned char *aad, size_t aad_len,
+                  unsigned char *buf, size_t len, unsigned char *tag,
+                  size_t tag_len);
+int gcm_decrypt (const struct gcm_s *g, const unsigned char *iv,
+                 size_t iv_len, const unsigned char *aad, size_t aad_len,
+                 unsigned char *buf, size_t len, const unsigned char *tag,
+                 size_t tag_len);
+void gcm_start (struct gcm_stream_s *s, const struct gcm_s *g,
+                const unsigned char *iv, size_t iv_len,
+                const unsigned char *aad, size_t aad_len);
+void gcm_update (struct gcm_stream_s *s, unsigned char *buf, size_t len,
+                 int decrypt);
+void gcm_hash (struct gcm_stream_s *s, const unsigned char *data,
+               size_t len);
+void gcm_crypt (struct gcm_stream_s *s, unsigned char *buf, size_t len);
+void gcm_finish (const struct gcm_stream_s *s, unsigned char *tag,
+                 size_t tag_len);
+int gcm_check (const struct gcm_stream_s *s, const unsigned char *tag,
+               size_t tag_len);
+
+#endif /* GCM_H_20261017_183022 */
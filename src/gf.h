@@ -0,0 +1,20 @@
+#ifndef GF_H_20261017_163544
+#define GF_H_20261017_163544
+
+/**
+ * GF(2^8) tables generated and checked at build time by gf_gen
+ * GF_LOG holds logs to the base {03}, GF_EXP its powers twice over, so
+ * the sum of two logs indexes it directly
+ */
+extern const unsigned char GF_LOG [256];
+extern const unsigned char GF_EXP [512];
+
+/* Products with the mix columns and inverse mix columns constants */
+extern const unsigned char GF_MUL_02 [256];
+extern const unsigned char GF_MUL_03 [256];
+extern const unsigned char GF_MUL_09 [256];
+extern const unsigned char GF_MUL_0B [256];
+extern const unsigned char GF_MUL_0D [256];
+extern const unsigned char GF_MUL_0E [256];
+
+#endif /* GF_H_20261017_163544 */
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "aesvars.h"
+#include "ops.h"
+
+/* Mismatches reported before the rest are only counted */
+#define CHECK_REPORT 8
+
+/* Rows of mix columns, the inverse rows are the same rotated */
+static const unsigned char mix_row [4] = {0x02, 0x03, 0x01, 0x01};
+static const unsigned char inv_mix_row [4] = {0x0e, 0x0b, 0x0d, 0x09};
+
+/* Mismatches found so far */
+static unsigned long failures = 0;
+
+/**
+ * Bit-serial multiplication in the finite field, the reference
+ * Shares nothing with the tables the cipher uses
+ */
+static unsigned char mult_ref (unsigned char a, unsigned char b) {
+    unsigned char ret = 0;
+    unsigned int cx;
+
+    for (cx = 0; cx < 8; cx++) {
+        if (b & (1 << cx)) {
+            ret ^= a;
+        }
+        a = (unsigned char) ((a << 1) ^ ((a & 0x80) ? 0x1b : 0x00));
+    }
+    return ret;
+}
+
+/**
+ * Counts a mismatch and reports the first few
+ * what: name of the routine and its arguments
+ */
+static void fail (const char *what, unsigned int got, unsigned int want) {
+    if (failures < CHECK_REPORT) {
+        fprintf(stderr, "gf_check: %s is %02x, expected %02x\n", what, got,
+                want);
+    }
+    failures++;
+}
+
+/**
+ * Multiplies a column by the circulant matrix of a row
+ * out: pointer to unsigned char[4]
+ * in: pointer to unsigned char[4]
+ * row: pointer to unsigned char[4], the first row of the matrix
+ */
+static void col_ref (unsigned char *out, const unsigned char *in,
+                     const unsigned char *row) {
+    unsigned int r;
+    unsigned int c;
+
+    for (r = 0; r < 4; r++) {
+        *(out + r) = 0;
+        for (c = 0; c < 4; c++) {
+            *(out + r) ^= mult_ref(*(in + c), *(row + ((c + 4 - r) % 4)));
+        }
+    }
+}
+
+/**
+ * Runs one column through mix_col and inv_mix_col and checks both
+ * against the bit-serial matrix product, and that they undo each other
+ * ctx: context whose state is used
+ * col: column of the state to use
+ * in: pointer to unsigned char[4], the column
+ */
+static void check_col (struct aes_ctx_s *ctx, unsigned int col,
+                       const unsigned char *in) {
+    unsigned char want [4];
+    unsigned char inv [4];
+    char what [48];
+    unsigned int r;
+
+    col_ref(want, in, mix_row);
+    col_ref(inv, in, inv_mix_row);
+    for (r = 0; r < 4; r++) {
+        *(*(ctx->state + r) + col) = *(in + r);
+    }
+
+    mix_col(ctx, col);
+    for (r = 0; r < 4; r++) {
+        snprintf(what, sizeof(what), "mix_col(%02x%02x%02x%02x)[%u]",
+                 *in, *(in + 1), *(in + 2), *(in + 3), r);
+        if ((unsigned char) *(*(ctx->state + r) + col) != *(want + r)) {
+            fail(what, (unsigned char) *(*(ctx->state + r) + col),
+                 *(want + r));
+        }
+    }
+    inv_mix_col(ctx, col);
+    for (r = 0; r < 4; r++) {
+        snprintf(what, sizeof(what), "inv_mix_col(mix_col(%02x%02x%02x%02x))"
+                 "[%u]", *in, *(in + 1), *(in + 2), *(in + 3), r);
+        if ((unsigned char) *(*(ctx->state + r) + col) != *(in + r)) {
+            fail(what, (unsigned char) *(*(ctx->state + r) + col),
+                 *(in + r));
+        }
+    }
+
+    for (r = 0; r < 4; r++) {
+        *(*(ctx->state + r) + col) = *(in + r);
+    }
+    inv_mix_col(ctx, col);
+    for (r = 0; r < 4; r++) {
+        snprintf(what, sizeof(what), "inv_mix_col(%02x%02x%02x%02x)[%u]",
+                 *in, *(in + 1), *(in + 2), *(in + 3), r);
+        if ((unsigned char) *(*(ctx->state + r) + col) != *(inv + r)) {
+            fail(what, (unsigned char) *(*(ctx->state + r) + col),
+                 *(inv + r));
+        }
+    }
+}
+
+/**
+ * Checks the finite field routines of ops.c against bit-serial
+ * multiplication: poly_mult for every pair of bytes, xtime for every
+ * byte, mix_col and inv_mix_col for every byte in every row of a column
+ * plus pseudo random columns, and the round constants
+ * Returns 0 if everything matches, 1 otherwise
+ */
+int main () {
+    static struct aes_ctx_s ctx;
+    unsigned char in [4];
+    unsigned char x = 1;
+    char rcon [BPW];
+    char what [32];
+    unsigned long long state = 0x9e3779b97f4a7c15ULL;
+    unsigned int a;
+    unsigned int b;
+    unsigned int cx;
+
+    for (a = 0; a < 256; a++) {
+        for (b = 0; b < 256; b++) {
+            snprintf(what, sizeof(what), "poly_mult(%02x, %02x)", a, b);
+            if ((unsigned char) poly_mult(a, b) != mult_ref(a, b)) {
+                fail(what, (unsigned char) poly_mult(a, b), mult_ref(a, b));
+            }
+        }
+        snprintf(what, sizeof(what), "xtime(%02x)", a);
+        if ((unsigned char) xtime(a) != mult_ref(a, 0x02)) {
+            fail(what, (unsigned char) xtime(a), mult_ref(a, 0x02));
+        }
+    }
+
+    /* Every byte alone in every row, then mixed columns */
+    for (cx = 0; cx < 4; cx++) {
+        for (a = 0; a < 256; a++) {
+            memset(in, 0, sizeof(in));
+            *(in + cx) = a;
+            check_col(&ctx, cx, in);
+        }
+    }
+    for (cx = 0; cx < 65536; cx++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        for (b = 0; b < 4; b++) {
+            *(in + b) = (unsigned char) (state >> (32 + (8 * b)));
+        }
+        check_col(&ctx, cx % 4, in);
+    }
+
+    /* x^(i - 1) for far more rounds than any key size has */
+    for (cx = 1; cx <= 30; cx++) {
+        round_constant(rcon, cx);
+        snprintf(what, sizeof(what), "round_constant(%u)", cx);
+        if ((unsigned char) *rcon != x) {
+            fail(what, (unsigned char) *rcon, x);
+        }
+        for (b = 1; b < BPW; b++) {
+            if (*(rcon + b)) {
+                fail(what, (unsigned char) *(rcon + b), 0);
+            }
+        }
+        x = mult_ref(x, 0x02);
+    }
+
+    if (failures) {
+        fprintf(stderr, "gf_check: %lu mismatches\n", failures);
+        return 1;
+    }
+    printf("gf_check: poly_mult, xtime, mix_col, inv_mix_col and "
+           "round_constant match\n");
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Generator of the multiplicative group, {03} = x + 1 */
+#define GF_GENERATOR 0x03
+
+/* Log and antilog tables, the antilog doubled so sums of logs need no mod */
+unsigned char gf_log [256];
+unsigned char gf_exp [512];
+
+/* Constants mix columns and inverse mix columns multiply by */
+const unsigned char consts [] = {0x02, 0x03, 0x09, 0x0b, 0x0d, 0x0e};
+
+/**
+ * Bit-serial multiplication in the finite field, the reference
+ * Goes through all 8 bits of b, unlike the old poly_mult which stopped
+ * at 7 and got every multiplier from {80} up wrong
+ */
+unsigned char mult_ref (unsigned char a, unsigned char b) {
+    unsigned char ret = 0;
+    unsigned int cx;
+
+    for (cx = 0; cx < 8; cx++) {
+        if (b & (1 << cx)) {
+            ret ^= a;
+        }
+        a = (unsigned char) ((a << 1) ^ ((a & 0x80) ? 0x1b : 0x00));
+    }
+    return ret;
+}
+
+/**
+ * Multiplication through the log tables, the way gf.h does it
+ */
+unsigned char mult_log (unsigned char a, unsigned char b) {
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    return *(gf_exp + *(gf_log + a) + *(gf_log + b));
+}
+
+/**
+ * Writes a table as a C array definition
+ */
+void print_table (FILE *out, const char *name, const unsigned char *t,
+                  unsigned int len) {
+    unsigned int cx;
+
+    fprintf(out, "const unsigned char %s [%u] = {", name, len);
+    for (cx = 0; cx < len; cx++) {
+        fprintf(out, "%s0x%02x%s", (cx % 12) ? " " : "\n    ", *(t + cx),
+                (cx + 1 < len) ? "," : "\n");
+    }
+    fprintf(out, "};\n\n");
+}
+
+/**
+ * Generates the GF(2^8) tables and checks them against the bit-serial
+ * multiplication for every pair of bytes, so a bad table fails the build
+ * Usage: gf_gen output.c
+ */
+int main (int argc, char **argv) {
+    unsigned char mul [256];
+    char name [16];
+    unsigned int a;
+    unsigned int b;
+    unsigned int cx;
+    unsigned char x = 1;
+    FILE *out;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: gf_gen output.c\n");
+        return 1;
+    }
+
+    /* Powers of the generator visit every nonzero byte once */
+    for (cx = 0; cx < 255; cx++) {
+        *(gf_exp + cx) = x;
+        *(gf_log + x) = cx;
+        x = mult_ref(x, GF_GENERATOR);
+    }
+    for (cx = 255; cx < 512; cx++) {
+        *(gf_exp + cx) = *(gf_exp + cx - 255);
+    }
+
+    for (a = 0; a < 256; a++) {
+        for (b = 0; b < 256; b++) {
+            if (mult_log(a, b) != mult_ref(a, b)) {
+                fprintf(stderr, "gf_gen: {%02x}{%02x} is %02x, expected %02x\n",
+                        a, b, mult_log(a, b), mult_ref(a, b));
+                return 1;
+            }
+        }
+    }
+
+    out = fopen(*(argv + 1), "w");
+    if (!out) {
+        perror(*(argv + 1));
+        return 1;
+    }
+    fprintf(out, "/* Generated by gf_gen, do not edit */\n\n");
+    fprintf(out, "#include \"gf.h\"\n\n");
+    print_table(out, "GF_LOG", gf_log, 256);
+    print_table(out, "GF_EXP", gf_exp, 512);
+    for (cx = 0; cx < sizeof(consts); cx++) {
+        for (a = 0; a < 256; a++) {
+            *(mul + a) = mult_log(a, *(consts + cx));
+        }
+        snprintf(name, sizeof(name), "GF_MUL_%02X", *(consts + cx));
+        print_table(out, name, mul, 256);
+    }
+    if (fclose(out)) {
+        perror(*(argv + 1));
+        return 1;
+    }
+    return 0;
+}
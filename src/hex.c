@@ -0,0 +1,315 @@
+#include <stddef.h>
+
+#include "hex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_SIMD 1
+#endif
+
+/* Widest code the CPU runs, picked on first use */
+enum hex_level_e {
+    HEX_UNSET,
+    HEX_SCALAR,
+    HEX_SSE2,
+    HEX_AVX2
+};
+static enum hex_level_e level = HEX_UNSET;
+
+/* Digits for encoding */
+static const char digits[] = "0123456789abcdef";
+
+/**
+ * Value of a hex digit
+ * c: character to convert
+ * Returns 0 to 15, or -1 if c is not a hex digit
+ */
+static int hex_nibble (char c) {
+    unsigned int d = (unsigned char) c - '0';
+    unsigned int l = ((unsigned char) c | 0x20) - 'a';
+
+    if (d < 10) {
+        return d;
+    }
+    if (l < 6) {
+        return l + 10;
+    }
+    return -1;
+}
+
+/**
+ * Decodes the characters the vector code leaves over, a byte at a time
+ */
+static int hex_decode_scalar (unsigned char *dst, const char *src,
+                              size_t len) {
+    int hi;
+    int lo;
+
+    for (; len > 0; len--, dst++, src += 2) {
+        hi = hex_nibble(*src);
+        lo = hex_nibble(*(src + 1));
+        if ((hi | lo) < 0) {
+            return -1;
+        }
+        *dst = (unsigned char) ((hi << 4) | lo);
+    }
+    return 0;
+}
+
+/**
+ * Encodes the bytes the vector code leaves over
+ */
+static void hex_encode_scalar (char *dst, const unsigned char *src,
+                               size_t len) {
+    for (; len > 0; len--, src++, dst += 2) {
+        *dst = *(digits + (*src >> 4));
+        *(dst + 1) = *(digits + (*src & 0x0f));
+    }
+}
+
+#ifdef HEX_SIMD
+
+/**
+ * Turns 16 hex digits into nibble values, one per byte
+ * Signed compares leave bytes from 0x80 up out of both ranges
+ * valid: cleared if any of the characters is not a hex digit
+ */
+__attribute__((target("sse2")))
+static __m128i hex_nibbles_sse2 (__m128i c, int *valid) {
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(
+        _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+        _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+    if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff) {
+        *valid = 0;
+    }
+    return _mm_or_si128(
+        _mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+        _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+/**
+ * Joins nibble pairs, high nibble first, into 16 bit lanes of bytes
+ */
+__attribute__((target("sse2")))
+static __m128i hex_join_sse2 (__m128i n) {
+    return _mm_or_si128(
+        _mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0x00ff)), 4),
+        _mm_srli_epi16(n, 8));
+}
+
+/**
+ * Decodes 32 characters into 16 bytes at a time
+ */
+__attribute__((target("sse2")))
+static int hex_decode_sse2 (unsigned char *dst, const char *src,
+                            size_t len) {
+    __m128i a;
+    __m128i b;
+    int valid = 1;
+
+    for (; len >= 16; len -= 16, dst += 16, src += 32) {
+        a = hex_nibbles_sse2(_mm_loadu_si128((const __m128i *) src), &valid);
+        b = hex_nibbles_sse2(_mm_loadu_si128((const __m128i *) (src + 16)),
+                             &valid);
+        if (!valid) {
+            return -1;
+        }
+        _mm_storeu_si128((__m128i *) dst,
+                         _mm_packus_epi16(hex_join_sse2(a), hex_join_sse2(b)));
+    }
+    return hex_decode_scalar(dst, src, len);
+}
+
+/**
+ * Turns 16 nibbles into their digits
+ */
+__attribute__((target("sse2")))
+static __m128i hex_digits_sse2 (__m128i n) {
+    __m128i letter = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')),
+                        _mm_and_si128(letter, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+/**
+ * Encodes 16 bytes into 32 characters at a time
+ */
+__attribute__((target("sse2")))
+static void hex_encode_sse2 (char *dst, const unsigned char *src,
+                             size_t len) {
+    __m128i v;
+    __m128i hi;
+    __m128i lo;
+
+    for (; len >= 16; len -= 16, src += 16, dst += 32) {
+        v = _mm_loadu_si128((const __m128i *) src);
+        hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+        lo = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+        _mm_storeu_si128((__m128i *) dst,
+                         hex_digits_sse2(_mm_unpacklo_epi8(hi, lo)));
+        _mm_storeu_si128((__m128i *) (dst + 16),
+                         hex_digits_sse2(_mm_unpackhi_epi8(hi, lo)));
+    }
+    hex_encode_scalar(dst, src, len);
+}
+
+/**
+ * The same as hex_nibbles_sse2 on 32 characters
+ */
+__attribute__((target("avx2")))
+static __m256i hex_nibbles_avx2 (__m256i c, int *valid) {
+    __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    __m256i digit = _mm256_andnot_si256(
+        _mm256_cmpgt_epi8(c, _mm256_set1_epi8('9')),
+        _mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)));
+    __m256i alpha = _mm256_andnot_si256(
+        _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('f')),
+        _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)));
+
+    if (_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != -1) {
+        *valid = 0;
+    }
+    return _mm256_or_si256(
+        _mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+        _mm256_and_si256(alpha,
+                         _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+}
+
+/**
+ * Decodes 64 characters into 32 bytes at a time
+ */
+__attribute__((target("avx2")))
+static int hex_decode_avx2 (unsigned char *dst, const char *src,
+                            size_t len) {
+    __m256i a;
+    __m256i b;
+    int valid = 1;
+
+    for (; len >= 32; len -= 32, dst += 32, src += 64) {
+        a = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *) src),
+                             &valid);
+        b = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *) (src + 32)),
+                             &valid);
+        if (!valid) {
+            return -1;
+        }
+        a = _mm256_or_si256(
+            _mm256_slli_epi16(_mm256_and_si256(a, _mm256_set1_epi16(0x00ff)), 4),
+            _mm256_srli_epi16(a, 8));
+        b = _mm256_or_si256(
+            _mm256_slli_epi16(_mm256_and_si256(b, _mm256_set1_epi16(0x00ff)), 4),
+            _mm256_srli_epi16(b, 8));
+        /* The pack works per 128 bit lane, put the quarters back in order */
+        _mm256_storeu_si256((__m256i *) dst,
+                            _mm256_permute4x64_epi64(
+                                _mm256_packus_epi16(a, b), 0xd8));
+    }
+    return hex_decode_sse2(dst, src, len);
+}
+
+/**
+ * Encodes 32 bytes into 64 characters at a time
+ */
+__attribute__((target("avx2")))
+static void hex_encode_avx2 (char *dst, const unsigned char *src,
+                             size_t len) {
+    __m256i v;
+    __m256i hi;
+    __m256i lo;
+    __m256i a;
+    __m256i b;
+    __m256i letter;
+
+    for (; len >= 32; len -= 32, src += 32, dst += 64) {
+        v = _mm256_loadu_si256((const __m256i *) src);
+        hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+        lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0f));
+        /* Bytes 0-7 and 16-23 in a, 8-15 and 24-31 in b */
+        a = _mm256_unpacklo_epi8(hi, lo);
+        b = _mm256_unpackhi_epi8(hi, lo);
+
+        letter = _mm256_cmpgt_epi8(a, _mm256_set1_epi8(9));
+        a = _mm256_add_epi8(_mm256_add_epi8(a, _mm256_set1_epi8('0')),
+                            _mm256_and_si256(letter,
+                                             _mm256_set1_epi8('a' - '0' - 10)));
+        letter = _mm256_cmpgt_epi8(b, _mm256_set1_epi8(9));
+        b = _mm256_add_epi8(_mm256_add_epi8(b, _mm256_set1_epi8('0')),
+                            _mm256_and_si256(letter,
+                                             _mm256_set1_epi8('a' - '0' - 10)));
+
+        _mm256_storeu_si256((__m256i *) dst,
+                            _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *) (dst + 32),
+                            _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    hex_encode_sse2(dst, src, len);
+}
+
+#endif
+
+/**
+ * Picks the widest code the CPU runs
+ */
+static void hex_setup () {
+    level = HEX_SCALAR;
+#ifdef HEX_SIMD
+    level = HEX_SSE2;
+    if (__builtin_cpu_supports("avx2")) {
+        level = HEX_AVX2;
+    }
+#endif
+}
+
+/**
+ * Decodes hex digits into bytes, checking every character
+ * Upper and lower case digits are accepted
+ * dst: pointer to unsigned char[len]
+ * src: pointer to char[len * 2], needs no terminator
+ * len: number of bytes to decode
+ * Returns 0 on success, -1 if src holds anything but hex digits, dst is
+ * left partly written then
+ */
+int hex_decode (unsigned char *dst, const char *src, size_t len) {
+    if (level == HEX_UNSET) {
+        hex_setup();
+    }
+    switch (level) {
+#ifdef HEX_SIMD
+    case HEX_AVX2:
+        return hex_decode_avx2(dst, src, len);
+    case HEX_SSE2:
+        return hex_decode_sse2(dst, src, len);
+#endif
+    default:
+        return hex_decode_scalar(dst, src, len);
+    }
+}
+
+/**
+ * Encodes bytes as lower case hex digits
+ * dst: pointer to char[len * 2], no terminator is written
+ * src: pointer to unsigned char[len]
+ * len: number of bytes to encode
+ */
+void hex_encode (char *dst, const unsigned char *src, size_t len) {
+    if (level == HEX_UNSET) {
+        hex_setup();
+    }
+    switch (level) {
+#ifdef HEX_SIMD
+    case HEX_AVX2:
+        hex_encode_avx2(dst, src, len);
+        break;
+    case HEX_SSE2:
+        hex_encode_sse2(dst, src, len);
+        break;
+#endif
+    default:
+        hex_encode_scalar(dst, src, len);
+        break;
+    }
+}
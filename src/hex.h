@@ -0,0 +1,9 @@
+#ifndef HEX_H_20261017_170212
+#define HEX_H_20261017_170212
+
+#include <stddef.h>
+
+int hex_decode (unsigned char *dst, const char *src, size_t len);
+void hex_encode (char *dst, const unsigned char *src, size_t len);
+
+#endif /* HEX_H_20261017_170212 */
@@ -0,0 +1,445 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesvars.h"
+#include "cipher.h"
+#include "hex.h"
+#include "kat.h"
+#include "modes.h"
+
+/* Longest line accepted, a whole MMT message with some slack */
+#define KAT_LINE_LEN 1024
+/* Longest message of a record, MMT goes up to 10 blocks */
+#define KAT_DATA_MAX (BLOCK_SIZE * 16)
+/* Records of a Monte Carlo test, and blocks chained per record */
+#define MCT_OUTER 100
+#define MCT_INNER 1000
+
+/**
+ * One record, a COUNT and the fields after it
+ * in is the plaintext when encrypting and the ciphertext when decrypting,
+ * out the other one, so the same code runs both directions
+ */
+struct kat_record_s {
+    unsigned long count;
+    unsigned char key [KEY_SIZE_MAX];
+    unsigned int nk;
+    unsigned char iv [BLOCK_SIZE];
+    int has_iv;
+    unsigned char in [KAT_DATA_MAX];
+    size_t in_len;
+    unsigned char out [KAT_DATA_MAX];
+    size_t out_len;
+};
+
+/* A file being checked */
+struct kat_file_s {
+    const struct engine_s *eng;
+    FILE *out;
+    struct kat_result_s *res;
+    /* Section the records are in, -1 before the first */
+    int decrypt;
+    /* Record being read, and which fields it has so far */
+    struct kat_record_s rec;
+    int fields;
+    /* Where the next Monte Carlo record should start, if anywhere */
+    struct kat_record_s next;
+    int chained;
+};
+
+/* Bits of kat_file_s.fields */
+#define FIELD_COUNT 1
+#define FIELD_KEY 2
+#define FIELD_IV 4
+#define FIELD_IN 8
+#define FIELD_OUT 16
+
+/* Names of the suites by kat_type_e */
+static const char *type_names[] = {
+    "?",
+    "KAT",
+    "MMT",
+    "MCT"
+};
+
+/**
+ * Names a kind of test for reports
+ */
+const char *kat_type_name (enum kat_type_e type) {
+    return *(type_names + type);
+}
+
+/**
+ * Works out a suite from the names AESAVS uses, in the header comment
+ * "# AESVS GFSbox test data for CBC" or in file names like CBCGFSbox128
+ * type: name or part of a name holding the test
+ * mode: name or part of a name starting with the mode
+ * res: result to fill in, left alone for names that mean nothing
+ */
+static void kat_suite (const char *type, const char *mode,
+                       struct kat_result_s *res) {
+    if (strstr(type, "MCT")) {
+        res->type = KAT_MCT;
+    } else if (strstr(type, "MMT")) {
+        res->type = KAT_MMT;
+    } else if (strstr(type, "GFSbox") || strstr(type, "KeySbox")
+               || strstr(type, "VarKey") || strstr(type, "VarTxt")) {
+        res->type = KAT_KNOWN_ANSWER;
+    }
+
+    /* CFB and OFB have no counterpart in modes.c */
+    if (!strncmp(mode, "ECB", 3)) {
+        res->mode = MODE_ECB;
+    } else if (!strncmp(mode, "CBC", 3)) {
+        res->mode = MODE_CBC;
+    }
+}
+
+/**
+ * Writes one field of the response
+ * name: name of the field
+ * bytes: value of the field
+ * len: length of the value in bytes, at most KAT_DATA_MAX
+ */
+static void kat_field (FILE *out, const char *name,
+                       const unsigned char *bytes, size_t len) {
+    char hex [KAT_DATA_MAX * 2 + 1];
+
+    hex_encode(hex, bytes, len);
+    *(hex + (len * 2)) = 0;
+    fprintf(out, "%s = %s\n", name, hex);
+}
+
+/**
+ * Writes a whole record of the response, with the answer
+ */
+static void kat_write (const struct kat_file_s *f,
+                       const struct kat_record_s *rec) {
+    if (!f->out) {
+        return;
+    }
+    fprintf(f->out, "COUNT = %lu\n", rec->count);
+    kat_field(f->out, "KEY", rec->key, rec->nk * BPW);
+    if (f->res->mode == MODE_CBC) {
+        kat_field(f->out, "IV", rec->iv, BLOCK_SIZE);
+    }
+    kat_field(f->out, f->decrypt ? "CIPHERTEXT" : "PLAINTEXT", rec->in,
+              rec->in_len);
+    kat_field(f->out, f->decrypt ? "PLAINTEXT" : "CIPHERTEXT", rec->out,
+              rec->out_len);
+    fprintf(f->out, "\n");
+}
+
+/**
+ * Runs the input of a record through the cipher in the mode of the file
+ * ctx: context holding the schedule for the section
+ * buf: pointer to unsigned char[blocks * BLOCK_SIZE], in place
+ * chain: chaining value for CBC, updated as modes.c does
+ */
+static void kat_crypt (const struct kat_file_s *f,
+                       const struct aes_ctx_s *ctx, unsigned char *buf,
+                       size_t blocks, unsigned char *chain) {
+    if (f->res->mode == MODE_CBC) {
+        if (f->decrypt) {
+            cbc_decrypt(f->eng, ctx, buf, buf, blocks, chain);
+        } else {
+            cbc_encrypt(f->eng, ctx, buf, buf, blocks, chain);
+        }
+    } else if (f->decrypt) {
+        ecb_decrypt(f->eng, ctx, buf, buf, blocks);
+    } else {
+        ecb_encrypt(f->eng, ctx, buf, buf, blocks);
+    }
+}
+
+/**
+ * Runs the chained blocks of one Monte Carlo record as in AESAVS 6.4,
+ * the same for both directions with in and out swapping roles
+ * ctx: context holding the schedule for the record key
+ * rec: record to answer
+ * result: pointer to unsigned char[BLOCK_SIZE], set to the last output
+ * next: set to where the following record starts
+ */
+static void mct_step (const struct kat_file_s *f,
+                      const struct aes_ctx_s *ctx,
+                      const struct kat_record_s *rec, unsigned char *result,
+                      struct kat_record_s *next) {
+    unsigned char in [BLOCK_SIZE];
+    unsigned char chain [BLOCK_SIZE];
+    /* The last two outputs, block j goes to outs[j % 2] */
+    unsigned char outs [2][BLOCK_SIZE];
+    unsigned int key_len = rec->nk * BPW;
+    unsigned int cx;
+
+    memcpy(in, rec->in, BLOCK_SIZE);
+    memcpy(chain, rec->iv, BLOCK_SIZE);
+    for (cx = 0; cx < MCT_INNER; cx++) {
+        memcpy(*(outs + (cx & 1)), in, BLOCK_SIZE);
+        kat_crypt(f, ctx, *(outs + (cx & 1)), 1, chain);
+
+        /* ECB feeds the output back, CBC the IV then the output before */
+        if (f->res->mode == MODE_ECB) {
+            memcpy(in, *(outs + (cx & 1)), BLOCK_SIZE);
+        } else {
+            memcpy(in, cx ? *(outs + (~cx & 1)) : rec->iv, BLOCK_SIZE);
+        }
+    }
+    memcpy(result, *(outs + 1), BLOCK_SIZE);
+
+    /* The key takes in as many of the last output bytes as it has */
+    *next = *rec;
+    next->count++;
+    for (cx = 0; cx < key_len; cx++) {
+        *(next->key + cx) ^= *(*outs + (BLOCK_SIZE * 2) - key_len + cx);
+    }
+    memcpy(next->iv, *(outs + 1), BLOCK_SIZE);
+    memcpy(next->in, (f->res->mode == MODE_ECB) ? *(outs + 1) : *outs,
+           BLOCK_SIZE);
+    next->out_len = 0;
+}
+
+/**
+ * Answers the record that has been read and checks the answer if the
+ * file has one
+ */
+static void kat_record (struct kat_file_s *f) {
+    struct kat_record_s *rec = &f->rec;
+    unsigned char computed [KAT_DATA_MAX];
+    unsigned char chain [BLOCK_SIZE];
+    struct aes_ctx_s ctx;
+    int has_out = f->fields & FIELD_OUT;
+    int ok = 1;
+
+    if (!f->fields) {
+        return;
+    }
+    f->fields = 0;
+    if (f->decrypt < 0 || !rec->nk || !rec->in_len
+        || rec->in_len % BLOCK_SIZE
+        || (f->res->mode == MODE_CBC && !rec->has_iv)
+        || (f->res->type == KAT_MCT && rec->in_len != BLOCK_SIZE)) {
+        f->res->malformed++;
+        return;
+    }
+
+    f->eng->expand(&ctx, rec->key, rec->nk);
+    if (f->decrypt) {
+        f->eng->expand_dec(&ctx);
+    }
+
+    if (f->res->type != KAT_MCT) {
+        memcpy(computed, rec->in, rec->in_len);
+        memcpy(chain, rec->iv, BLOCK_SIZE);
+        kat_crypt(f, &ctx, computed, rec->in_len / BLOCK_SIZE, chain);
+    } else {
+        /* Every record has to start where the one before left off */
+        if (f->chained && rec->count == f->next.count
+            && (rec->nk != f->next.nk
+                || memcmp(rec->key, f->next.key, rec->nk * BPW)
+                || memcmp(rec->in, f->next.in, BLOCK_SIZE)
+                || (f->res->mode == MODE_CBC
+                    && memcmp(rec->iv, f->next.iv, BLOCK_SIZE)))) {
+            ok = 0;
+        }
+        mct_step(f, &ctx, rec, computed, &f->next);
+        f->chained = 1;
+    }
+
+    if (has_out) {
+        if (!ok || rec->out_len != rec->in_len
+            || memcmp(rec->out, computed, rec->in_len)) {
+            f->res->failed++;
+        } else {
+            f->res->passed++;
+        }
+    } else {
+        f->res->answered++;
+    }
+    memcpy(rec->out, computed, rec->in_len);
+    rec->out_len = rec->in_len;
+    kat_write(f, rec);
+
+    /* A request only has the first Monte Carlo record, make up the rest */
+    if (f->res->type == KAT_MCT && !has_out) {
+        while (f->next.count < MCT_OUTER) {
+            *rec = f->next;
+            f->eng->expand(&ctx, rec->key, rec->nk);
+            if (f->decrypt) {
+                f->eng->expand_dec(&ctx);
+            }
+            mct_step(f, &ctx, rec, rec->out, &f->next);
+            rec->out_len = BLOCK_SIZE;
+            f->res->answered++;
+            kat_write(f, rec);
+        }
+    }
+}
+
+/**
+ * Reads the value of a field into a record
+ * value: hex string of the value
+ * dst: where the bytes go
+ * max: room in dst
+ * len: set to the number of bytes
+ * Returns 0 on success, -1 if the value is not hex or too long
+ */
+static int kat_value (const char *value, unsigned char *dst, size_t max,
+                      size_t *len) {
+    size_t hex_len = strlen(value);
+
+    if (hex_len % 2 || hex_len / 2 > max
+        || hex_decode(dst, value, hex_len / 2)) {
+        return -1;
+    }
+    *len = hex_len / 2;
+    return 0;
+}
+
+/**
+ * Takes in one "NAME = value" line
+ * Returns 0 on success, -1 if the line makes no sense
+ */
+static int kat_line (struct kat_file_s *f, char *line) {
+    struct kat_record_s *rec = &f->rec;
+    char *value = strchr(line, '=');
+    char *name_end;
+    const char *in_name = f->decrypt > 0 ? "CIPHERTEXT" : "PLAINTEXT";
+    const char *out_name = f->decrypt > 0 ? "PLAINTEXT" : "CIPHERTEXT";
+    size_t len;
+
+    if (!value) {
+        return -1;
+    }
+    for (name_end = value; name_end > line && *(name_end - 1) == ' ';
+         name_end--);
+    *name_end = 0;
+    value += 1 + strspn(value + 1, " ");
+
+    /* COUNT starts the next record */
+    if (!strcmp(line, "COUNT")) {
+        kat_record(f);
+        memset(rec, 0, sizeof(*rec));
+        rec->count = strtoul(value, 0, 10);
+        f->fields |= FIELD_COUNT;
+        return 0;
+    }
+
+    if (!strcmp(line, "KEY")) {
+        if (kat_value(value, rec->key, KEY_SIZE_MAX, &len)
+            || !key_words(len)) {
+            return -1;
+        }
+        rec->nk = key_words(len);
+        f->fields |= FIELD_KEY;
+    } else if (!strcmp(line, "IV")) {
+        if (kat_value(value, rec->iv, BLOCK_SIZE, &len)
+            || len != BLOCK_SIZE) {
+            return -1;
+        }
+        rec->has_iv = 1;
+        f->fields |= FIELD_IV;
+    } else if (!strcmp(line, in_name)) {
+        if (kat_value(value, rec->in, KAT_DATA_MAX, &rec->in_len)) {
+            return -1;
+        }
+        f->fields |= FIELD_IN;
+    } else if (!strcmp(line, out_name)) {
+        if (kat_value(value, rec->out, KAT_DATA_MAX, &rec->out_len)) {
+            return -1;
+        }
+        f->fields |= FIELD_OUT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Checks an AESAVS request or response file against an engine
+ * Records with an answer are checked against it. Records without one,
+ * as in .req files, are answered, and a Monte Carlo request gets all
+ * 100 records made up from its first. Either way the complete response
+ * is written to out, which gives back a .rsp file.
+ * eng: engine to check, set up already
+ * in: the .req or .rsp file
+ * out: stream for the response, null for none
+ * name: name of the file, to tell the suite if the header doesn't
+ * res: set to what was found
+ * Returns 0 on success, -1 on I/O errors, -2 if the suite is not one
+ * that can be run, ECB or CBC and a known kind of test
+ */
+int kat_run (const struct engine_s *eng, FILE *in, FILE *out,
+             const char *name, struct kat_result_s *res) {
+    struct kat_file_s f;
+    char line [KAT_LINE_LEN];
+    char type [16];
+    char mode [16];
+    const char *base = strrchr(name, '/');
+    size_t len;
+
+    memset(res, 0, sizeof(*res));
+    memset(&f, 0, sizeof(f));
+    f.eng = eng;
+    f.out = out;
+    f.res = res;
+    f.decrypt = -1;
+
+    while (fgets(line, sizeof(line), in)) {
+        len = strcspn(line, "\r\n");
+        if (*(line + len) == 0 && !feof(in)) {
+            /* Longer than anything a valid file has */
+            res->malformed++;
+            while (fgets(line, sizeof(line), in)
+                   && !strchr(line, '\n'));
+            continue;
+        }
+        *(line + len) = 0;
+
+        if (*line == '#') {
+            if (sscanf(line, "# AESVS %15s test data for %15s", type,
+                       mode) == 2) {
+                kat_suite(type, mode, res);
+            }
+            if (out) {
+                fprintf(out, "%s\n", line);
+            }
+        } else if (*line == '[') {
+            kat_record(&f);
+            /* The header is all read, fall back on the name */
+            if (res->type == KAT_UNKNOWN || res->mode == MODE_NONE) {
+                kat_suite(base ? base + 1 : name, base ? base + 1 : name,
+                          res);
+            }
+            if (res->type == KAT_UNKNOWN || res->mode == MODE_NONE) {
+                return -2;
+            }
+            if (!strcmp(line, "[ENCRYPT]")) {
+                f.decrypt = 0;
+            } else if (!strcmp(line, "[DECRYPT]")) {
+                f.decrypt = 1;
+            } else {
+                f.decrypt = -1;
+                res->malformed++;
+            }
+            f.chained = 0;
+            if (out) {
+                fprintf(out, "%s\n", line);
+            }
+        } else if (!*line) {
+            if (f.fields) {
+                kat_record(&f);
+            } else if (out) {
+                fprintf(out, "\n");
+            }
+        } else if (f.decrypt < 0 || kat_line(&f, line)) {
+            res->malformed++;
+        }
+    }
+    kat_record(&f);
+
+    if (ferror(in) || (out && (ferror(out) || fflush(out)))) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef KAT_H_20261017_191547
+#define KAT_H_20261017_191547
+
+#include <stdio.h>
+
+#include "cipher.h"
+#include "modes.h"
+
+/* Kinds of AESAVS test, the MCT ones chain their records */
+enum kat_type_e {
+    KAT_UNKNOWN = 0,
+    /* GFSbox, KeySbox, VarKey and VarTxt, one block per record */
+    KAT_KNOWN_ANSWER,
+    /* Multi-block message test, several blocks per record */
+    KAT_MMT,
+    /* Monte Carlo test, 1000 chained blocks per record */
+    KAT_MCT
+};
+
+/* What checking one file found */
+struct kat_result_s {
+    /* Suite of the file, from its header or failing that its name */
+    enum kat_type_e type;
+    enum mode_e mode;
+    /* Records matching the file, and those that did not */
+    unsigned long passed;
+    unsigned long failed;
+    /* Records with no answer to check, computed for the response */
+    unsigned long answered;
+    /* Lines that could not be made sense of */
+    unsigned long malformed;
+};
+
+const char *kat_type_name (enum kat_type_e type);
+int kat_run (const struct engine_s *eng, FILE *in, FILE *out,
+             const char *name, struct kat_result_s *res);
+
+#endif /* KAT_H_20261017_191547 */
@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "aesvars.h"
+#include "cipher.h"
+#include "keycache.h"
+#include "stats.h"
+
+/* Number of expanded keys kept around */
+#define KEYCACHE_SIZE 16
+
+/* A cached key schedule */
+struct keycache_entry_s {
+    /* Context holding the expanded schedule, first to keep it aligned */
+    struct aes_ctx_s ctx;
+    /* Raw key the schedule was expanded from and its length in words */
+    unsigned char key [KEY_SIZE_MAX];
+    unsigned int nk;
+    /* Tick of the last use, 0 if the entry is empty */
+    unsigned long used;
+    /* Set once the decryption schedule has been derived */
+    int has_dec;
+};
+
+/* The cache entries */
+static struct keycache_entry_s entries [KEYCACHE_SIZE];
+/* Incremented on every lookup, orders the entries by last use */
+static unsigned long tick = 0;
+/* Lookup counters */
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+/**
+ * Finds the entry for a key, expanding it into the oldest entry on a miss
+ */
+static struct keycache_entry_s *keycache_entry (const struct engine_s *eng,
+                                                const unsigned char *key,
+                                                unsigned int nk) {
+    struct keycache_entry_s *victim = entries;
+    unsigned int cx;
+
+    tick++;
+    for (cx = 0; cx < KEYCACHE_SIZE; cx++) {
+        struct keycache_entry_s *e = entries + cx;
+
+        if (e->used && e->nk == nk && !memcmp(e->key, key, nk * BPW)) {
+            e->used = tick;
+            hits++;
+            return e;
+        }
+        /* Remember the oldest, empty entries have used == 0 */
+        if (e->used < victim->used) {
+            victim = e;
+        }
+    }
+
+    misses++;
+    STATS_BEGIN();
+    eng->expand(&victim->ctx, key, nk);
+    STATS_END(STATS_ENGINE_EXPAND, 0);
+    memcpy(victim->key, key, nk * BPW);
+    victim->nk = nk;
+    victim->used = tick;
+    victim->has_dec = 0;
+    return victim;
+}
+
+/**
+ * Gets the expanded schedule for a key, expanding it on a miss
+ * The least recently used entry is replaced when the cache is full.
+ * Every engine produces the same schedule, so entries are shared.
+ * eng: engine whose expansion to use on a miss
+ * key: pointer to unsigned char[nk * BPW]
+ * nk: length of the key in words
+ * Returns a context that stays valid until KEYCACHE_SIZE other keys
+ * have been looked up
+ */
+const struct aes_ctx_s *keycache_get (const struct engine_s *eng,
+                                      const unsigned char *key,
+                                      unsigned int nk) {
+    return &keycache_entry(eng, key, nk)->ctx;
+}
+
+/**
+ * Gets the expanded schedule for a key along with the decryption
+ * schedule, which is derived once per entry the first time it is asked
+ * for, the same as keycache_get otherwise
+ */
+const struct aes_ctx_s *keycache_get_dec (const struct engine_s *eng,
+                                          const unsigned char *key,
+                                          unsigned int nk) {
+    struct keycache_entry_s *e = keycache_entry(eng, key, nk);
+
+    if (!e->has_dec) {
+        STATS_BEGIN();
+        eng->expand_dec(&e->ctx);
+        STATS_END(STATS_ENGINE_EXPAND, 0);
+        e->has_dec = 1;
+    }
+    return &e->ctx;
+}
+
+/**
+ * Reads the lookup counters
+ * hit: set to the number of lookups answered from the cache
+ * miss: set to the number of key expansions done
+ */
+void keycache_stats (unsigned long *hit, unsigned long *miss) {
+    *hit = hits;
+    *miss = misses;
+}
@@ -0,0 +1,15 @@
+#ifndef KEYCACHE_H_20261017_140352
+#define KEYCACHE_H_20261017_140352
+
+#include "aesvars.h"
+#include "cipher.h"
+
+const struct aes_ctx_s *keycache_get (const struct engine_s *eng,
+                                      const unsigned char *key,
+                                      unsigned int nk);
+const struct aes_ctx_s *keycache_get_dec (const struct engine_s *eng,
+                                          const unsigned char *key,
+                                          unsigned int nk);
+void keycache_stats (unsigned long *hit, unsigned long *miss);
+
+#endif /* KEYCACHE_H_20261017_140352 */
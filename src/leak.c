@@ -0,0 +1,377 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LEAK_TSC 1
+#endif
+
+#include "aesvars.h"
+#include "cipher.h"
+#include "leak.h"
+#include "ops.h"
+
+/* Timings counted one by one to find the median, longer ones go last */
+#define LEAK_TIME_MAX 65536
+/* Samples taking this many times the median were interrupted */
+#define LEAK_OUTLIER 8
+/* Bytes written between samples to push the tables out of L1 */
+#define LEAK_EVICT_SIZE (64 * 1024)
+/* Cache line size assumed when evicting */
+#define LEAK_LINE 64
+
+/* Memory the eviction writes to */
+static unsigned char evict_buf [LEAK_EVICT_SIZE];
+
+/**
+ * Time stamp counter, serialized so the timed code can't leak out of the
+ * measurement, or nanoseconds where there is none
+ */
+static unsigned long long leak_now () {
+#ifdef LEAK_TSC
+    _mm_lfence();
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * xorshift64*, plenty for picking plaintexts
+ * state: pointer to the nonzero generator state
+ */
+static unsigned long long leak_rand (unsigned long long *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * Times one sample, a whole block on an engine or just the first round
+ * lookups of the step by step cipher
+ * eng: engine to time, null for sub_byte
+ * ctx: context holding the schedule for the engine
+ * key: pointer to unsigned char[BLOCK_SIZE], the first round key
+ * block: pointer to unsigned char[BLOCK_SIZE], the plaintext
+ * Returns the time taken
+ */
+static unsigned long long leak_sample (const struct engine_s *eng,
+                                       const struct aes_ctx_s *ctx,
+                                       const unsigned char *key,
+                                       const unsigned char *block) {
+    unsigned char out [BLOCK_SIZE];
+    unsigned long long t0;
+    unsigned long long t1;
+    unsigned int cx;
+
+    if (eng) {
+        t0 = leak_now();
+        eng->encrypt(ctx, out, block, 1);
+        t1 = leak_now();
+    } else {
+        t0 = leak_now();
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            *(out + cx) = sub_byte(*(block + cx) ^ *(key + cx));
+        }
+        t1 = leak_now();
+    }
+    return t1 - t0;
+}
+
+/**
+ * Draws the next random plaintext
+ * seed: pointer to the state of leak_rand
+ * words: the plaintext as two words
+ */
+static void leak_block (unsigned long long *seed, unsigned long long *words) {
+    *words = leak_rand(seed);
+    *(words + 1) = leak_rand(seed);
+}
+
+/**
+ * Finds the time of the sample of a given rank
+ * counts: pointer to unsigned long[LEAK_TIME_MAX], samples per time
+ * rank: rank of the sample, 0 for the fastest
+ * Returns its time, at most LEAK_TIME_MAX - 1
+ */
+static unsigned long long leak_rank (const unsigned long *counts,
+                                     unsigned long rank) {
+    unsigned long seen = 0;
+    unsigned long long t;
+
+    for (t = 0; t < LEAK_TIME_MAX - 1; t++) {
+        seen += *(counts + t);
+        if (seen > rank) {
+            break;
+        }
+    }
+    return t;
+}
+
+/**
+ * Adds a sample to the counts of its plaintext bytes, or to the outliers
+ * if it took over LEAK_OUTLIER times the median
+ * block: pointer to unsigned char[BLOCK_SIZE], the plaintext
+ * t: time taken
+ */
+static void leak_add (struct leak_s *l, const unsigned char *block,
+                      unsigned long long t) {
+    unsigned int pos;
+    unsigned int bucket;
+
+    if (t > l->median * LEAK_OUTLIER) {
+        l->outliers++;
+        return;
+    }
+    bucket = (t < l->base) ? 0 : (t - l->base) / l->width;
+    if (bucket >= LEAK_BUCKETS) {
+        bucket = LEAK_BUCKETS - 1;
+    }
+    for (pos = 0; pos < LEAK_POSITIONS; pos++) {
+        *(*(l->count + pos) + *(block + pos)) += 1;
+        *(*(l->sum + pos) + *(block + pos)) += t;
+        *(*(l->sumsq + pos) + *(block + pos)) += t * t;
+        *(*(*(l->hist + pos) + *(block + pos)) + bucket) += 1;
+    }
+    l->samples++;
+}
+
+/**
+ * Mean and standard deviation of every sample kept
+ */
+static void leak_overall (struct leak_s *l) {
+    unsigned long long sum = 0;
+    unsigned long long sumsq = 0;
+    unsigned int cx;
+
+    /* Every sample went to exactly one value at each position */
+    for (cx = 0; cx < 256; cx++) {
+        sum += *(*l->sum + cx);
+        sumsq += *(*l->sumsq + cx);
+    }
+    l->mean = l->samples ? (double) sum / l->samples : 0;
+    l->stddev = l->samples ? sqrt((double) sumsq / l->samples
+                                  - (l->mean * l->mean)) : 0;
+}
+
+/**
+ * Times encryptions of random plaintexts under one key
+ * Only the times are kept while measuring, 4 bytes a sample. The median
+ * and the histogram buckets come from all of them, then the plaintexts
+ * are drawn again from the same seed to count every sample under its
+ * bytes.
+ * eng: engine to time, null for the first round lookups of sub_byte
+ * key: pointer to unsigned char[nk * BPW]
+ * nk: length of the key in words
+ * samples: number of encryptions to time
+ * evict: nonzero to write over more than an L1 cache between samples,
+ *        so lookups only hit the lines the sample itself brought in
+ * Returns the timings, to be freed by the caller, or null if out of
+ * memory
+ */
+struct leak_s *leak_measure (const struct engine_s *eng,
+                             const unsigned char *key, unsigned int nk,
+                             unsigned long samples, int evict) {
+    struct leak_s *l = calloc(1, sizeof(*l));
+    unsigned int *times = malloc(samples * sizeof(*times));
+    unsigned long *counts = calloc(LEAK_TIME_MAX, sizeof(*counts));
+    unsigned long long seed = leak_now() | 1;
+    unsigned long long start = seed;
+    unsigned long long words [2];
+    unsigned char *block = (unsigned char *) words;
+    unsigned long long t;
+    struct aes_ctx_s ctx;
+    unsigned long cx;
+    unsigned int pos;
+
+    if (!l || !times || !counts) {
+        free(l);
+        free(times);
+        free(counts);
+        return 0;
+    }
+    l->target = eng ? eng->name : "sub_byte";
+#ifdef LEAK_TSC
+    l->unit = "cycles";
+#else
+    l->unit = "ns";
+#endif
+    memcpy(l->key, key, nk * BPW);
+    l->nk = nk;
+    if (eng) {
+        eng->expand(&ctx, key, nk);
+    }
+
+    for (cx = 0; cx < samples; cx++) {
+        leak_block(&seed, words);
+        if (evict) {
+            for (pos = 0; pos < LEAK_EVICT_SIZE; pos += LEAK_LINE) {
+                (*(evict_buf + pos))++;
+            }
+        }
+        t = leak_sample(eng, &ctx, key, block);
+        *(times + cx) = (t < UINT_MAX) ? t : UINT_MAX;
+        (*(counts + ((t < LEAK_TIME_MAX) ? t : LEAK_TIME_MAX - 1)))++;
+    }
+
+    /* The median tells interrupts apart, the buckets span the middle 98% */
+    l->median = leak_rank(counts, samples / 2);
+    l->base = leak_rank(counts, samples / 100);
+    t = leak_rank(counts, samples - 1 - (samples / 100));
+    l->width = (t - l->base + LEAK_BUCKETS - 1) / LEAK_BUCKETS;
+    if (l->width == 0) {
+        l->width = 1;
+    }
+
+    seed = start;
+    for (cx = 0; cx < samples; cx++) {
+        leak_block(&seed, words);
+        leak_add(l, block, *(times + cx));
+    }
+    leak_overall(l);
+
+    free(times);
+    free(counts);
+    return l;
+}
+
+/**
+ * Adds up the samples of an s-box index at a position, or at all of them
+ * count: set to the number of samples
+ * Returns the sum of their times
+ */
+static unsigned long long leak_sum (const struct leak_s *l,
+                                    unsigned int pos, unsigned int index,
+                                    unsigned long *count) {
+    unsigned long long sum = 0;
+    unsigned int first = (pos == LEAK_ALL) ? 0 : pos;
+    unsigned int last = (pos == LEAK_ALL) ? LEAK_POSITIONS - 1 : pos;
+    unsigned int value;
+
+    *count = 0;
+    for (pos = first; pos <= last; pos++) {
+        value = index ^ *(l->key + pos);
+        sum += *(*(l->sum + pos) + value);
+        *count += *(*(l->count + pos) + value);
+    }
+    return sum;
+}
+
+/**
+ * How much slower than average the samples looking up an s-box index
+ * in the first round were, the number the attack works with
+ * pos: byte position, LEAK_ALL for all of them together
+ * index: s-box index, the plaintext byte xor the key byte
+ * Returns the difference of the means, 0 if the index never came up
+ */
+double leak_dev (const struct leak_s *l, unsigned int pos,
+                 unsigned int index) {
+    unsigned long long sum;
+    unsigned long count;
+
+    sum = leak_sum(l, pos, index, &count);
+    if (!count) {
+        return 0;
+    }
+    return (double) sum / count - l->mean;
+}
+
+/**
+ * Gap between the slowest and the fastest s-box index at a position
+ * pos: byte position, LEAK_ALL for all of them together
+ * ratio: set to how far the means of the indexes spread compared to
+ *        what noise alone gives with as many samples, the variance of
+ *        the means over the variance expected of them. Around 1 is
+ *        noise, with millions of samples anything over 1.3 is not.
+ * Returns the gap in the unit of the timings
+ */
+double leak_spread (const struct leak_s *l, unsigned int pos,
+                    double *ratio) {
+    double lo = 0;
+    double hi = 0;
+    double dev;
+    double chi = 0;
+    unsigned long count;
+    unsigned int cx;
+
+    for (cx = 0; cx < 256; cx++) {
+        dev = leak_dev(l, pos, cx);
+        lo = (cx == 0 || dev < lo) ? dev : lo;
+        hi = (cx == 0 || dev > hi) ? dev : hi;
+        leak_sum(l, pos, cx, &count);
+        chi += dev * dev * count;
+    }
+    *ratio = (l->stddev > 0) ? chi / (256 * l->stddev * l->stddev) : 0;
+    return hi - lo;
+}
+
+/**
+ * Writes the summary per byte position, then the mean, deviation and
+ * histogram of every position and s-box index
+ * out: stream to write to
+ */
+void leak_report (const struct leak_s *l, FILE *out) {
+    unsigned long count;
+    unsigned int value;
+    unsigned int slow;
+    unsigned int fast;
+    unsigned int pos;
+    unsigned int cx;
+    unsigned int cx2;
+    double spread;
+    double ratio;
+    double mean;
+    double var;
+    double dev;
+
+    fprintf(out, "Cache timing of %s, %lu samples, %lu dropped as "
+            "interrupted\n", l->target, l->samples, l->outliers);
+    fprintf(out, "Median %llu %s, histogram buckets of %llu from %llu\n\n",
+            l->median, l->unit, l->width, l->base);
+
+    fprintf(out, "%-4s %10s %8s %8s %8s\n", "Pos", "Spread", "Ratio",
+            "Slowest", "Fastest");
+    for (pos = 0; pos <= LEAK_ALL; pos++) {
+        spread = leak_spread(l, pos, &ratio);
+        slow = 0;
+        fast = 0;
+        for (cx = 1; cx < 256; cx++) {
+            dev = leak_dev(l, pos, cx);
+            slow = (dev > leak_dev(l, pos, slow)) ? cx : slow;
+            fast = (dev < leak_dev(l, pos, fast)) ? cx : fast;
+        }
+        if (pos == LEAK_ALL) {
+            fprintf(out, "%-4s", "all");
+        } else {
+            fprintf(out, "%-4u", pos);
+        }
+        fprintf(out, " %10.3f %8.2f %8.2x %8.2x\n", spread, ratio, slow,
+                fast);
+    }
+
+    fprintf(out, "\n%-4s %5s %8s %10s %10s  %s\n", "Pos", "Index", "Count",
+            "Mean", "Stddev", "Histogram");
+    for (pos = 0; pos < LEAK_POSITIONS; pos++) {
+        for (cx = 0; cx < 256; cx++) {
+            value = cx ^ *(l->key + pos);
+            count = *(*(l->count + pos) + value);
+            mean = count ? (double) *(*(l->sum + pos) + value) / count : 0;
+            var = count ? (double) *(*(l->sumsq + pos) + value) / count
+                          - (mean * mean) : 0;
+            fprintf(out, "%-4u %5.2x %8lu %10.3f %10.3f ", pos, cx, count,
+                    mean, (var > 0) ? sqrt(var) : 0);
+            for (cx2 = 0; cx2 < LEAK_BUCKETS; cx2++) {
+                fprintf(out, " %u", *(*(*(l->hist + pos) + value) + cx2));
+            }
+            fprintf(out, "\n");
+        }
+    }
+}
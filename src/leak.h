@@ -0,0 +1,53 @@
+#ifndef LEAK_H_20261017_201433
+#define LEAK_H_20261017_201433
+
+#include <stdio.h>
+
+#include "cipher.h"
+
+/* Byte positions of a block, and the index of all of them together */
+#define LEAK_POSITIONS 16
+#define LEAK_ALL LEAK_POSITIONS
+/* Buckets of the latency histograms */
+#define LEAK_BUCKETS 16
+
+/**
+ * Timings of many encryptions of random plaintexts under one key, in the
+ * way of Bernstein's cache-timing attack
+ * Every sample is added to the plaintext byte value at each position, so
+ * the first round lookup it stands for is that value xor the key byte
+ */
+struct leak_s {
+    /* What was timed, an engine or the step by step sub_byte */
+    const char *target;
+    /* Unit of the timings, cycles of the time stamp counter or ns */
+    const char *unit;
+    unsigned char key [KEY_SIZE_MAX];
+    unsigned int nk;
+    /* Samples kept, and those thrown away as interrupted */
+    unsigned long samples;
+    unsigned long outliers;
+    /* Median time of a sample, and buckets over the middle 98% of them */
+    unsigned long long median;
+    unsigned long long base;
+    unsigned long long width;
+    /* Mean and standard deviation of every sample kept */
+    double mean;
+    double stddev;
+    /* Per position and plaintext byte value */
+    unsigned long count [LEAK_POSITIONS][256];
+    unsigned long long sum [LEAK_POSITIONS][256];
+    unsigned long long sumsq [LEAK_POSITIONS][256];
+    unsigned int hist [LEAK_POSITIONS][256][LEAK_BUCKETS];
+};
+
+struct leak_s *leak_measure (const struct engine_s *eng,
+                             const unsigned char *key, unsigned int nk,
+                             unsigned long samples, int evict);
+double leak_dev (const struct leak_s *l, unsigned int pos,
+                 unsigned int index);
+double leak_spread (const struct leak_s *l, unsigned int pos,
+                    double *ratio);
+void leak_report (const struct leak_s *l, FILE *out);
+
+#endif /* LEAK_H_20261017_201433 */
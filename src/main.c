@@ -1,183 +1,572 @@
+#include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <curses.h>
 #include <panel.h>
 
 #include "aesvars.h"
+#include "batch.h"
+#include "bulk.h"
+#include "cipher.h"
+#include "events.h"
+#include "gcm.h"
+#include "hex.h"
+#include "kat.h"
+#include "keycache.h"
+#include "leak.h"
+#include "modes.h"
 #include "ops.h"
 #include "output_ctrl.h"
+#include "record.h"
+#include "stats.h"
+#include "trace.h"
 
 /* String of available options */
-const char *optstring = ":hi:k:n";
+const char *optstring = ":A:bd:e:f:hIi:Kk:Mm:no:r:st:T:v:w:x";
+/* Long forms of some of the options */
+const struct option long_opts[] = {
+    {"stream", no_argument, 0, 's'},
+    {"kat", no_argument, 0, 'K'},
+    {"stats", no_argument, 0, 'S'},
+    {"leak", required_argument, 0, 'L'},
+    {"evict", no_argument, 0, 'E'},
+    {"record", required_argument, 0, 'R'},
+    {0, 0, 0, 0}
+};
 
 /* Default values for key and input */
-char key[] = "2b7e151628aed2a6abf7158809cf4f3c";
+char key [KEY_SIZE_MAX * 2 + 1] = "2b7e151628aed2a6abf7158809cf4f3c";
 char input[] = "3243f6a8885a308d313198a2e0370734";
+/* Default initialization vector for chaining modes */
+char iv [BLOCK_SIZE * 2 + 1] = "00000000000000000000000000000000";
+/* Length of the initialization vector in bytes, 0 until one is given */
+size_t iv_len = 0;
+/* Additional authenticated data for gcm as hex, none by default */
+const char *aad_hex = "";
+
+/* Engine for non-visual runs, null to trace the rounds */
+const struct engine_s *engine = 0;
+
+/* Set to decrypt the input instead of encrypting it */
+int decrypt = 0;
+
+/* Bulk encryption parameters */
+enum mode_e bulk_mode = MODE_NONE;
+int batch_mode = 0;
+/* Set to go through memory mappings of the files, and to work in place */
+int map_files = 0;
+int in_place = 0;
+/* Set to overlap reading, encryption and writing */
+int stream_mode = 0;
+/* Worker threads for counter mode, 0 for one per core */
+unsigned int threads = 0;
+/* Set to print the stage counters once done, see stats.h */
+int show_stats = 0;
+/* Samples of the cache-timing analysis, 0 for none */
+unsigned long leak_samples = 0;
+/* Set to evict the caches between the samples */
+int leak_evict = 0;
+/* File to record the visualization to as an asciicast, null for none */
+const char *record_path = 0;
+/* Set by -n and -T, which unlike -e also mean no heatmap */
+int headless = 0;
+/* Set to check the AESAVS files given as arguments */
+int kat_mode = 0;
+/* Input file, null for stdin unless one was given */
+const char *in_path = 0;
+const char *out_path = "-";
+
+/* Format of the headless trace, and the trace while one is written */
+enum trace_fmt_e trace_fmt = TRACE_TEXT;
+struct trace_s *active_trace = 0;
+
+/* Round or schedule word to start the visualization at, -1 for the start */
+int start_round = -1;
+int start_word = -1;
 
 void usage () {
+    const struct engine_s **e;
+
     printf("Usage: aes128-visualizer [options]\n");
     printf("    -h          print this help\n");
     printf("    -i data     hex string to use as input, at most 16 bytes\n");
     printf("                    anything longer is truncated\n");
-    printf("    -k key      encryption key (128 bits)\n");
+    printf("    -k key      encryption key (128, 192 or 256 bits)\n");
     printf("    -n          no ncurses visualization, dump to terminal\n");
+    printf("    -T format   format of the -n dump, text (default), json or\n");
+    printf("                    binary, implies -n\n");
+    printf("    -x          decrypt, the input and bulk/batch data are\n");
+    printf("                    ciphertext\n");
+    printf("    -d ms       animation delay per step, default 100, also\n");
+    printf("                    + and - while running, space pauses,\n");
+    printf("                    left and right step an operation back\n");
+    printf("                    or forward, PgUp and PgDn a round\n");
+    printf("    -r round    start the visualization at a round, also Nr\n");
+    printf("                    while running\n");
+    printf("    -w word     start the visualization at a key expansion\n");
+    printf("                    word, also Nw while running\n");
+    printf("    -m mode     bulk encrypt in mode ecb, cbc, ctr or gcm, writes\n");
+    printf("                    raw ciphertext, ecb and cbc with PKCS#7\n");
+    printf("                    padding, gcm followed by the 16 byte\n");
+    printf("                    tag, implies -n\n");
+    printf("    -A aad      additional authenticated data for gcm, hex\n");
+    printf("    -b          batch mode, encrypt one 'key plaintext' hex\n");
+    printf("                    pair per line into a line of hex\n");
+    printf("                    ciphertext, 'error' if malformed\n");
+    printf("    -f file     bulk/batch input file, default '-' for stdin,\n");
+    printf("                    with -n every block of it is dumped\n");
+    printf("    -o file     bulk/batch/dump output file, default '-' for\n");
+    printf("                    stdout\n");
+    printf("    -M          bulk encrypt through memory mappings of the\n");
+    printf("                    -f and -o files\n");
+    printf("    -I          bulk encrypt the -f file in place, implies -M\n");
+    printf("    -s, --stream\n");
+    printf("                bulk encrypt with reading, encryption and\n");
+    printf("                    writing in threads of their own, for\n");
+    printf("                    pipes\n");
+    printf("    -v iv       initialization vector for cbc or initial\n");
+    printf("                    counter block for ctr (128 bits), or\n");
+    printf("                    nonce for gcm (96 bits, or 128),\n");
+    printf("                    defaults to all zeros\n");
+    printf("    -t threads  worker threads for ctr, defaults to the\n");
+    printf("                    number of cores\n");
+    printf("    -K, --kat file...\n");
+    printf("                check NIST AESAVS .rsp files, ECB and CBC\n");
+    printf("                    KAT, MMT and MCT, with every engine\n");
+    printf("                    unless -e is given, and answer .req\n");
+    printf("                    files into the -o file\n");
+    printf("    --leak n    time n encryptions of random plaintexts and\n");
+    printf("                    show how slow every first round s-box\n");
+    printf("                    lookup was, of sub_byte or the -e\n");
+    printf("                    engine, as a heatmap or with -n a table\n");
+    printf("    --evict     write over the caches before every --leak\n");
+    printf("                    sample\n");
+    printf("    --record file\n");
+    printf("                write the visualization to an asciicast v2\n");
+    printf("                    file instead of the terminal, paced by\n");
+    printf("                    -d but without waiting, 160x50 unless\n");
+    printf("                    COLUMNS and LINES are set\n");
+    printf("    --stats     print the time spent per stage and round\n");
+    printf("                    once done, needs a build with\n");
+    printf("                    make STATS=1\n");
+    printf("    -e engine   non-visual engine, implies -n and prints only\n");
+    printf("                    the result, bulk runs pick the fastest\n");
+    printf("                    by default. One of:");
+    for (e = engines; *e; e++) {
+        printf(" %s", (*e)->name);
+    }
+    printf("\n");
 }
 
-int main (int argc, char **argv) {
-    int opt;
-    unsigned int cx;
-    unsigned int cx2;
-    unsigned int round;
+/**
+ * Checks that a string only holds hex digits
+ * str: string of at most KEY_SIZE_MAX * 2 characters
+ * len: number of characters to check
+ * Returns nonzero if every character is a hex digit
+ */
+int hex_valid (const char *str, size_t len) {
+    unsigned char buf [KEY_SIZE_MAX];
+    char pair [2] = {'0', '0'};
 
-    /* Parse arguments */
-    while ((opt = getopt(argc, argv, optstring)) != -1) {
-        switch (opt) {
-        case 'h':
-            usage();
-            exit(1);
-        case 'i':
-            /* Reset input to null bytes */
-            memset(input, 0, NB * BPW * 2);
-            strncpy(input, optarg, NB * BPW * 2);
-            break;
-        case 'k':
-            /* Reset key to null bytes */
-            memset(key, 0, NK * BPW * 2);
-            strncpy(key, optarg, NK * BPW * 2);
+    /* An odd digit out is checked paired with a zero */
+    if (len % 2) {
+        *pair = *(str + len - 1);
+        if (hex_decode(buf, pair, 1)) {
+            return 0;
+        }
+    }
+    return len / 2 <= KEY_SIZE_MAX && !hex_decode(buf, str, len / 2);
+}
 
-            /* Test the key length */
-            if (strlen(key) != NB * BPW * 2) {
-                printf("Key not of 128 bit length!\n");
-                usage();
-                exit(1);
+/**
+ * Describes the argument an option expects, used in error messages
+ */
+const char *opt_arg_desc (int opt) {
+    switch (opt) {
+    case 'i':
+        return "input data";
+    case 'k':
+        return "a key";
+    case 'm':
+        return "a mode";
+    case 'e':
+        return "an engine";
+    case 'f':
+    case 'o':
+        return "a file name";
+    case 'T':
+        return "a trace format";
+    case 'v':
+        return "an initialization vector";
+    case 'A':
+        return "additional authenticated data";
+    case 't':
+        return "a thread count";
+    case 'd':
+        return "a delay";
+    case 'r':
+        return "a round";
+    case 'w':
+        return "a schedule word";
+    case 'L':
+        return "a sample count";
+    case 'R':
+        return "a file name";
+    }
+    return "an argument";
+}
+
+/**
+ * Opens the input and output files, '-' meaning stdin and stdout
+ * in: set to the input stream
+ * out: set to the output stream
+ * Returns 0 on success, the error has been printed otherwise
+ */
+int open_streams (FILE **in, FILE **out) {
+    *in = stdin;
+    *out = stdout;
+
+    if (in_path && strcmp(in_path, "-")) {
+        *in = fopen(in_path, "rb");
+        if (!*in) {
+            perror(in_path);
+            return -1;
+        }
+    }
+    if (strcmp(out_path, "-")) {
+        *out = fopen(out_path, "wb");
+        if (!*out) {
+            perror(out_path);
+            if (*in != stdin) {
+                fclose(*in);
             }
-            break;
-        case 'n':
-            use_ncurses = 0;
-            break;
-        /* No argument given */
-        case ':':
-            printf("Option '%s' requires %s as an argument.\n",
-                *(argv + optind - 1),
-                (!strcmp(*(argv + optind - 1), "-i")) ? "input data"
-                : "a key"
-            );
-            usage();
-            exit(1);
-        /* Invalid option */
-        case '?':
-            printf("Invalid option: '%s'\n", *(argv + optind - 1));
-            usage();
-            exit(1);
+            return -1;
         }
     }
+    return 0;
+}
 
-    if (use_ncurses) {
-        init_ncurses();
-        /* Populate the parameters window */
-        mvwprintw(params_win.win, 1, 1,
-                  "Plaintext:  %s", input);
-        mvwprintw(params_win.win, 2, 1,
-                  "Key:        %s", key);
-        mvwprintw(params_win.win, 3, 1,
-                  "Ciphertext:");
-        update_panels();
-        doupdate();
-    }
-
-    /* Initialize the schedule */
-    schedule = calloc(NB * (NR + 1), sizeof(*schedule));
-    for (cx = 0; cx < NB * (NR + 1); cx++) {
-        *(schedule + cx) = calloc(BPW, sizeof(**schedule));
-    }
-    /* Initialize the state */
-    state = calloc(NB, sizeof(*state));
-    for (cx = 0; cx < NB; cx++) {
-        *(state + cx) = calloc(BPW, sizeof(**state));
+/**
+ * Closes the streams from open_streams
+ * Returns 0 on success, -1 if the output could not be written out
+ */
+int close_streams (FILE *in, FILE *out) {
+    if (in != stdin) {
+        fclose(in);
     }
+    if (out != stdout && fclose(out)) {
+        perror(out_path);
+        return -1;
+    }
+    return 0;
+}
 
-    /* Create the key schedule */
-    if (use_ncurses) {
-        update_step("Key expansion");
+/**
+ * Runs the bulk authenticated encryption, opening the files as needed
+ * ctx: context holding the schedule
+ * ivbytes: pointer to unsigned char[iv_len], the nonce
+ * Returns the exit status
+ */
+int run_gcm (const struct aes_ctx_s *ctx, const unsigned char *ivbytes) {
+    unsigned char *aad;
+    size_t aad_len = strlen(aad_hex) / 2;
+    FILE *in;
+    FILE *out;
+    int ret;
+
+    aad = malloc(aad_len + 1);
+    if (!aad) {
+        fprintf(stderr, "Out of memory for the additional data\n");
+        return 1;
     }
-    key_expand(key);
-    /* Print the key schedule */
-    if (use_ncurses) {
-        key_sched_top = 0;
-        update_schedule();
-    } else {
-        printf("Key schedule:\n");
-        for (cx = 0; cx < NB * (NR + 1); cx++) {
-            for (cx2 = 0; cx2 < BPW; cx2++) {
-                printf("%02hhx", *(*(schedule + cx) + cx2));
-            }
-            printf("\n");
+    if (strlen(aad_hex) % 2 || hex_decode(aad, aad_hex, aad_len)) {
+        printf("Additional data is not a hex string!\n");
+        free(aad);
+        return 1;
+    }
+
+    if (open_streams(&in, &out)) {
+        free(aad);
+        return 1;
+    }
+    ret = bulk_gcm(engine, ctx, in, out, ivbytes, iv_len, aad, aad_len,
+                   decrypt);
+    if (ret == -2) {
+        fprintf(stderr, "Bulk decryption failed: authentication failed\n");
+    } else if (ret) {
+        fprintf(stderr, "Bulk %s failed: I/O error\n",
+                decrypt ? "decryption" : "encryption");
+    }
+    if (close_streams(in, out)) {
+        ret = -1;
+    }
+    free(aad);
+    return ret ? 1 : 0;
+}
+
+/**
+ * Runs the bulk encryption, opening the files as needed
+ * ctx: context holding the schedule
+ * Returns the exit status
+ */
+int run_bulk (const struct aes_ctx_s *ctx) {
+    unsigned char ivbytes [BLOCK_SIZE];
+    FILE *in;
+    FILE *out;
+    int ret;
+
+    hex_decode(ivbytes, iv, iv_len);
+
+    if (bulk_mode == MODE_GCM) {
+        return run_gcm(ctx, ivbytes);
+    }
+
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cores > 0) ? cores : 1;
+    }
+
+    if (map_files) {
+        ret = bulk_map(engine, ctx, in_path, in_place ? 0 : out_path,
+                       bulk_mode, ivbytes, threads, decrypt);
+        if (ret == -2) {
+            fprintf(stderr, "Bulk decryption failed: bad length or padding\n");
+        } else if (ret) {
+            fprintf(stderr, "Bulk %s failed: %s\n",
+                    decrypt ? "decryption" : "encryption", strerror(errno));
         }
+        return ret ? 1 : 0;
     }
 
-    /* Copy input into state */
-    for (cx = 0; cx < NB; cx++) {
-        str_bytes(*(state + cx), input + (cx * NB * 2), 1);
+    if (open_streams(&in, &out)) {
+        return 1;
     }
-    /* Transpose state */
-    for (cx = 1; cx < NB; cx++) {
-        for (cx2 = 0; cx2 < cx; cx2++) {
-            *(*(state + cx) + cx2) ^= *(*(state + cx2) + cx);
-            *(*(state + cx2) + cx) ^= *(*(state + cx) + cx2);
-            *(*(state + cx) + cx2) ^= *(*(state + cx2) + cx);
+    if (stream_mode) {
+        ret = bulk_stream(engine, ctx, fileno(in), fileno(out), bulk_mode,
+                          ivbytes, threads, decrypt);
+    } else if (decrypt) {
+        ret = bulk_decrypt(engine, ctx, in, out, bulk_mode, ivbytes, threads);
+    } else {
+        ret = bulk_encrypt(engine, ctx, in, out, bulk_mode, ivbytes, threads);
+    }
+    if (ret == -2) {
+        fprintf(stderr, "Bulk decryption failed: bad length or padding\n");
+    } else if (ret) {
+        fprintf(stderr, "Bulk %s failed: I/O error\n",
+                decrypt ? "decryption" : "encryption");
+    }
+    if (close_streams(in, out)) {
+        ret = -1;
+    }
+    return ret ? 1 : 0;
+}
+
+/**
+ * Runs the batch encryption and reports the key cache counters
+ * Returns the exit status
+ */
+int run_batch () {
+    unsigned long hits;
+    unsigned long misses;
+    FILE *in;
+    FILE *out;
+    int ret;
+
+    if (open_streams(&in, &out)) {
+        return 1;
+    }
+    ret = batch_encrypt(engine, in, out, decrypt);
+    if (ret < 0) {
+        fprintf(stderr, "Batch %s failed: I/O error\n",
+                decrypt ? "decryption" : "encryption");
+    }
+    if (close_streams(in, out)) {
+        ret = -1;
+    }
+
+    keycache_stats(&hits, &misses);
+    fprintf(stderr, "Key cache: %lu hits, %lu misses\n", hits, misses);
+    return ret ? 1 : 0;
+}
+
+/**
+ * Checks AESAVS files with the selected engine, or every engine usable
+ * here, and reports each one with the time it took
+ * The response is written by the first engine to check a file
+ * paths: the .req and .rsp files
+ * count: number of files
+ * Returns the exit status
+ */
+int run_kat (char **paths, int count) {
+    const struct engine_s *selected [] = {engine, 0};
+    const struct engine_s **e;
+    struct kat_result_s res;
+    struct timespec t0;
+    struct timespec t1;
+    FILE *in;
+    FILE *out = 0;
+    FILE *resp;
+    int cx;
+    int ret;
+    int status = 0;
+
+    if (strcmp(out_path, "-")) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            perror(out_path);
+            return 1;
         }
     }
 
-    /* Animate the input copying */
-    if (use_ncurses) {
-        update_step("Copy input into state");
-        highlight_op(COPY_INTO_STATE_OP);
-        for (cx = 0; cx < NB; cx++) {
-            for (cx2 = 0; cx2 < BPW; cx2++) {
-                /* Put in state window */
-                mvwprintw(state_win.win, 1 + (cx2 * 2), 1 + (cx * 3),
-                          "%02hhx", *(*(state + cx2) + cx));
-                /* Highlight the input bytes */
-                mvwchgat(params_win.win, 1, 13 + (2 * ((cx * NB) + cx2)), 2,
-                         A_STANDOUT, 0, 0);
-                update_panels();
-                doupdate();
-                napms(DELAY_MS);
+    for (cx = 0; cx < count; cx++) {
+        resp = out;
+        for (e = engine ? selected : engines; *e; e++) {
+            if (!engine && (*e)->setup()) {
+                continue;
+            }
+            in = fopen(*(paths + cx), "r");
+            if (!in) {
+                perror(*(paths + cx));
+                status = 1;
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            ret = kat_run(*e, in, resp, *(paths + cx), &res);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            fclose(in);
+            resp = 0;
+
+            if (ret == -2) {
+                printf("%s: not an ECB or CBC AESAVS suite, skipped\n",
+                       *(paths + cx));
+                break;
+            } else if (ret) {
+                fprintf(stderr, "%s: I/O error\n", *(paths + cx));
+                status = 1;
+                break;
+            }
+            printf("%s %s %s %s: %lu passed, %lu failed",
+                   *(paths + cx), (*e)->name, kat_type_name(res.type),
+                   (res.mode == MODE_CBC) ? "CBC" : "ECB", res.passed,
+                   res.failed);
+            if (res.answered) {
+                printf(", %lu answered", res.answered);
+            }
+            if (res.malformed) {
+                printf(", %lu malformed", res.malformed);
+            }
+            printf(" in %.1f ms%s\n",
+                   (t1.tv_sec - t0.tv_sec) * 1e3
+                   + (t1.tv_nsec - t0.tv_nsec) / 1e6,
+                   (res.failed || res.malformed) ? " FAIL" : "");
+            if (res.failed || res.malformed) {
+                status = 1;
             }
         }
-        /* Un-highlight input */
-        mvwchgat(params_win.win, 1, 13, 32,
-                 A_NORMAL, 0, 0);
     }
 
-    /* AES rounds */
+    if (out && fclose(out)) {
+        perror(out_path);
+        status = 1;
+    }
+    return status;
+}
+
+/**
+ * Times the first round lookups of the engine, or of sub_byte without
+ * one, and shows the heatmap or writes the table
+ * Returns the exit status
+ */
+int run_leak () {
+    unsigned char keybytes [KEY_SIZE_MAX];
+    struct leak_s *l;
+
+    str_bytes((char *) keybytes, key, NK);
+    fprintf(stderr, "Timing %lu samples of %s...\n", leak_samples,
+            engine ? engine->name : "sub_byte");
+    l = leak_measure(engine, keybytes, NK, leak_samples, leak_evict);
+    if (!l) {
+        fprintf(stderr, "Out of memory for the timings\n");
+        return 1;
+    }
+    if (headless || !isatty(STDOUT_FILENO)) {
+        leak_report(l, stdout);
+    } else {
+        show_leak(l);
+    }
+    free(l);
+    return 0;
+}
+
+/**
+ * Runs the selected engine on the single block, in bulk or in batch
+ * Returns the exit status
+ */
+int run_engine () {
+    unsigned char keybytes [KEY_SIZE_MAX];
+    unsigned char block [BLOCK_SIZE];
+    char hex [BLOCK_SIZE * 2 + 1] = {0};
+    const struct aes_ctx_s *ctx;
+
+    /* Bulk runs default to the fastest engine */
+    if (!engine) {
+        engine = engine_default();
+    }
+    if (batch_mode) {
+        return run_batch();
+    }
+    str_bytes((char *) keybytes, key, NK);
+    /* Counter modes only ever run the cipher forwards */
+    if (decrypt && bulk_mode != MODE_CTR && bulk_mode != MODE_GCM) {
+        ctx = keycache_get_dec(engine, keybytes, NK);
+    } else {
+        ctx = keycache_get(engine, keybytes, NK);
+    }
+
+    if (bulk_mode != MODE_NONE) {
+        return run_bulk(ctx);
+    }
+
+    str_bytes((char *) block, input, NB);
+    STATS_BEGIN();
+    if (decrypt) {
+        engine->decrypt(ctx, block, block, 1);
+    } else {
+        engine->encrypt(ctx, block, block, 1);
+    }
+    STATS_END(STATS_ENGINE_BLOCKS, 0);
+    printf("%s %s\n", decrypt ? "Ciphertext:" : "Plaintext: ", input);
+    printf("Key:        %s\n", key);
+    hex_encode(hex, block, BLOCK_SIZE);
+    printf("%s %s\n", decrypt ? "Plaintext: " : "Ciphertext:", hex);
+    return 0;
+}
+
+/**
+ * Runs the rounds of the cipher on the state step by step
+ * ctx: context holding the expanded schedule and the input state
+ */
+void cipher_rounds (struct aes_ctx_s *ctx) {
+    unsigned int cx;
+    unsigned int cx2;
+    unsigned int round;
+
     for (round = 0; round < NR + 1; round++) {
-        char round_buf [45] = {0};
-        if (use_ncurses) {
-            /* Clear the description eac round */
-            clear_ops_desc();
-            /* Display the round number in the current step window */
-            snprintf(round_buf, 44, "Round %u", round);
-            update_step(round_buf);
-            /* Display state in the state window unless round 0 */
-            if (round != 0) {
-                highlight_op(COPY_INTO_STATE_OP);
-                update_state();
-            }
-        } else {
-            printf("Round %u\n", round);
-            printf("========\n");
-            printf("State:\n");
-            for (cx = 0; cx < NB; cx++) {
-                for (cx2 = 0; cx2 < BPW; cx2++) {
-                    printf("%02hhx ", *(*(state + cx) + cx2));
-                }
-                printf("\n");
-            }
+        /* Clear the description each round */
+        emit(EV_DESC_CLEAR, 0, 0, 0);
+        emit(EV_STEP, STEP_ROUND, round, 0);
+        /* Display state in the state window unless round 0 */
+        if (round != 0) {
+            emit(EV_OP, COPY_INTO_STATE_OP, 0, 0);
+            emit(EV_STATE_SHOW, 0, 0, 0);
         }
+        trace_round(active_trace, round);
+        trace_state(active_trace, TRACE_START, *ctx->state);
 
         /* Round 0 only adds key */
         if (round == 0) {
@@ -185,162 +574,578 @@ int main (int argc, char **argv) {
         }
 
         /* Feed the state through the s-box */
-        if (use_ncurses) {
-            highlight_op(SUB_BYTES_OP);
-            update_panels();
-            doupdate();
-        }
+        emit(EV_OP, SUB_BYTES_OP, 0, 0);
+        STATS_BEGIN();
         for (cx = 0; cx < NB; cx++) {
             for (cx2 = 0; cx2 < BPW; cx2++) {
-                char *c = *(state + cx) + cx2;
+                char *c = *(ctx->state + cx) + cx2;
                 *c = sub_byte(*c);
-                if (use_ncurses) {
-                    napms(DELAY_MS);
-                }
-            }
-        }
-        if (use_ncurses) {
-        } else {
-            printf("After S-Box:\n");
-            for (cx = 0; cx < NB; cx++) {
-                for (cx2 = 0; cx2 < BPW; cx2++) {
-                    printf("%02hhx ", *(*(state + cx) + cx2));
-                }
-                printf("\n");
             }
+            emit(EV_STATE_ROW, cx, 0, *(ctx->state + cx));
         }
+        STATS_END(STATS_SUB_BYTES, round);
+        trace_state(active_trace, TRACE_SUB_BYTES, *ctx->state);
 
         /* Shift the rows */
-        if (use_ncurses) {
-            highlight_op(SHIFT_ROW_OP);
-            update_panels();
-            doupdate();
-        }
+        emit(EV_OP, SHIFT_ROW_OP, 0, 0);
+        STATS_BEGIN();
         for (cx = 1; cx < BPW; cx++) {
-            shift_row(*(state + cx), cx);
-            if (use_ncurses) {
-                napms(DELAY_MS);
-            }
-        }
-        if (use_ncurses) {
-        } else {
-            printf("After Row Shifts:\n");
-            for (cx = 0; cx < NB; cx++) {
-                for (cx2 = 0; cx2 < BPW; cx2++) {
-                    printf("%02hhx ", *(*(state + cx) + cx2));
-                }
-                printf("\n");
-            }
+            shift_row(*(ctx->state + cx), cx);
+            emit(EV_STATE_ROW, cx, 0, *(ctx->state + cx));
         }
+        STATS_END(STATS_SHIFT_ROWS, round);
+        trace_state(active_trace, TRACE_SHIFT_ROWS, *ctx->state);
 
         /* Mix the columns except last round */
         if (round == NR) {
             goto add_key;
         }
-        if (use_ncurses) {
-            highlight_op(MIX_COLS_OP);
-            update_panels();
-            doupdate();
-        }
+        emit(EV_OP, MIX_COLS_OP, 0, 0);
+        STATS_BEGIN();
         for (cx = 0; cx < NB; cx++) {
-            mix_col(cx);
-            if (use_ncurses) {
-                napms(DELAY_MS);
-            }
-        }
-        if (use_ncurses) {
-        } else {
-            printf("After Mix Columns:\n");
-            for (cx = 0; cx < NB; cx++) {
-                for (cx2 = 0; cx2 < BPW; cx2++) {
-                    printf("%02hhx ", *(*(state + cx) + cx2));
-                }
-                printf("\n");
-            }
+            mix_col(ctx, cx);
         }
+        STATS_END(STATS_MIX_COLS, round);
+        trace_state(active_trace, TRACE_MIX_COLS, *ctx->state);
 
 add_key:
         /* Add the round key */
-        if (use_ncurses) {
-            highlight_op(ADD_ROUND_KEY_OP);
-            update_panels();
-            doupdate();
+        emit(EV_OP, ADD_ROUND_KEY_OP, 0, 0);
+        trace_round_key(active_trace, ctx, round);
+        STATS_BEGIN();
+        add_round_key(ctx, round);
+        STATS_END(STATS_ADD_ROUND_KEY, round);
+
+        /* Blank between rounds */
+        trace_end(active_trace);
+    }
+}
+
+/**
+ * Runs the rounds of the inverse cipher on the state step by step
+ * This is the inverse cipher as written in FIPS-197 rather than the
+ * equivalent one the engines use, so the round keys shown are the ones
+ * in the schedule, just taken in reverse
+ * ctx: context holding the expanded schedule and the input state
+ */
+void inv_cipher_rounds (struct aes_ctx_s *ctx) {
+    unsigned int cx;
+    unsigned int cx2;
+    unsigned int round;
+
+    for (round = 0; round < NR + 1; round++) {
+        /* Clear the description each round */
+        emit(EV_DESC_CLEAR, 0, 0, 0);
+        emit(EV_STEP, STEP_ROUND, round, 0);
+        /* Display state in the state window unless round 0 */
+        if (round != 0) {
+            emit(EV_OP, COPY_INTO_STATE_OP, 0, 0);
+            emit(EV_STATE_SHOW, 0, 0, 0);
         }
-        add_round_key(round);
-        if (use_ncurses) {
-            napms(DELAY_MS);
+        trace_round(active_trace, round);
+        trace_state(active_trace, TRACE_START, *ctx->state);
+
+        /* Round 0 only adds the last round key */
+        if (round == 0) {
+            goto add_key;
         }
 
-        if (!use_ncurses) {
-            /* Blank between rounds */
-            printf("\n");
+        /* Shift the rows back */
+        emit(EV_OP, INV_SHIFT_ROWS_OP, 0, 0);
+        STATS_BEGIN();
+        for (cx = 1; cx < BPW; cx++) {
+            inv_shift_row(*(ctx->state + cx), cx);
+            emit(EV_STATE_ROW, cx, 0, *(ctx->state + cx));
         }
-    }
+        STATS_END(STATS_INV_SHIFT_ROWS, round);
+        trace_state(active_trace, TRACE_INV_SHIFT_ROWS, *ctx->state);
 
-    /* Print the final state */
-    if (use_ncurses) {
-        highlight_op(COPY_INTO_STATE_OP);
-        /* Display state in the state window */
-        update_state();
-    } else {
-        printf("Final State:\n");
+        /* Feed the state through the inverse s-box */
+        emit(EV_OP, INV_SUB_BYTES_OP, 0, 0);
+        STATS_BEGIN();
         for (cx = 0; cx < NB; cx++) {
             for (cx2 = 0; cx2 < BPW; cx2++) {
-                printf("%02hhx ", *(*(state + cx) + cx2));
+                char *c = *(ctx->state + cx) + cx2;
+                *c = inv_sub_byte(*c);
             }
-            printf("\n");
+            emit(EV_STATE_ROW, cx, 0, *(ctx->state + cx));
         }
-        printf("\n");
-    }
+        STATS_END(STATS_INV_SUB_BYTES, round);
+        trace_state(active_trace, TRACE_INV_SUB_BYTES, *ctx->state);
 
-    /* Print the results */
-    if (use_ncurses) {
-        update_step("Copy final state into output");
-        highlight_op(NO_OP);
-        /* Update the parameters window with the final ciphertext */
-        for (cx = 0; cx < NB; cx++) {
-            for (cx2 = 0; cx2 < BPW; cx2++) {
-                mvwprintw(params_win.win, 3, 13 + (((cx * NB) + cx2) * 2),
-                          "%02hhx", *(*(state + cx2) + cx));
-                /* Highlight the bytes in the state */
-                mvwchgat(state_win.win, 1 + (cx2 * 2), 1 + (cx * 3), 2,
-                         A_STANDOUT, 0, 0);
-                update_panels();
-                doupdate();
-                napms(DELAY_MS);
+add_key:
+        /* Add the round key */
+        emit(EV_OP, ADD_ROUND_KEY_OP, 0, 0);
+        trace_round_key(active_trace, ctx, NR - round);
+        STATS_BEGIN();
+        add_round_key(ctx, NR - round);
+        STATS_END(STATS_ADD_ROUND_KEY, round);
+
+        /* Unmix the columns except round 0 and the last round */
+        if (round != 0 && round != NR) {
+            emit(EV_OP, INV_MIX_COLS_OP, 0, 0);
+            STATS_BEGIN();
+            for (cx = 0; cx < NB; cx++) {
+                inv_mix_col(ctx, cx);
             }
+            STATS_END(STATS_INV_MIX_COLS, round);
+            trace_state(active_trace, TRACE_INV_MIX_COLS, *ctx->state);
         }
-        /* Unhighlight all the bytes in the state once done */
-        for (cx = 0; cx < NB; cx++) {
-            mvwchgat(state_win.win, 1 + (cx * 2), 1, state_win.width - 2,
-                     A_NORMAL, 0, 0);
+
+        /* Blank between rounds */
+        trace_end(active_trace);
+    }
+}
+
+/**
+ * Runs one block through the cipher step by step, from the input to the
+ * output
+ * ctx: context holding the expanded schedule
+ * in: hex string of the input block
+ */
+void cipher_block (struct aes_ctx_s *ctx, const char *in) {
+    unsigned int cx;
+    unsigned int cx2;
+
+    /* Copy input into state */
+    for (cx = 0; cx < NB; cx++) {
+        str_bytes(*(ctx->state + cx), in + (cx * NB * 2), 1);
+    }
+    /* Transpose state */
+    for (cx = 1; cx < NB; cx++) {
+        for (cx2 = 0; cx2 < cx; cx2++) {
+            *(*(ctx->state + cx) + cx2) ^= *(*(ctx->state + cx2) + cx);
+            *(*(ctx->state + cx2) + cx) ^= *(*(ctx->state + cx) + cx2);
+            *(*(ctx->state + cx) + cx2) ^= *(*(ctx->state + cx2) + cx);
         }
-        update_panels();
-        doupdate();
+    }
+    for (cx = 0; cx < NB; cx++) {
+        emit(EV_STATE_ROW, cx, 0, *(ctx->state + cx));
+    }
+
+    /* Animate the input copying */
+    emit(EV_STEP, STEP_COPY_INPUT, 0, 0);
+    emit(EV_OP, COPY_INTO_STATE_OP, 0, 0);
+    emit(EV_INPUT, 0, 0, 0);
+
+    /* AES rounds */
+    if (decrypt) {
+        inv_cipher_rounds(ctx);
     } else {
-        printf("Plaintext:  %s\n", input);
-        printf("Key:        %s\n", key);
-        printf("Ciphertext: ");
-        for (cx = 0; cx < NB; cx++) {
-            for (cx2 = 0; cx2 < BPW; cx2++) {
-                printf("%02hhx", *(*(state + cx2) + cx));
+        cipher_rounds(ctx);
+    }
+
+    /* Trace the final state */
+    emit(EV_OP, COPY_INTO_STATE_OP, 0, 0);
+    emit(EV_STATE_SHOW, 0, 0, 0);
+    trace_state(active_trace, TRACE_FINAL, *ctx->state);
+    trace_end(active_trace);
+
+    /* Trace the results */
+    emit(EV_STEP, STEP_OUTPUT, 0, 0);
+    emit(EV_OP, NO_OP, 0, 0);
+    emit(EV_OUTPUT, 0, 0, 0);
+    trace_result(active_trace, in, key, ctx, decrypt);
+}
+
+/**
+ * Writes the headless trace of the input block, or of every block of the
+ * input file if one was given
+ * A short last block is padded with zeros like short input
+ * ctx: context holding the expanded schedule
+ * Returns the exit status
+ */
+int run_trace (struct aes_ctx_s *ctx) {
+    unsigned char block [BLOCK_SIZE];
+    char hex [BLOCK_SIZE * 2 + 1] = {0};
+    struct trace_s t;
+    FILE *in;
+    FILE *out;
+    size_t len;
+    int ret = 0;
+
+    if (open_streams(&in, &out)) {
+        return 1;
+    }
+    if (trace_open(&t, out, trace_fmt)) {
+        fprintf(stderr, "Out of memory for the trace\n");
+        close_streams(in, out);
+        return 1;
+    }
+    active_trace = &t;
+
+    trace_schedule(active_trace, ctx);
+    if (!in_path) {
+        cipher_block(ctx, input);
+    } else {
+        while ((len = fread(block, 1, BLOCK_SIZE, in)) > 0) {
+            memset(block + len, 0, BLOCK_SIZE - len);
+            hex_encode(hex, block, BLOCK_SIZE);
+            cipher_block(ctx, hex);
+        }
+        if (ferror(in)) {
+            perror(in_path);
+            ret = 1;
+        }
+    }
+
+    active_trace = 0;
+    if (trace_close(&t)) {
+        fprintf(stderr, "Trace failed: I/O error\n");
+        ret = 1;
+    }
+    if (close_streams(in, out)) {
+        ret = 1;
+    }
+    return ret;
+}
+
+/**
+ * Opens the recording file and points the replay at it
+ * rec: recording to start
+ * Returns 0 on success, the error has been printed otherwise
+ */
+int open_recording (struct rec_s *rec) {
+    const char *cols = getenv("COLUMNS");
+    const char *lines = getenv("LINES");
+    FILE *out = fopen(record_path, "w");
+
+    if (!out) {
+        perror(record_path);
+        return -1;
+    }
+    if (rec_open(rec, out, cols ? strtoul(cols, 0, 10) : 160,
+                 lines ? strtoul(lines, 0, 10) : 50)) {
+        perror(record_path);
+        fclose(out);
+        return -1;
+    }
+    recording = rec;
+    return 0;
+}
+
+/**
+ * Prints the stage counters if they were asked for
+ * status: exit status of the run
+ * Returns status
+ */
+int finish (int status) {
+    if (show_stats) {
+        fprintf(stderr, "\n");
+        stats_print(stderr);
+    }
+    return status;
+}
+
+int main (int argc, char **argv) {
+    int opt;
+    /* State and schedule for the single block */
+    struct aes_ctx_s ctx = {0};
+    /* Steps recorded for the visualization */
+    struct event_log_s log;
+    /* First event to animate */
+    long start = 0;
+    /* Asciicast the replay goes to instead of the terminal */
+    struct rec_s rec;
+
+    /* Parse arguments */
+    while ((opt = getopt_long(argc, argv, optstring, long_opts, 0)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            exit(1);
+        case 'i':
+            /* Reset input to null bytes */
+            memset(input, 0, NB * BPW * 2);
+            strncpy(input, optarg, NB * BPW * 2);
+
+            /* Short input is padded with zeros, but must be hex */
+            if (!hex_valid(input, strlen(input))) {
+                printf("Input is not a hex string!\n");
+                usage();
+                exit(1);
+            }
+            break;
+        case 'k':
+            /* Test the key length */
+            if (strlen(optarg) % 2 || !key_words(strlen(optarg) / 2)) {
+                printf("Key not of 128, 192 or 256 bit length!\n");
+                usage();
+                exit(1);
+            }
+            if (!hex_valid(optarg, strlen(optarg))) {
+                printf("Key is not a hex string!\n");
+                usage();
+                exit(1);
+            }
+
+            /* Reset key to null bytes */
+            memset(key, 0, sizeof(key));
+            strncpy(key, optarg, sizeof(key) - 1);
+            set_key_size(key_words(strlen(key) / 2));
+            break;
+        case 'n':
+            use_ncurses = 0;
+            headless = 1;
+            break;
+        case 'T':
+            trace_fmt = trace_fmt_from_str(optarg);
+            if (trace_fmt == TRACE_NONE) {
+                printf("Unknown trace format: '%s'\n", optarg);
+                usage();
+                exit(1);
+            }
+            use_ncurses = 0;
+            headless = 1;
+            break;
+        case 'x':
+            decrypt = 1;
+            decrypt_mode = 1;
+            break;
+        case 'm':
+            bulk_mode = mode_from_str(optarg);
+            if (bulk_mode == MODE_NONE) {
+                printf("Unknown mode: '%s'\n", optarg);
+                usage();
+                exit(1);
+            }
+            use_ncurses = 0;
+            break;
+        case 'e':
+            engine = engine_find(optarg);
+            if (!engine) {
+                printf("Unknown or unsupported engine: '%s'\n", optarg);
+                usage();
+                exit(1);
+            }
+            use_ncurses = 0;
+            break;
+        case 'I':
+            in_place = 1;
+            map_files = 1;
+            break;
+        case 'M':
+            map_files = 1;
+            break;
+        case 's':
+            stream_mode = 1;
+            break;
+        case 'S':
+#ifndef AES_STATS
+            printf("Built without the stage counters, rebuild with\n");
+            printf("make clean && make STATS=1 for --stats\n");
+            usage();
+            exit(1);
+#endif
+            show_stats = 1;
+            break;
+        case 'L':
+            leak_samples = strtoul(optarg, 0, 10);
+            if (leak_samples == 0) {
+                printf("Sample count must be a positive number\n");
+                usage();
+                exit(1);
+            }
+            break;
+        case 'E':
+            leak_evict = 1;
+            break;
+        case 'R':
+            record_path = optarg;
+            break;
+        case 'K':
+            kat_mode = 1;
+            use_ncurses = 0;
+            break;
+        case 'b':
+            batch_mode = 1;
+            use_ncurses = 0;
+            break;
+        case 'f':
+            in_path = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 't':
+            threads = strtoul(optarg, 0, 10);
+            if (threads == 0 || threads > CTR_MAX_THREADS) {
+                printf("Thread count must be 1 to %u\n", CTR_MAX_THREADS);
+                usage();
+                exit(1);
+            }
+            break;
+        case 'd':
+            delay_ms = strtol(optarg, 0, 10);
+            if (delay_ms < 0 || delay_ms > DELAY_MAX) {
+                printf("Delay must be 0 to %d ms\n", DELAY_MAX);
+                usage();
+                exit(1);
             }
+            break;
+        case 'r':
+            start_round = strtol(optarg, 0, 10);
+            break;
+        case 'w':
+            start_word = strtol(optarg, 0, 10);
+            break;
+        case 'v':
+            /* Test the IV length, 96 bits only make sense for gcm */
+            if (strlen(optarg) != NB * BPW * 2
+                && strlen(optarg) != GCM_IV_SIZE * 2) {
+                printf("IV not of 96 or 128 bit length!\n");
+                usage();
+                exit(1);
+            }
+            if (!hex_valid(optarg, strlen(optarg))) {
+                printf("IV is not a hex string!\n");
+                usage();
+                exit(1);
+            }
+            strncpy(iv, optarg, NB * BPW * 2);
+            iv_len = strlen(iv) / 2;
+            break;
+        case 'A':
+            aad_hex = optarg;
+            break;
+        /* No argument given */
+        case ':':
+            printf("Option '%s' requires %s as an argument.\n",
+                *(argv + optind - 1), opt_arg_desc(optopt)
+            );
+            usage();
+            exit(1);
+        /* Invalid option */
+        case '?':
+            printf("Invalid option: '%s'\n", *(argv + optind - 1));
+            usage();
+            exit(1);
         }
-        printf("\n");
     }
 
-    /* Cleanup */
-    for (cx = 0; cx < NB; cx++) {
-        free(*(state + cx));
+    /* The number of rounds depends on the key, so check these last */
+    if (start_round < -1 || start_round > (int) NR) {
+        printf("Round must be 0 to %u\n", NR);
+        usage();
+        exit(1);
+    }
+    if (start_word < -1 || start_word >= (int) (NB * (NR + 1))) {
+        printf("Schedule word must be 0 to %u\n", NB * (NR + 1) - 1);
+        usage();
+        exit(1);
     }
-    free(state);
-    for (cx = 0; cx < NB * (NR + 1); cx++) {
-        free(*(schedule + cx));
+
+    /* Mappings need real files on both ends, or just one in place */
+    if (map_files) {
+        if (bulk_mode == MODE_NONE) {
+            printf("Memory mapping needs a bulk mode\n");
+            usage();
+            exit(1);
+        }
+        if (!in_path || !strcmp(in_path, "-")
+            || (!in_place && !strcmp(out_path, "-"))) {
+            printf("Memory mapping needs files, not stdin or stdout\n");
+            usage();
+            exit(1);
+        }
+        if (in_place && strcmp(out_path, "-")) {
+            printf("In place encryption has no output file\n");
+            usage();
+            exit(1);
+        }
     }
-    free(schedule);
+
+    if (stream_mode && (bulk_mode == MODE_NONE || map_files)) {
+        printf("Streaming needs a bulk mode and no memory mapping\n");
+        usage();
+        exit(1);
+    }
+
+    /* GCM takes its nonce as it is, 96 bits unless told otherwise */
+    if (bulk_mode == MODE_GCM) {
+        if (map_files || stream_mode) {
+            printf("gcm checks the whole message at once, so it is not\n");
+            printf("available with -M, -I or --stream\n");
+            usage();
+            exit(1);
+        }
+        if (!iv_len) {
+            iv_len = GCM_IV_SIZE;
+        }
+    } else if (iv_len == GCM_IV_SIZE) {
+        printf("IV not of 128 bit length!\n");
+        usage();
+        exit(1);
+    } else {
+        iv_len = BLOCK_SIZE;
+    }
+
+    if (kat_mode) {
+        if (optind >= argc) {
+            printf("Checking needs AESAVS files\n");
+            usage();
+            exit(1);
+        }
+        return finish(run_kat(argv + optind, argc - optind));
+    }
+
+    if (leak_samples) {
+        return finish(run_leak());
+    }
+
+    if (record_path && (!use_ncurses || engine || bulk_mode != MODE_NONE
+                        || batch_mode)) {
+        printf("Recording needs the visualization, not a headless run\n");
+        usage();
+        exit(1);
+    }
+
+    /* Non-visual runs don't need the step by step machinery */
+    if (engine || bulk_mode != MODE_NONE || batch_mode) {
+        return finish(run_engine());
+    }
+
+    /* Record the steps for the visualization to replay afterwards */
     if (use_ncurses) {
-        getch();
-        leave_ncurses();
+        event_log_init(&log);
+        event_log = &log;
     }
-    return 0;
+
+    /* Create the key schedule */
+    emit(EV_STEP, STEP_KEY_EXPANSION, 0, 0);
+    STATS_BEGIN();
+    key_expand(&ctx, key);
+    STATS_END(STATS_KEY_EXPAND, 0);
+    emit(EV_SCHED_SHOW, 0, 0, 0);
+
+    if (!use_ncurses) {
+        return finish(run_trace(&ctx));
+    }
+    cipher_block(&ctx, input);
+
+    /* The block is done, now play it back from where was asked */
+    event_log = 0;
+    if (start_round >= 0) {
+        start = event_find_round(&log, start_round);
+    } else if (start_word >= 0) {
+        start = event_find_word(&log, start_word);
+    }
+    if (record_path && open_recording(&rec)) {
+        event_log_free(&log);
+        return 1;
+    }
+    init_ncurses();
+    replay_events(&log, input, key, start);
+
+    /* Cleanup */
+    leave_ncurses();
+    event_log_free(&log);
+    if (recording) {
+        recording = 0;
+        if (rec_close(&rec) || fclose(rec.out)) {
+            perror(record_path);
+            return finish(1);
+        }
+    }
+    return finish(0);
 }
@@ -0,0 +1,314 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cipher.h"
+#include "modes.h"
+
+/**
+ * Looks up a mode of operation by name
+ * str: name of the mode, "ecb", "cbc" or "ctr"
+ * Returns MODE_NONE if the name is unknown
+ */
+enum mode_e mode_from_str (const char *str) {
+    if (!strcmp(str, "ecb")) {
+        return MODE_ECB;
+    } else if (!strcmp(str, "cbc")) {
+        return MODE_CBC;
+    } else if (!strcmp(str, "ctr")) {
+        return MODE_CTR;
+    } else if (!strcmp(str, "gcm")) {
+        return MODE_GCM;
+    }
+    return MODE_NONE;
+}
+
+/**
+ * Encrypts whole blocks in electronic codebook mode
+ * eng: engine to encrypt with
+ * ctx: context holding the schedule
+ * out: pointer to unsigned char[blocks * BLOCK_SIZE], may equal in but
+ *      not overlap it otherwise
+ * in: pointer to unsigned char[blocks * BLOCK_SIZE]
+ * blocks: number of blocks in in
+ */
+void ecb_encrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in,
+                  size_t blocks) {
+    /* Blocks are independent, let the engine batch them */
+    eng->encrypt(ctx, out, in, blocks);
+}
+
+/**
+ * Encrypts whole blocks in cipher block chaining mode
+ * eng: engine to encrypt with
+ * ctx: context holding the schedule
+ * out: pointer to unsigned char[blocks * BLOCK_SIZE], may equal in but
+ *      not overlap it otherwise
+ * in: pointer to unsigned char[blocks * BLOCK_SIZE]
+ * blocks: number of blocks in in
+ * iv: chaining value, updated to the last ciphertext block so that
+ *     consecutive calls continue the same chain
+ */
+void cbc_encrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in,
+                  size_t blocks, unsigned char *iv) {
+    unsigned int cx;
+
+    for (; blocks > 0; blocks--, in += BLOCK_SIZE, out += BLOCK_SIZE) {
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            *(out + cx) = *(in + cx) ^ *(iv + cx);
+        }
+        eng->encrypt(ctx, out, out, 1);
+        memcpy(iv, out, BLOCK_SIZE);
+    }
+}
+
+/* Blocks decrypted per engine call in cipher block chaining mode */
+#define CBC_BATCH 64
+
+/**
+ * Decrypts whole blocks in electronic codebook mode
+ * eng: engine to decrypt with
+ * ctx: context holding the decryption schedule
+ * out, in, blocks: as for ecb_encrypt
+ */
+void ecb_decrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in,
+                  size_t blocks) {
+    eng->decrypt(ctx, out, in, blocks);
+}
+
+/**
+ * Decrypts whole blocks in cipher block chaining mode
+ * Unlike encryption every block only depends on ciphertext, so blocks
+ * are decrypted CBC_BATCH at a time and the chain is applied afterwards.
+ * In place the ciphertext of a batch is saved first, out of place it is
+ * still there in in.
+ * eng: engine to decrypt with
+ * ctx: context holding the decryption schedule
+ * out, in, blocks: as for cbc_encrypt
+ * iv: chaining value, updated to the last ciphertext block so that
+ *     consecutive calls continue the same chain
+ */
+void cbc_decrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in,
+                  size_t blocks, unsigned char *iv) {
+    unsigned char saved [CBC_BATCH * BLOCK_SIZE];
+    const unsigned char *prev;
+    size_t n;
+    size_t cx;
+
+    for (; blocks > 0; blocks -= n, in += n * BLOCK_SIZE,
+         out += n * BLOCK_SIZE) {
+        n = (blocks < CBC_BATCH) ? blocks : CBC_BATCH;
+        prev = in;
+        if (out == in) {
+            memcpy(saved, in, n * BLOCK_SIZE);
+            prev = saved;
+        }
+        eng->decrypt(ctx, out, in, n);
+
+        /* Block i chains with ciphertext block i - 1, the first with iv */
+        for (cx = 0; cx < BLOCK_SIZE; cx++) {
+            *(out + cx) ^= *(iv + cx);
+        }
+        for (cx = BLOCK_SIZE; cx < n * BLOCK_SIZE; cx++) {
+            *(out + cx) ^= *(prev + cx - BLOCK_SIZE);
+        }
+        memcpy(iv, prev + ((n - 1) * BLOCK_SIZE), BLOCK_SIZE);
+    }
+}
+
+/* Counter blocks encrypted per engine call */
+#define CTR_BATCH 64
+/* Don't bother with threads for less than this many blocks per thread */
+#define CTR_MIN_BLOCKS 1024
+
+/* A range of the input for one worker */
+struct ctr_job_s {
+    const struct engine_s *eng;
+    const struct aes_ctx_s *ctx;
+    unsigned char *out;
+    const unsigned char *in;
+    size_t len;
+    /* Counter block for the first block of buf */
+    unsigned char ctr [BLOCK_SIZE];
+};
+
+/**
+ * Adds to a counter block, treated as a 128 bit big endian number
+ * ctr: pointer to unsigned char[BLOCK_SIZE]
+ * n: amount to add
+ */
+static void ctr_add (unsigned char *ctr, size_t n) {
+    unsigned int cx;
+    size_t sum;
+
+    for (cx = BLOCK_SIZE; cx > 0 && n; cx--) {
+        sum = *(ctr + cx - 1) + (n & 0xff);
+        *(ctr + cx - 1) = (unsigned char) sum;
+        n = (n >> 8) + (sum >> 8);
+    }
+}
+
+/**
+ * Xors the key stream into a range of the input, single threaded
+ * job: range to encrypt, its counter is left untouched
+ */
+static void ctr_xor (const struct ctr_job_s *job) {
+    unsigned char ctrs [CTR_BATCH * BLOCK_SIZE];
+    unsigned char ctr [BLOCK_SIZE];
+    unsigned char *out = job->out;
+    const unsigned char *in = job->in;
+    size_t len = job->len;
+    uint64_t a;
+    uint64_t b;
+    size_t n;
+    size_t cx;
+
+    memcpy(ctr, job->ctr, BLOCK_SIZE);
+    while (len > 0) {
+        /* Lay out the next counter blocks and encrypt them at once */
+        n = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (n > CTR_BATCH) {
+            n = CTR_BATCH;
+        }
+        for (cx = 0; cx < n; cx++) {
+            memcpy(ctrs + (cx * BLOCK_SIZE), ctr, BLOCK_SIZE);
+            ctr_add(ctr, 1);
+        }
+        job->eng->encrypt(job->ctx, ctrs, ctrs, n);
+
+        n *= BLOCK_SIZE;
+        if (n > len) {
+            n = len;
+        }
+        /* Whole words at a time, the compiler turns these into loads */
+        for (cx = 0; cx + 8 <= n; cx += 8) {
+            memcpy(&a, in + cx, 8);
+            memcpy(&b, ctrs + cx, 8);
+            a ^= b;
+            memcpy(out + cx, &a, 8);
+        }
+        for (; cx < n; cx++) {
+            *(out + cx) = *(in + cx) ^ *(ctrs + cx);
+        }
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+/**
+ * Thread entry point for ctr_xor
+ */
+static void *ctr_worker (void *job) {
+    ctr_xor(job);
+    return 0;
+}
+
+/**
+ * Encrypts in counter mode, spreading the work over threads
+ * Every thread gets its own contiguous range of blocks and starts from
+ * the counter value for that range, they all share the read only
+ * schedule. Decryption is the same operation.
+ * eng: engine to encrypt with
+ * ctx: context holding the schedule
+ * out: pointer to unsigned char[len], may equal in but not overlap it
+ *      otherwise
+ * in: pointer to unsigned char[len]
+ * len: number of bytes, anything but the last call of a stream must
+ *      be a multiple of BLOCK_SIZE
+ * ctr: counter block, advanced past buf so that consecutive calls
+ *      continue the same stream
+ * threads: number of threads to use, at most CTR_MAX_THREADS
+ */
+void ctr_encrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in, size_t len,
+                  unsigned char *ctr, unsigned int threads) {
+    struct ctr_job_s jobs [CTR_MAX_THREADS];
+    pthread_t tids [CTR_MAX_THREADS];
+    size_t blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t per;
+    size_t off = 0;
+    unsigned int started;
+    unsigned int cx;
+
+    if (threads > CTR_MAX_THREADS) {
+        threads = CTR_MAX_THREADS;
+    }
+    if (threads > blocks / CTR_MIN_BLOCKS) {
+        threads = blocks / CTR_MIN_BLOCKS;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    per = (blocks + threads - 1) / threads;
+
+    /* Carve the buffer into ranges, the last may be short */
+    for (cx = 0; cx < threads; cx++) {
+        (jobs + cx)->eng = eng;
+        (jobs + cx)->ctx = ctx;
+        (jobs + cx)->out = out + off;
+        (jobs + cx)->in = in + off;
+        (jobs + cx)->len = (len - off < per * BLOCK_SIZE)
+                         ? len - off : per * BLOCK_SIZE;
+        memcpy((jobs + cx)->ctr, ctr, BLOCK_SIZE);
+        ctr_add((jobs + cx)->ctr, off / BLOCK_SIZE);
+        off += (jobs + cx)->len;
+    }
+
+    /* The calling thread takes the first range itself */
+    for (started = 1; started < threads; started++) {
+        if (pthread_create(tids + started, 0, ctr_worker, jobs + started)) {
+            break;
+        }
+    }
+    ctr_xor(jobs);
+    for (cx = 1; cx < started; cx++) {
+        pthread_join(*(tids + cx), 0);
+    }
+    /* Ranges a thread couldn't be started for */
+    for (cx = started; cx < threads; cx++) {
+        ctr_xor(jobs + cx);
+    }
+
+    ctr_add(ctr, blocks);
+}
+
+/**
+ * Applies PKCS#7 padding to the final partial block
+ * buf: pointer to unsigned char[BLOCK_SIZE], holding len bytes of data
+ * len: number of data bytes, less than BLOCK_SIZE
+ * Returns the padded length, always BLOCK_SIZE
+ */
+unsigned int pkcs7_pad (unsigned char *buf, unsigned int len) {
+    memset(buf + len, BLOCK_SIZE - len, BLOCK_SIZE - len);
+    return BLOCK_SIZE;
+}
+
+/**
+ * Checks and strips PKCS#7 padding from the end of decrypted data
+ * buf: pointer to unsigned char[len]
+ * len: number of bytes, a nonzero multiple of BLOCK_SIZE
+ * Returns the length without padding, -1 if the padding is invalid
+ */
+long pkcs7_unpad (const unsigned char *buf, size_t len) {
+    unsigned int pad;
+    unsigned int cx;
+
+    if (len == 0 || len % BLOCK_SIZE) {
+        return -1;
+    }
+    pad = *(buf + len - 1);
+    if (pad == 0 || pad > BLOCK_SIZE) {
+        return -1;
+    }
+    for (cx = 1; cx <= pad; cx++) {
+        if (*(buf + len - cx) != pad) {
+            return -1;
+        }
+    }
+    return len - pad;
+}
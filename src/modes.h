@@ -0,0 +1,40 @@
+#ifndef MODES_H_20261017_092733
+#define MODES_H_20261017_092733
+
+#include <stddef.h>
+
+#include "cipher.h"
+
+/* Block cipher modes of operation */
+enum mode_e {
+    MODE_NONE = 0,
+    MODE_ECB,
+    MODE_CBC,
+    MODE_CTR,
+    /* Counter mode with a GHASH tag, see gcm.h */
+    MODE_GCM
+};
+
+/* Upper limit on the worker threads of ctr_encrypt */
+#define CTR_MAX_THREADS 64
+
+enum mode_e mode_from_str (const char *str);
+void ecb_encrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in,
+                  size_t blocks);
+void cbc_encrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in,
+                  size_t blocks, unsigned char *iv);
+void ecb_decrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in,
+                  size_t blocks);
+void cbc_decrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in,
+                  size_t blocks, unsigned char *iv);
+void ctr_encrypt (const struct engine_s *eng, const struct aes_ctx_s *ctx,
+                  unsigned char *out, const unsigned char *in, size_t len,
+                  unsigned char *ctr, unsigned int threads);
+unsigned int pkcs7_pad (unsigned char *buf, unsigned int len);
+long pkcs7_unpad (const unsigned char *buf, size_t len);
+
+#endif /* MODES_H_20261017_092733 */
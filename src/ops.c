@@ -3,38 +3,32 @@
 #include <string.h>
 
 #include "aesvars.h"
+#include "events.h"
+#include "gf.h"
 #include "ops.h"
-#include "output_ctrl.h"
 
 /**
- * Perfomrs a multiplication by x in the finite field
- * shift left 1, if highest bit set xor with 0x1b
+ * Performs a multiplication by x in the finite field
+ * shift left 1, if highest bit set xor with 0x1b, looked up in a table
  */
 char xtime (char c) {
-    return (c & 0x80) ? ((c << 1) & 0xfe) ^ 0x1b : (c << 1) & 0xfe;
+    return *(GF_MUL_02 + (unsigned char) c);
 }
 
 /**
  * Performs polynomial multiplication in the finite field
+ * Adds the logs of the two, every multiplier works
  * a: polynomial to multiply with
  * b: polynomial to multiply by
  */
 char poly_mult (char a, char b) {
-    char ret = 0;
-    char cur = a;
-    unsigned int cx;
-
-    /* Go through each bit of b, performing incremental xtime's */
-    for (cx = 0; cx < 7; cx++) {
-        /* if the bit is set, add to total */
-        if (b & (1 << cx)) {
-            ret ^= cur;
-        }
+    unsigned char x = a;
+    unsigned char y = b;
 
-        cur = xtime(cur);
+    if (x == 0 || y == 0) {
+        return 0;
     }
-
-    return ret;
+    return *(GF_EXP + *(GF_LOG + x) + *(GF_LOG + y));
 }
 
 /**
@@ -44,23 +38,12 @@ char poly_mult (char a, char b) {
  */
 void xor_word (char *dest, char *src) {
     unsigned int cx;
-    int x;
-    int y;
 
-    if (use_ncurses) {
-        getyx(desc_win.win, y, x);
-    }
     for (cx = 0; cx < BPW; cx++) {
         *(dest + cx) = *(dest + cx) ^ *(src + cx);
-        /* Show in the description window */
-        if (use_ncurses) {
-            mvwprintw(desc_win.win, y + 1, 1 + (3 * cx),
-                      "%02hhx", *(dest + cx));
-            update_panels();
-            doupdate();
-            napms(DELAY_MS);
-        }
     }
+    /* Show in the description window */
+    emit(EV_DESC_WORD, 0, 0, dest);
 }
 
 /**
@@ -69,39 +52,15 @@ void xor_word (char *dest, char *src) {
  */
 void sub_word (char *word) {
     unsigned int cx;
-    int x;
-    int y;
-
-    /**
-     * Display the byte substitution description
-     * and show the s box window
-     */
-    if (use_ncurses) {
-        getyx(desc_win.win, y, x);
-        wprintw(desc_win.win, "   Byte substitution");
-        mvwprintw(desc_win.win, y + 1, 1, "-----------");
-        show_panel(s_box_win.pan);
-        update_panels();
-        doupdate();
-        napms(DELAY_MS);
-    }
+
+    /* Show the s box alongside the byte substitution description */
+    emit(EV_SUB_BEGIN, 0, 0, 0);
     for (cx = 0; cx < BPW; cx++) {
         *(word + cx) = sub_byte(*(word + cx));
         /* Update the description with the newly substituted byte */
-        if (use_ncurses) {
-            mvwprintw(desc_win.win, y + 2, 1 + (3 * cx),
-                      "%02hhx", *(word + cx));
-            update_panels();
-            doupdate();
-        }
-    }
-    /* Hide the s box window again */
-    if (use_ncurses) {
-        hide_panel(s_box_win.pan);
-        update_panels();
-        doupdate();
-        napms(DELAY_MS);
+        emit(EV_SUB_BYTE, cx, (unsigned char) *(word + cx), 0);
     }
+    emit(EV_SUB_END, 0, 0, 0);
 }
 
 /**
@@ -110,13 +69,9 @@ void sub_word (char *word) {
  * rcon: pointer to char[4]
  */
 void round_constant (char *rcon, unsigned int i) {
-    char temp = 0x01;
-
     memset(rcon, 0, BPW);
-    for (i = i - 1; i > 0; i--) {
-        temp = xtime(temp);
-    }
-    *rcon = temp;
+    /* x^(i-1) is {03} to the power of log(x) * (i-1) */
+    *rcon = *(GF_EXP + ((*(GF_LOG + 0x02) * (i - 1)) % 255));
 }
 
 /**
@@ -161,143 +116,62 @@ void str_bytes (char *dest, const char *src, unsigned int len) {
 
 /**
  * Performs a key expansion on the given key
+ * ctx: context to fill the schedule of
+ * keystr: key as a hex string, NK words long
  */
-void key_expand (const char *keystr) {
+void key_expand (struct aes_ctx_s *ctx, const char *keystr) {
     unsigned int cx;
-    unsigned int cx2;
     char key [NK * BPW];
     char temp [BPW];
     char rcon [BPW];
-    int x;
-    int y;
 
     str_bytes(key, keystr, NK);
+    ctx->nk = NK;
+    ctx->nr = NR;
 
-    /* Highlight operation */
-    if (use_ncurses) {
-        highlight_op(COPY_INIT_KEY_OP);
-    }
     /* Copy the key into the first part of the schedule */
+    emit(EV_OP, COPY_INIT_KEY_OP, 0, 0);
     for (cx = 0; cx < NK; cx++) {
-        memcpy(*(schedule + cx), key + (cx * NK), BPW);
-        /* Update the schedule window */
-        if (use_ncurses) {
-            key_sched_count++;
-            update_schedule();
-            napms(DELAY_MS);
-        }
+        memcpy(*(ctx->schedule + cx), key + (cx * BPW), BPW);
+        emit(EV_SCHED_WORD, cx, 0, *(ctx->schedule + cx));
     }
 
     /* Expand the key into the schedule */
     for (cx = NK; cx < NB * (NR + 1); cx++) {
-        memcpy(temp, *(schedule + cx - 1), BPW);
-        if (use_ncurses) {
-            /* Clear the description */
-            clear_ops_desc();
-
-            /* Highlight operation */
-            highlight_op(GET_PREV_KEY_OP);
-
-            /* Highlight key in schedule and print in the description */
-            mvwchgat(key_sched_win.win, 1 + (cx - 1 - key_sched_top), 1, 11,
-                     A_STANDOUT, 0, 0);
-            for (cx2 = 0; cx2 < BPW; cx2++) {
-                mvwprintw(desc_win.win, 1, 1 + (cx2 * 3),
-                          "%02hhx ", *(temp + cx2));
-                update_panels();
-                doupdate();
-                napms(DELAY_MS);
-            }
-            /* Un-highlight the key in schedule */
-            mvwchgat(key_sched_win.win, 1 + (cx - 1 - key_sched_top), 1, 11,
-                     A_NORMAL, 0, 0);
-            update_panels();
-            doupdate();
-        }
+        memcpy(temp, *(ctx->schedule + cx - 1), BPW);
+        emit(EV_DESC_CLEAR, 0, 0, 0);
+        emit(EV_OP, GET_PREV_KEY_OP, 0, 0);
+        emit(EV_PREV_WORD, cx - 1, 0, temp);
         /* temp =  */
         if (cx % NK == 0) {
             /* sub_word(shift_row(temp)) xor round_constant(rcon, cx/NK) */
-            if (use_ncurses) {
-                highlight_op(SHIFT_ROW_OP);
-            }
+            emit(EV_OP, SHIFT_ROW_OP, 0, 0);
             shift_row(temp, 1);
-            /* Display shift row results */
-            if (use_ncurses) {
-                getyx(desc_win.win, y, x);
-                for (cx2 = 0; cx2 < BPW; cx2++) {
-                    mvwprintw(desc_win.win, y + 1, 1 + (cx2 * 3),
-                              "%02hhx", *(temp + cx2));
-                    update_panels();
-                    doupdate();
-                    napms(DELAY_MS);
-                }
-            }
-            if (use_ncurses) {
-                highlight_op(SUB_ROW_OP);
-            }
+            emit(EV_DESC_WORD, 0, 0, temp);
+            emit(EV_OP, SUB_ROW_OP, 0, 0);
             sub_word(temp);
-            if (use_ncurses) {
-                update_panels();
-                doupdate();
-                napms(DELAY_MS);
-            }
-            if (use_ncurses) {
-                highlight_op(ADD_ROUND_CONST_OP);
-            }
+            emit(EV_OP, ADD_ROUND_CONST_OP, 0, 0);
             round_constant(rcon, cx / NK);
-            /* Show the round constant in the window */
-            if (use_ncurses) {
-                getyx(desc_win.win, y, x);
-                mvwprintw(desc_win.win, y + 1, x, "   Add round constant");
-                update_panels();
-                doupdate();
-                for (cx2 = 0; cx2 < BPW; cx2++) {
-                    mvwprintw(desc_win.win, y + 1, 1 + (3 * cx2),
-                              "%02hhx", *(rcon + cx2));
-                    update_panels();
-                    doupdate();
-                    napms(DELAY_MS);
-                }
-                mvwprintw(desc_win.win, y + 2, 1, "-----------");
-                update_panels();
-                doupdate();
-                napms(DELAY_MS);
-            }
+            emit(EV_RCON, 0, 0, rcon);
             xor_word(temp, rcon);
         } else if (NK > 6 && (cx % NK == 4)) {
             sub_word(temp);
         }
         /* schedule[cx] = schedule[cx-NK] xor temp */
-        if (use_ncurses) {
-            highlight_op(ADD_EQUIV_KEY_OP);
-        }
-        xor_word(temp, *(schedule + cx - NK));
-        update_panels();
-        doupdate();
-        napms(DELAY_MS);
-        if (use_ncurses) {
-            highlight_op(SAVE_KEY_OP);
-        }
-        memcpy(*(schedule + cx), temp, BPW);
-        /* Update the schedule window */
-        if (use_ncurses) {
-            /* Test whether to scroll or append */
-            if (key_sched_count < key_sched_win.height - 2) {
-                key_sched_count++;
-            } else {
-                key_sched_top++;
-            }
-            update_schedule();
-            napms(DELAY_MS);
-        }
+        emit(EV_OP, ADD_EQUIV_KEY_OP, 0, 0);
+        xor_word(temp, *(ctx->schedule + cx - NK));
+        emit(EV_OP, SAVE_KEY_OP, 0, 0);
+        memcpy(*(ctx->schedule + cx), temp, BPW);
+        emit(EV_SCHED_WORD, cx, 0, temp);
     }
 }
 
 /**
  * Add a round key from the schedule
+ * ctx: context holding the state and schedule
  * round: round number, used to index into schedule
  */
-void add_round_key (unsigned int round) {
+void add_round_key (struct aes_ctx_s *ctx, unsigned int round) {
     unsigned int cx;
     unsigned int cx2;
     char key [4][4];
@@ -306,49 +180,19 @@ void add_round_key (unsigned int round) {
     for (cx = 0; cx < NB; cx++) {
         for (cx2 = 0; cx2 < BPW; cx2++) {
             /* Transpose in the process */
-            *(*(key + cx) + cx2) = *(*(schedule + (round * NB) + cx2) + cx);
+            *(*(key + cx) + cx2) = *(*(ctx->schedule + (round * NB) + cx2) + cx);
         }
     }
 
-    /* Print the round key */
-    if (use_ncurses) {
-        /* Blank the round key window */
-        for (cx = 0; cx < NB; cx++) {
-            mvwprintw(round_key_win.win, 1 + (cx * 2), 1,
-                      "           ");
-        }
-        for (cx = 0; cx < NB; cx++) {
-            for (cx2 = 0; cx2 < BPW; cx2++) {
-                mvwprintw(round_key_win.win, 1 + (cx2 * 2), 1 + (cx * 3),
-                          "%02hhx", *(*(key + cx2) + cx));
-                /* Highlight the byte in the key schedule */
-                mvwchgat(key_sched_win.win, 1, 1 + (cx2 * 3), 2,
-                         A_STANDOUT, 0, 0);
-                update_panels();
-                doupdate();
-                napms(DELAY_MS);
-            }
-            if (NB * (NR + 1) - key_sched_top <= key_sched_win.height - 2) {
-                if (key_sched_count != 0) {
-                    key_sched_count--;
-                }
-            }
-            key_sched_top++;
-            update_schedule();
-        }
-    } else {
-        printf("Round key:\n");
-        for (cx = 0; cx < NB; cx++) {
-            for (cx2 = 0; cx2 < BPW; cx2++) {
-                printf("%02hhx ", *(*(key + cx) + cx2));
-            }
-            printf("\n");
-        }
+    /* Show the round key, a schedule word per column */
+    for (cx = 0; cx < NB; cx++) {
+        emit(EV_ROUND_KEY, cx, round, *(ctx->schedule + (round * NB) + cx));
     }
 
     /* Add it to the state */
     for (cx = 0; cx < NB; cx++) {
-        xor_word(*(state + cx), *(key + cx));
+        xor_word(*(ctx->state + cx), *(key + cx));
+        emit(EV_STATE_ROW, cx, 0, *(ctx->state + cx));
     }
 }
 
@@ -358,35 +202,11 @@ void add_round_key (unsigned int round) {
 char sub_byte (char byte) {
     unsigned int row = (byte >> 4) & 0x0f;
     unsigned int col = byte & 0x0f;
-    unsigned int cx;
-    char ret = *(*(SBOX + row) + col);
 
     /* Animate the s box operation */
-    if (use_ncurses) {
-        /* Highlight the row */
-        mvwchgat(s_box_win.win, 3 + (row * 2), 4, s_box_win.width - 5,
-                 A_STANDOUT, 0, 0);
-        /* Highlight the column */
-        for (cx = 0; cx < s_box_win.height - 4; cx++) {
-            mvwchgat(s_box_win.win, 3 + cx, 4 + (3 * col), 2,
-                     A_STANDOUT, 0, 0);
-        }
-        update_panels();
-        doupdate();
-        napms(DELAY_MS * 3);
-        /* Un-highlight the row */
-        mvwchgat(s_box_win.win, 3 + (row * 2), 4, s_box_win.width - 5,
-                 A_NORMAL, 0, 0);
-        /* Un-highlight the column */
-        for (cx = 0; cx < s_box_win.height - 4; cx++) {
-            mvwchgat(s_box_win.win, 3 + cx, 4 + (3 * col), 2,
-                     A_NORMAL, 0, 0);
-        }
-        update_panels();
-        doupdate();
-    }
+    emit(EV_SBOX, row, col, 0);
 
-    return ret;
+    return *(*(SBOX + row) + col);
 }
 
 /**
@@ -397,8 +217,6 @@ char sub_byte (char byte) {
  */
 void shift_row (char *row, unsigned int amt) {
     char save;
-    int x;
-    int y;
 
     for (; amt > 0; amt--) {
         save = *row;
@@ -407,47 +225,129 @@ void shift_row (char *row, unsigned int amt) {
     }
 
     /* Display in the description */
-    if (use_ncurses) {
-        getyx(desc_win.win, y, x);
-        wprintw(desc_win.win, "  Row shift");
-        mvwprintw(desc_win.win, y + 1, 1, "-----------");
-    }
+    emit(EV_ROW_SHIFT, 0, 0, 0);
 }
 
 /**
  * Performs the column mixing
  * column multiplier: {03}x^3 + {01}x^2 + {01}x + {02}
+ * ctx: context holding the state
  * col: the column number to mix
  */
-void mix_col (unsigned int col) {
-    /* Multiplier polynomials */
-    char a0 = 0x02;
-    char a3 = 0x03;
-
+void mix_col (struct aes_ctx_s *ctx, unsigned int col) {
     /* Column polynomials */
-    char s0 = *(*(state + 0) + col);
-    char s1 = *(*(state + 1) + col);
-    char s2 = *(*(state + 2) + col);
-    char s3 = *(*(state + 3) + col);
+    unsigned char s0 = *(*(ctx->state + 0) + col);
+    unsigned char s1 = *(*(ctx->state + 1) + col);
+    unsigned char s2 = *(*(ctx->state + 2) + col);
+    unsigned char s3 = *(*(ctx->state + 3) + col);
+
+    /* Mixed column, for the event log */
+    char column [4];
+    unsigned int cx;
 
     /* New s0 */
-    *(*(state + 0) + col) = poly_mult(s0, a0)
-                          ^ poly_mult(s1, a3)
+    *(*(ctx->state + 0) + col) = *(GF_MUL_02 + s0)
+                          ^ *(GF_MUL_03 + s1)
                           ^ s2
                           ^ s3;
     /* New s1 */
-    *(*(state + 1) + col) = s0
-                          ^ poly_mult(s1, a0)
-                          ^ poly_mult(s2, a3)
+    *(*(ctx->state + 1) + col) = s0
+                          ^ *(GF_MUL_02 + s1)
+                          ^ *(GF_MUL_03 + s2)
                           ^ s3;
     /* New s2 */
-    *(*(state + 2) + col) = s0
+    *(*(ctx->state + 2) + col) = s0
                           ^ s1
-                          ^ poly_mult(s2, a0)
-                          ^ poly_mult(s3, a3);
+                          ^ *(GF_MUL_02 + s2)
+                          ^ *(GF_MUL_03 + s3);
     /* New s3 */
-    *(*(state + 3) + col) = poly_mult(s0, a3)
+    *(*(ctx->state + 3) + col) = *(GF_MUL_03 + s0)
                           ^ s1
                           ^ s2
-                          ^ poly_mult(s3, a0);
+                          ^ *(GF_MUL_02 + s3);
+
+    /* Show the new column */
+    for (cx = 0; cx < BPW; cx++) {
+        *(column + cx) = *(*(ctx->state + cx) + col);
+    }
+    emit(EV_MIX_COL, col, 0, column);
+}
+
+/**
+ * Performs an inverse s-box lookup
+ * The lookup is shown where the result sits in the forward s-box
+ * byte: byte to substitute
+ */
+char inv_sub_byte (char byte) {
+    char ret;
+
+    gen_inv_sbox();
+    ret = *(*(INV_SBOX + ((byte >> 4) & 0x0f)) + (byte & 0x0f));
+
+    /* Animate the s box operation */
+    emit(EV_SBOX, (ret >> 4) & 0x0f, ret & 0x0f, 0);
+
+    return ret;
+}
+
+/**
+ * Rotates a row to the right, undoing shift_row
+ * row: pointer to char[4]
+ * amt: number of bytes to rotate by
+ */
+void inv_shift_row (char *row, unsigned int amt) {
+    char save;
+
+    for (; amt > 0; amt--) {
+        save = *(row + BPW - 1);
+        memmove(row + 1, row, BPW - 1);
+        *row = save;
+    }
+
+    /* Display in the description */
+    emit(EV_ROW_SHIFT, 0, 0, 0);
+}
+
+/**
+ * Performs inverse mix columns on a column of the state
+ * ctx: context holding the state
+ * col: column number
+ */
+void inv_mix_col (struct aes_ctx_s *ctx, unsigned int col) {
+    /* Column polynomials */
+    unsigned char s0 = *(*(ctx->state + 0) + col);
+    unsigned char s1 = *(*(ctx->state + 1) + col);
+    unsigned char s2 = *(*(ctx->state + 2) + col);
+    unsigned char s3 = *(*(ctx->state + 3) + col);
+
+    /* Mixed column, for the event log */
+    char column [4];
+    unsigned int cx;
+
+    /* New s0 */
+    *(*(ctx->state + 0) + col) = *(GF_MUL_0E + s0)
+                          ^ *(GF_MUL_0B + s1)
+                          ^ *(GF_MUL_0D + s2)
+                          ^ *(GF_MUL_09 + s3);
+    /* New s1 */
+    *(*(ctx->state + 1) + col) = *(GF_MUL_09 + s0)
+                          ^ *(GF_MUL_0E + s1)
+                          ^ *(GF_MUL_0B + s2)
+                          ^ *(GF_MUL_0D + s3);
+    /* New s2 */
+    *(*(ctx->state + 2) + col) = *(GF_MUL_0D + s0)
+                          ^ *(GF_MUL_09 + s1)
+                          ^ *(GF_MUL_0E + s2)
+                          ^ *(GF_MUL_0B + s3);
+    /* New s3 */
+    *(*(ctx->state + 3) + col) = *(GF_MUL_0B + s0)
+                          ^ *(GF_MUL_0D + s1)
+                          ^ *(GF_MUL_09 + s2)
+                          ^ *(GF_MUL_0E + s3);
+
+    /* Show the new column */
+    for (cx = 0; cx < BPW; cx++) {
+        *(column + cx) = *(*(ctx->state + cx) + col);
+    }
+    emit(EV_MIX_COL, col, 0, column);
 }
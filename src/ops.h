@@ -1,11 +1,20 @@
 #ifndef OPS_H_20200520_200225
 #define OPS_H_20200520_200225
 
+#include "aesvars.h"
+
+char xtime (char c);
+char poly_mult (char a, char b);
+void xor_word (char *dest, char *src);
+void round_constant (char *rcon, unsigned int i);
 void str_bytes (char *dest, const char *src, unsigned int len);
-void key_expand (const char *key);
-void add_round_key (unsigned int round);
+void key_expand (struct aes_ctx_s *ctx, const char *key);
+void add_round_key (struct aes_ctx_s *ctx, unsigned int round);
 char sub_byte (char byte);
 void shift_row (char *row, unsigned int amt);
-void mix_col (unsigned int col);
+void mix_col (struct aes_ctx_s *ctx, unsigned int col);
+char inv_sub_byte (char byte);
+void inv_shift_row (char *row, unsigned int amt);
+void inv_mix_col (struct aes_ctx_s *ctx, unsigned int col);
 
 #endif /* OPS_H_20200520_200225 */
@@ -1,19 +1,55 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
 
 #include <curses.h>
 #include <panel.h>
 
 #include "aesvars.h"
+#include "events.h"
+#include "leak.h"
 #include "output_ctrl.h"
+#include "record.h"
 
 #define MAX(A,B) (((A) > (B)) ? (A) : (B))
+#define MIN(A,B) (((A) < (B)) ? (A) : (B))
 #define CURSOR_HIDE 0
+/* Longest the keyboard goes unread while waiting, in milliseconds */
+#define POLL_MS 20
+/* Shortest time between two flushes to the terminal, in milliseconds */
+#define FRAME_MS 33
+/* Size of the recorded terminal unless LINES and COLUMNS say otherwise */
+#define REC_COLS "160"
+#define REC_LINES "50"
+/* Shades of the timing heatmap, fastest to slowest */
+#define HEAT_LEVELS 5
 
 /* Control flag for using ncurses */
 int use_ncurses = 1;
-/* Milliseconds to delay for */
-const int DELAY_MS = 100;
+/* Milliseconds to delay for per animation step */
+int delay_ms = 100;
+/* Set when the replay is of a decryption, swaps the parameter labels */
+int decrypt_mode = 0;
+/**
+ * Recording the replay instead of showing it, null for none
+ * The terminal output goes to a temporary file and on into the
+ * recording, and the replay runs on a clock of its own rather than
+ * waiting
+ */
+struct rec_s *recording = 0;
+/* Terminal of the recording, ncurses writes straight to its descriptor */
+SCREEN *rec_screen;
+FILE *rec_term;
+/* Buffer the output is read back into */
+char *rec_buf;
+size_t rec_buf_size;
+/* Time the recording has got to, in milliseconds */
+long rec_clock;
+
 /* List of operations */
 const char *ops [] = {
     "Copy initial key into schedule",
@@ -26,7 +62,10 @@ const char *ops [] = {
     "Copy bytes into state",
     "Perform substitute bytes operation",
     "Perform mix columns operation",
-    "Add round key"
+    "Add round key",
+    "Perform inverse shift rows",
+    "Perform inverse substitute bytes",
+    "Perform inverse mix columns"
 };
 
 /* Key schedule window */
@@ -54,20 +93,6 @@ unsigned int key_sched_count;
 /* Column where the operations description portion begins */
 unsigned int ops_desc_off;
 
-/* Operation offsets */
-int NO_OP = -1;
-int COPY_INIT_KEY_OP = 0;
-int GET_PREV_KEY_OP = 1;
-int SHIFT_ROW_OP = 2;
-int SUB_ROW_OP = 3;
-int ADD_ROUND_CONST_OP = 4;
-int ADD_EQUIV_KEY_OP = 5;
-int SAVE_KEY_OP = 6;
-int COPY_INTO_STATE_OP = 7;
-int SUB_BYTES_OP = 8;
-int MIX_COLS_OP = 9;
-int ADD_ROUND_KEY_OP = 10;
-
 /* Backup of cursor state */
 int curs_bu;
 /* Longest operation string */
@@ -75,6 +100,81 @@ size_t max_op_len;
 /* Current highlighted operation */
 int current_op;
 
+/* State and schedule as far as the replay has got */
+struct aes_ctx_s view;
+/* Description line above the bytes of the current word substitution */
+int sub_word_y;
+
+/* Log being replayed and the parameters it was computed from */
+const struct event_log_s *replay_log;
+const char *replay_input;
+const char *replay_key;
+/* Event being replayed */
+size_t replay_pos;
+/* Events before this one are replayed without showing or waiting */
+size_t seek_to;
+/* Event the keyboard asked to jump to, -1 for none */
+long jump_to = -1;
+/* Round and schedule word the replay is in, -1 before the first */
+int replay_round;
+int replay_word;
+/* Set while the replay is paused */
+int paused;
+/* Count typed in front of a jump key */
+unsigned int key_count;
+int have_count;
+
+/* Set when the windows hold changes the terminal hasn't seen */
+int screen_dirty;
+/* When the terminal was last flushed */
+long last_flush;
+
+/* What a row of the schedule window shows */
+struct sched_row_s {
+    /* Schedule word in the row, -1 for blank */
+    int word;
+    char bytes [4];
+};
+/* Rows of the schedule window as last drawn */
+struct sched_row_s *sched_rows;
+
+/* Event of the operation last highlighted, the end of the log once done */
+long op_pos;
+
+/* Windows a snapshot keeps a copy of */
+struct window_s *snap_wins [] = {
+    &key_sched_win, &state_win, &round_key_win, &s_box_win,
+    &params_win, &ops_win, &step_win, &desc_win
+};
+#define SNAP_WINS (sizeof(snap_wins) / sizeof(*snap_wins))
+
+/**
+ * Everything the replay has drawn and worked out before an event, so
+ * seeking restores the nearest one and replays at most a round from there
+ */
+struct snap_s {
+    /* Event the snapshot was taken before */
+    size_t pos;
+    /* Set when the event starts a step, where PgUp and PgDn stop */
+    int step;
+    struct aes_ctx_s view;
+    unsigned int key_sched_top;
+    unsigned int key_sched_count;
+    int current_op;
+    int sub_word_y;
+    int replay_round;
+    int replay_word;
+    long op_pos;
+    int sbox_shown;
+    struct sched_row_s *sched_rows;
+    WINDOW *wins [SNAP_WINS];
+};
+/* Snapshots in the order of their events */
+struct snap_s *snaps;
+size_t snap_count;
+/* Snapshot to restore for each event and the end of the log */
+size_t *snap_of;
+
 /**
  * Initializes a window_s object
  * w: pointer to a window_s
@@ -164,14 +264,12 @@ void pop_ops () {
 }
 
 /**
- * ncurses initialization function
+ * Creates all the windows
  */
-void init_ncurses () {
-    initscr();
-    noecho();
-    curs_bu = curs_set(CURSOR_HIDE);
+void create_windows () {
+    char title [24];
+    unsigned int cx;
 
-    /* Create the windows */
     init_win(&key_sched_win,
              11 + 2, 0,
              COLS - (11 + 2), 0,
@@ -192,10 +290,12 @@ void init_ncurses () {
              (COLS - (50 + 2)) / 2, (LINES - (33 + 2)) / 2,
              "S-Box");
     pop_sbox_win();
+    /* Wide enough for the key, which can be longer than a block */
+    snprintf(title, sizeof(title), "AES-%u Parameters", NK * BPW * 8);
     init_win(&params_win,
-             32 + 12 + 2, 3 + 2,
+             (NK * BPW * 2) + 12 + 2, 3 + 2,
              round_key_win.x + round_key_win.width, 0,
-             "AES-128 Parameters");
+             title);
     init_win(&ops_win,
              key_sched_win.x - 1, 0,
              0, state_win.height,
@@ -220,15 +320,19 @@ void init_ncurses () {
 
     /* Show the windows, except for S-Box */
     hide_panel(s_box_win.pan);
-    update_panels();
-    doupdate();
+
+    /* The schedule window starts out blank */
+    sched_rows = malloc((key_sched_win.height - 2) * sizeof(*sched_rows));
+    for (cx = 0; cx < key_sched_win.height - 2; cx++) {
+        (sched_rows + cx)->word = -1;
+    }
 }
 
 /**
- * ncurses cleanup function
+ * Deletes all the windows
  */
-void leave_ncurses () {
-    /* Delete the windows */
+void remove_windows () {
+    free(sched_rows);
     remove_win(&desc_win);
     remove_win(&step_win);
     remove_win(&ops_win);
@@ -237,33 +341,384 @@ void leave_ncurses () {
     remove_win(&round_key_win);
     remove_win(&state_win);
     remove_win(&key_sched_win);
+}
+
+/**
+ * Adds what has been sent to the terminal since last time to the
+ * recording, if there is one
+ */
+void rec_capture () {
+    struct stat st;
+    ssize_t len;
+    char *buf;
+
+    if (!recording) {
+        return;
+    }
+    fflush(rec_term);
+    if (fstat(fileno(rec_term), &st) || st.st_size <= 0) {
+        return;
+    }
+    if ((size_t) st.st_size > rec_buf_size) {
+        buf = realloc(rec_buf, st.st_size);
+        if (!buf) {
+            recording->err = 1;
+            return;
+        }
+        rec_buf = buf;
+        rec_buf_size = st.st_size;
+    }
+    len = pread(fileno(rec_term), rec_buf, st.st_size, 0);
+    if (len < 0) {
+        recording->err = 1;
+        return;
+    }
+    rec_output(recording, rec_clock, rec_buf, len);
+
+    /* Start over so the file never holds more than one frame */
+    if (ftruncate(fileno(rec_term), 0)) {
+        recording->err = 1;
+    }
+    rewind(rec_term);
+}
+
+/**
+ * ncurses initialization function
+ * With a recording the terminal of the recorded size writes to a temporary
+ * file, which rec_capture reads back and empties after every frame
+ */
+void init_ncurses () {
+    if (recording) {
+        setenv("COLUMNS", REC_COLS, 0);
+        setenv("LINES", REC_LINES, 0);
+        rec_term = tmpfile();
+        rec_screen = rec_term ? newterm("xterm", rec_term, stdin) : 0;
+        if (!rec_screen) {
+            perror("Recording terminal");
+            exit(1);
+        }
+        rec_clock = 0;
+    } else {
+        initscr();
+    }
+    cbreak();
+    noecho();
+    /* Arrows and page keys step through the replay */
+    keypad(stdscr, TRUE);
+    curs_bu = curs_set(CURSOR_HIDE);
+    /* Keys are read from stdscr, so get its first refresh out of the way */
+    refresh();
+
+    create_windows();
+    update_panels();
+    doupdate();
+    rec_capture();
+}
+
+/**
+ * ncurses cleanup function
+ */
+void leave_ncurses () {
+    remove_windows();
 
     curs_set(curs_bu);
     endwin();
+    if (recording) {
+        rec_capture();
+        delscreen(rec_screen);
+        fclose(rec_term);
+        free(rec_buf);
+        rec_buf = 0;
+        rec_buf_size = 0;
+    }
+}
+
+/**
+ * Shows the speed and whether the replay is paused
+ * Written over the bottom border of the current step window
+ */
+void show_speed () {
+    mvwprintw(step_win.win, 2, 1, " %4d ms/step %-8s", delay_ms,
+              paused ? "paused " : "");
+}
+
+/**
+ * Shows the AES parameters being replayed
+ */
+void show_params () {
+    mvwprintw(params_win.win, 1, 1,
+              "%s %s", decrypt_mode ? "Ciphertext:" : "Plaintext: ",
+              replay_input);
+    mvwprintw(params_win.win, 2, 1,
+              "Key:        %s", replay_key);
+    mvwprintw(params_win.win, 3, 1,
+              "%s", decrypt_mode ? "Plaintext: " : "Ciphertext:");
+}
+
+/**
+ * Monotonic time in milliseconds, the recording clock when recording
+ */
+long now_ms () {
+    struct timespec ts;
+
+    if (recording) {
+        return rec_clock;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000L) + (ts.tv_nsec / 1000000L);
+}
+
+/**
+ * Sends the changed cells to the terminal, at most once per frame tick
+ * Everything drawn in between goes out together in the next flush
+ * force: nonzero to flush even if the tick isn't up yet
+ */
+void flush_frame (int force) {
+    long now;
+
+    if (!screen_dirty) {
+        return;
+    }
+    now = now_ms();
+    if (!force && now - last_flush < FRAME_MS) {
+        return;
+    }
+    update_panels();
+    doupdate();
+    rec_capture();
+    last_flush = now;
+    screen_dirty = 0;
+}
+
+/**
+ * Waits for a key for up to a number of milliseconds
+ * A recording reads no keys, its clock just moves on by the time
+ * ms: longest to wait, 0 to only check
+ * Returns the key, ERR if there was none
+ */
+int wait_key (long ms) {
+    if (recording) {
+        rec_clock += ms;
+        return ERR;
+    }
+    timeout(ms);
+    return getch();
+}
+
+/**
+ * Finds the operation next to the one last highlighted
+ * dir: 1 for the next operation, -1 for the previous one
+ * Returns the index of its event, the end of the log after the last
+ * operation, -1 if there is nowhere to go
+ */
+long find_op (int dir) {
+    const struct event_s *ev;
+    long cx;
+
+    for (cx = op_pos + dir; cx >= 0 && (size_t) cx < replay_log->count;
+         cx += dir) {
+        ev = replay_log->events + cx;
+        if (ev->type == EV_OP && (signed char) ev->a != NO_OP) {
+            return cx;
+        }
+    }
+    if (dir > 0 && (size_t) op_pos < replay_log->count) {
+        return replay_log->count;
+    }
+    return -1;
+}
+
+/**
+ * Finds the step next to the one being replayed, from the snapshots
+ * dir: 1 for the next step, -1 for the previous one
+ * Returns the index of its first event, -1 if there is none
+ */
+long find_step (int dir) {
+    long cx;
+
+    /* The step being replayed, or one past the last once done */
+    if (replay_pos >= replay_log->count) {
+        cx = snap_count;
+    } else {
+        cx = *(snap_of + replay_pos);
+        while (cx > 0 && !(snaps + cx)->step) {
+            cx--;
+        }
+    }
+
+    for (cx += dir; cx >= 0 && (size_t) cx < snap_count; cx += dir) {
+        if ((snaps + cx)->step) {
+            return (snaps + cx)->pos;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Handles a key pressed during the replay
+ *     + -          halve or double the delay
+ *     space        pause or resume
+ *     Nr           jump to round N, the next round without N
+ *     Nw           jump to key expansion word N, the next word without N
+ *     left right   pause and step back or forward an operation
+ *     PgUp PgDn    jump back or forward a step, key expansion, input,
+ *                  a round or output
+ * ch: key pressed
+ * Returns 0 if the key does nothing
+ */
+int handle_key (int ch) {
+    long target = -1;
+    int jump = 1;
+
+    /* Collect the count for a jump */
+    if (ch >= '0' && ch <= '9') {
+        if (key_count < 1000) {
+            key_count = (key_count * 10) + (ch - '0');
+        }
+        have_count = 1;
+        return 1;
+    }
+
+    switch (ch) {
+    case '+':
+    case '=':
+        delay_ms /= 2;
+        jump = 0;
+        break;
+    case '-':
+        delay_ms = delay_ms ? MIN(delay_ms * 2, DELAY_MAX) : 1;
+        jump = 0;
+        break;
+    case ' ':
+    case 'p':
+        paused = !paused;
+        jump = 0;
+        break;
+    case KEY_LEFT:
+    case KEY_RIGHT:
+        paused = 1;
+        target = find_op((ch == KEY_RIGHT) ? 1 : -1);
+        break;
+    case KEY_PPAGE:
+    case KEY_NPAGE:
+        target = find_step((ch == KEY_NPAGE) ? 1 : -1);
+        break;
+    case 'r':
+        target = event_find_round(replay_log,
+                                  have_count ? key_count
+                                  : (unsigned int) (replay_round + 1));
+        break;
+    case 'w':
+        target = event_find_word(replay_log,
+                                 have_count ? key_count
+                                 : (unsigned int) (replay_word + 1));
+        break;
+    default:
+        key_count = 0;
+        have_count = 0;
+        return 0;
+    }
+
+    if (jump && target < 0) {
+        beep();
+    } else if (target >= 0) {
+        jump_to = target;
+    }
+    key_count = 0;
+    have_count = 0;
+    show_speed();
+    screen_dirty = 1;
+    flush_frame(1);
+    return 1;
+}
+
+/**
+ * Waits for a number of animation steps, handling keys meanwhile
+ * Returns early once a jump has been asked for
+ * ticks: number of steps to wait
+ */
+void wait_ticks (int ticks) {
+    long left = (long) delay_ms * ticks;
+    long slice;
+    long due;
+    long start;
+    int ch;
+
+    if (replay_pos < seek_to) {
+        return;
+    }
+
+    /* Keys are read even without a delay so the speed can come back down */
+    ch = wait_key(0);
+    if (ch != ERR) {
+        handle_key(ch);
+    }
+    flush_frame(0);
+
+    while ((left > 0 || paused) && jump_to < 0) {
+        slice = (paused || left > POLL_MS) ? POLL_MS : left;
+        /* Wake up in time to flush the next frame */
+        if (screen_dirty) {
+            due = FRAME_MS - (now_ms() - last_flush);
+            slice = MAX(MIN(slice, due), 0);
+        }
+        start = now_ms();
+        ch = wait_key(slice);
+        if (ch != ERR) {
+            handle_key(ch);
+        }
+        if (!paused) {
+            left -= now_ms() - start;
+        }
+        flush_frame(0);
+    }
+}
+
+/**
+ * Marks the drawing done so far for the next frame, then waits
+ * While seeking nothing is shown, the windows only catch up off screen
+ * ticks: number of animation steps to wait
+ */
+void frame (int ticks) {
+    screen_dirty = 1;
+    if (replay_pos < seek_to) {
+        return;
+    }
+    wait_ticks(ticks);
 }
 
 /**
  * Used to update the key schedule display
+ * ctx: context holding the schedule
  */
-void update_schedule () {
+void update_schedule (struct aes_ctx_s *ctx) {
+    struct sched_row_s *row;
     unsigned int cx;
     unsigned int cx2;
+    int word;
 
-    /* Clear the current display */
+    /* Only redraw rows that show something else than last time */
     for (cx = 0; cx < key_sched_win.height - 2; cx++) {
-        mvwprintw(key_sched_win.win, 1 + cx, 1, "           ");
-    }
+        row = sched_rows + cx;
+        word = (cx < key_sched_count) ? (int) (key_sched_top + cx) : -1;
+        if (word == row->word
+            && (word < 0
+                || !memcmp(row->bytes, *(ctx->schedule + word), BPW))) {
+            continue;
+        }
 
-    /* Only display the number of elements requested */
-    for (cx = 0; cx < key_sched_count; cx++) {
-        for (cx2 = 0; cx2 < BPW; cx2++) {
-            mvwprintw(key_sched_win.win, 1 + cx, 1 + (cx2 * 3),
-                      "%02hhx", *(*(schedule + key_sched_top + cx) + cx2));
+        if (word < 0) {
+            mvwprintw(key_sched_win.win, 1 + cx, 1, "           ");
+        } else {
+            for (cx2 = 0; cx2 < BPW; cx2++) {
+                mvwprintw(key_sched_win.win, 1 + cx, 1 + (cx2 * 3),
+                          "%02hhx", *(*(ctx->schedule + word) + cx2));
+            }
+            memcpy(row->bytes, *(ctx->schedule + word), BPW);
         }
+        row->word = word;
     }
-    update_panels();
-    doupdate();
-    napms(DELAY_MS);
+    frame(1);
 }
 
 /**
@@ -287,8 +742,7 @@ void highlight_op (int op) {
     current_op = op;
 
     /* Show highlight */
-    update_panels();
-    doupdate();
+    frame(0);
 }
 
 /**
@@ -312,25 +766,18 @@ void update_step (const char *str) {
 
 /**
  * Updates the state window
+ * ctx: context holding the state
  */
-void update_state () {
+void update_state (struct aes_ctx_s *ctx) {
     unsigned int cx;
     unsigned int cx2;
 
-    /* Blank the state window */
-    for (cx = 0; cx < NB; cx++) {
-        mvwprintw(state_win.win, 1 + (cx * 2), 1,
-                  "           ");
-    }
-
-    /* Update the state window */
+    /* Update the state window, every byte overwrites the old one */
     for (cx = 0; cx < NB; cx++) {
         for (cx2 = 0; cx2 < BPW; cx2++) {
             mvwprintw(state_win.win, 1 + (cx2 * 2), 1 + (cx * 3),
-                      "%02hhx", *(*(state + cx2) + cx));
-            update_panels();
-            doupdate();
-            napms(DELAY_MS);
+                      "%02hhx", *(*(ctx->state + cx2) + cx));
+            frame(1);
         }
     }
 }
@@ -348,6 +795,632 @@ void clear_ops_desc () {
     }
     /* Reset cursor to top left */
     wmove(desc_win.win, 1, 1);
+    frame(0);
+}
+
+/**
+ * Writes a word on the line below the description cursor, a byte at a time
+ * word: pointer to char[4]
+ */
+void show_desc_word (const char *word) {
+    unsigned int cx;
+    int y = getcury(desc_win.win);
+
+    for (cx = 0; cx < BPW; cx++) {
+        mvwprintw(desc_win.win, y + 1, 1 + (3 * cx),
+                  "%02hhx", *(word + cx));
+        frame(1);
+    }
+}
+
+/**
+ * Shows a previous schedule word being fetched
+ * index: word index in the schedule
+ * word: pointer to char[4]
+ */
+void show_prev_word (unsigned int index, const char *word) {
+    unsigned int cx;
+
+    /* Highlight key in schedule and print in the description */
+    mvwchgat(key_sched_win.win, 1 + (index - key_sched_top), 1, 11,
+             A_STANDOUT, 0, 0);
+    for (cx = 0; cx < BPW; cx++) {
+        mvwprintw(desc_win.win, 1, 1 + (cx * 3),
+                  "%02hhx ", *(word + cx));
+        frame(1);
+    }
+    /* Un-highlight the key in schedule */
+    mvwchgat(key_sched_win.win, 1 + (index - key_sched_top), 1, 11,
+             A_NORMAL, 0, 0);
+    frame(0);
+}
+
+/**
+ * Highlights a lookup in the s-box window
+ * row: top nybble of the byte looked up
+ * col: bottom nybble of the byte looked up
+ */
+void show_sbox (unsigned int row, unsigned int col) {
+    unsigned int cx;
+
+    /* Highlight the row */
+    mvwchgat(s_box_win.win, 3 + (row * 2), 4, s_box_win.width - 5,
+             A_STANDOUT, 0, 0);
+    /* Highlight the column */
+    for (cx = 0; cx < s_box_win.height - 4; cx++) {
+        mvwchgat(s_box_win.win, 3 + cx, 4 + (3 * col), 2,
+                 A_STANDOUT, 0, 0);
+    }
+    frame(3);
+    /* Un-highlight the row */
+    mvwchgat(s_box_win.win, 3 + (row * 2), 4, s_box_win.width - 5,
+             A_NORMAL, 0, 0);
+    /* Un-highlight the column */
+    for (cx = 0; cx < s_box_win.height - 4; cx++) {
+        mvwchgat(s_box_win.win, 3 + cx, 4 + (3 * col), 2,
+                 A_NORMAL, 0, 0);
+    }
+    frame(0);
+}
+
+/**
+ * Shows the round constant being added
+ * rcon: pointer to char[4]
+ */
+void show_rcon (const char *rcon) {
+    unsigned int cx;
+    int x;
+    int y;
+
+    getyx(desc_win.win, y, x);
+    mvwprintw(desc_win.win, y + 1, x, "   Add round constant");
+    frame(0);
+    for (cx = 0; cx < BPW; cx++) {
+        mvwprintw(desc_win.win, y + 1, 1 + (3 * cx),
+                  "%02hhx", *(rcon + cx));
+        frame(1);
+    }
+    mvwprintw(desc_win.win, y + 2, 1, "-----------");
+    frame(1);
+}
+
+/**
+ * Shows a column of the round key and scrolls the schedule past its word
+ * The schedule is scrolled to the word first, so round keys can come in
+ * any order
+ * col: column of the round key
+ * round: round of the key
+ * word: pointer to char[4], the schedule word making up the column
+ */
+void show_round_key (unsigned int col, unsigned int round, const char *word) {
+    unsigned int total = NB * (NR + 1);
+    unsigned int index = (round * NB) + col;
+    unsigned int cx;
+
+    if (key_sched_top != index) {
+        key_sched_top = index;
+        key_sched_count = MIN(key_sched_win.height - 2, total - index);
+        update_schedule(&view);
+    }
+
+    /* Blank the round key window for a new key */
+    if (col == 0) {
+        for (cx = 0; cx < NB; cx++) {
+            mvwprintw(round_key_win.win, 1 + (cx * 2), 1,
+                      "           ");
+        }
+    }
+    for (cx = 0; cx < BPW; cx++) {
+        mvwprintw(round_key_win.win, 1 + (cx * 2), 1 + (col * 3),
+                  "%02hhx", *(word + cx));
+        /* Highlight the byte in the key schedule */
+        mvwchgat(key_sched_win.win, 1, 1 + (cx * 3), 2,
+                 A_STANDOUT, 0, 0);
+        frame(1);
+    }
+    key_sched_top = index + 1;
+    key_sched_count = MIN(key_sched_win.height - 2, total - key_sched_top);
+    update_schedule(&view);
+}
+
+/**
+ * Animates the input being copied into the state
+ */
+void show_input () {
+    unsigned int cx;
+    unsigned int cx2;
+
+    for (cx = 0; cx < NB; cx++) {
+        for (cx2 = 0; cx2 < BPW; cx2++) {
+            /* Put in state window */
+            mvwprintw(state_win.win, 1 + (cx2 * 2), 1 + (cx * 3),
+                      "%02hhx", *(*(view.state + cx2) + cx));
+            /* Highlight the input bytes */
+            mvwchgat(params_win.win, 1, 13 + (2 * ((cx * NB) + cx2)), 2,
+                     A_STANDOUT, 0, 0);
+            frame(1);
+        }
+    }
+    /* Un-highlight input */
+    mvwchgat(params_win.win, 1, 13, 32,
+             A_NORMAL, 0, 0);
+}
+
+/**
+ * Animates the final state being copied into the ciphertext
+ */
+void show_output () {
+    unsigned int cx;
+    unsigned int cx2;
+
+    /* Update the parameters window with the final ciphertext */
+    for (cx = 0; cx < NB; cx++) {
+        for (cx2 = 0; cx2 < BPW; cx2++) {
+            mvwprintw(params_win.win, 3, 13 + (((cx * NB) + cx2) * 2),
+                      "%02hhx", *(*(view.state + cx2) + cx));
+            /* Highlight the bytes in the state */
+            mvwchgat(state_win.win, 1 + (cx2 * 2), 1 + (cx * 3), 2,
+                     A_STANDOUT, 0, 0);
+            frame(1);
+        }
+    }
+    /* Unhighlight all the bytes in the state once done */
+    for (cx = 0; cx < NB; cx++) {
+        mvwchgat(state_win.win, 1 + (cx * 2), 1, state_win.width - 2,
+                 A_NORMAL, 0, 0);
+    }
+    frame(0);
+}
+
+/**
+ * Plays back a single event in the windows
+ * ev: event to play
+ */
+void play_event (const struct event_s *ev) {
+    char step_buf [45] = {0};
+    unsigned int cx;
+    int y;
+
+    switch (ev->type) {
+    case EV_STEP:
+        if (ev->a == STEP_ROUND) {
+            replay_round = ev->b;
+        }
+        if (ev->a == STEP_KEY_EXPANSION) {
+            update_step("Key expansion");
+        } else if (ev->a == STEP_COPY_INPUT) {
+            update_step("Copy input into state");
+        } else if (ev->a == STEP_ROUND) {
+            snprintf(step_buf, 44, "Round %u", ev->b);
+            update_step(step_buf);
+        } else {
+            update_step("Copy final state into output");
+        }
+        break;
+    case EV_OP:
+        if ((signed char) ev->a != NO_OP) {
+            op_pos = replay_pos;
+        }
+        highlight_op((signed char) ev->a);
+        break;
+    case EV_DESC_CLEAR:
+        clear_ops_desc();
+        break;
+    case EV_DESC_WORD:
+        show_desc_word(ev->v);
+        break;
+    case EV_SCHED_WORD:
+        replay_word = ev->a;
+        memcpy(*(view.schedule + ev->a), ev->v, BPW);
+        /* Test whether to scroll or append */
+        if (key_sched_count < key_sched_win.height - 2) {
+            key_sched_count++;
+        } else {
+            key_sched_top++;
+        }
+        update_schedule(&view);
+        wait_ticks(1);
+        break;
+    case EV_SCHED_SHOW:
+        key_sched_top = 0;
+        update_schedule(&view);
+        break;
+    case EV_PREV_WORD:
+        show_prev_word(ev->a, ev->v);
+        break;
+    case EV_ROW_SHIFT:
+        y = getcury(desc_win.win);
+        wprintw(desc_win.win, "  Row shift");
+        mvwprintw(desc_win.win, y + 1, 1, "-----------");
+        frame(1);
+        break;
+    case EV_SUB_BEGIN:
+        /* Describe the substitution and show the s box window */
+        sub_word_y = getcury(desc_win.win);
+        wprintw(desc_win.win, "   Byte substitution");
+        mvwprintw(desc_win.win, sub_word_y + 1, 1, "-----------");
+        show_panel(s_box_win.pan);
+        frame(1);
+        break;
+    case EV_SBOX:
+        show_sbox(ev->a, ev->b);
+        break;
+    case EV_SUB_BYTE:
+        mvwprintw(desc_win.win, sub_word_y + 2, 1 + (3 * ev->a),
+                  "%02hhx", ev->b);
+        frame(0);
+        break;
+    case EV_SUB_END:
+        /* Hide the s box window again */
+        hide_panel(s_box_win.pan);
+        frame(1);
+        break;
+    case EV_RCON:
+        show_rcon(ev->v);
+        break;
+    case EV_ROUND_KEY:
+        show_round_key(ev->a, ev->b, ev->v);
+        break;
+    case EV_STATE_ROW:
+        memcpy(*(view.state + ev->a), ev->v, BPW);
+        break;
+    case EV_MIX_COL:
+        for (cx = 0; cx < BPW; cx++) {
+            *(*(view.state + cx) + ev->a) = *(ev->v + cx);
+        }
+        wait_ticks(1);
+        break;
+    case EV_STATE_SHOW:
+        update_state(&view);
+        break;
+    case EV_INPUT:
+        show_input();
+        break;
+    case EV_OUTPUT:
+        show_output();
+        break;
+    }
+}
+
+/**
+ * Tells whether a snapshot is taken before an event, at the start of
+ * every step and every schedule word so no seek replays more than a round
+ * log: pointer to an event_log_s
+ * pos: index of the event
+ * step: set when the event starts a step
+ */
+int snap_boundary (const struct event_log_s *log, size_t pos, int *step) {
+    const struct event_s *ev = log->events + pos;
+
+    /* A round starts with clearing the description for it */
+    *step = (ev->type == EV_STEP
+             && !(pos > 0 && (ev - 1)->type == EV_DESC_CLEAR))
+            || (ev->type == EV_DESC_CLEAR && pos + 1 < log->count
+                && (ev + 1)->type == EV_STEP);
+    return *step || ev->type == EV_SCHED_WORD;
+}
+
+/**
+ * Keeps what the replay has drawn and worked out so far
+ * s: pointer to the snap_s to fill in
+ * step: set when the snapshot starts a step
+ * Returns 0, or -1 if out of memory
+ */
+int snap_take (struct snap_s *s, int step) {
+    size_t rows = (key_sched_win.height - 2) * sizeof(*sched_rows);
+    unsigned int cx;
+
+    s->pos = replay_pos;
+    s->step = step;
+    s->view = view;
+    s->key_sched_top = key_sched_top;
+    s->key_sched_count = key_sched_count;
+    s->current_op = current_op;
+    s->sub_word_y = sub_word_y;
+    s->replay_round = replay_round;
+    s->replay_word = replay_word;
+    s->op_pos = op_pos;
+    s->sbox_shown = !panel_hidden(s_box_win.pan);
+    s->sched_rows = malloc(rows);
+    if (!s->sched_rows) {
+        return -1;
+    }
+    memcpy(s->sched_rows, sched_rows, rows);
+    for (cx = 0; cx < SNAP_WINS; cx++) {
+        *(s->wins + cx) = dupwin((*(snap_wins + cx))->win);
+        if (!*(s->wins + cx)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Puts the windows and the replay back the way a snapshot has them, in
+ * time independent of how far into the log it is
+ * s: pointer to the snap_s to restore
+ */
+void snap_restore (const struct snap_s *s) {
+    WINDOW *src;
+    WINDOW *dst;
+    unsigned int cx;
+
+    replay_pos = s->pos;
+    view = s->view;
+    key_sched_top = s->key_sched_top;
+    key_sched_count = s->key_sched_count;
+    current_op = s->current_op;
+    sub_word_y = s->sub_word_y;
+    replay_round = s->replay_round;
+    replay_word = s->replay_word;
+    op_pos = s->op_pos;
+    memcpy(sched_rows, s->sched_rows,
+           (key_sched_win.height - 2) * sizeof(*sched_rows));
+    for (cx = 0; cx < SNAP_WINS; cx++) {
+        src = *(s->wins + cx);
+        dst = (*(snap_wins + cx))->win;
+        copywin(src, dst, 0, 0, 0, 0,
+                getmaxy(src) - 1, getmaxx(src) - 1, FALSE);
+        wmove(dst, getcury(src), getcurx(src));
+        touchwin(dst);
+    }
+    if (s->sbox_shown) {
+        show_panel(s_box_win.pan);
+    } else {
+        hide_panel(s_box_win.pan);
+    }
+    show_speed();
+    screen_dirty = 1;
+}
+
+/**
+ * Runs through the whole log without showing it, taking the snapshots
+ * The windows are left the way the end of the log has them
+ * log: pointer to an event_log_s
+ */
+void snap_build (const struct event_log_s *log) {
+    size_t count = 1;
+    int step;
+
+    for (replay_pos = 1; replay_pos < log->count; replay_pos++) {
+        count += snap_boundary(log, replay_pos, &step);
+    }
+    snaps = calloc(count, sizeof(*snaps));
+    snap_of = malloc((log->count + 1) * sizeof(*snap_of));
+    if (!snaps || !snap_of) {
+        endwin();
+        perror("Replay snapshots");
+        exit(1);
+    }
+
+    /* The first snapshot is of the blank windows, whatever comes first */
+    seek_to = log->count;
+    snap_count = 0;
+    for (replay_pos = 0; replay_pos < log->count; replay_pos++) {
+        if ((snap_boundary(log, replay_pos, &step) || replay_pos == 0)
+            && snap_take(snaps + snap_count++, step)) {
+            endwin();
+            perror("Replay snapshots");
+            exit(1);
+        }
+        *(snap_of + replay_pos) = snap_count - 1;
+        play_event(log->events + replay_pos);
+    }
+    *(snap_of + log->count) = snap_count - 1;
+}
+
+/**
+ * Frees the snapshots of the replay
+ */
+void snap_free () {
+    unsigned int cx;
+    size_t cx2;
+
+    for (cx2 = 0; cx2 < snap_count; cx2++) {
+        for (cx = 0; cx < SNAP_WINS; cx++) {
+            delwin(*((snaps + cx2)->wins + cx));
+        }
+        free((snaps + cx2)->sched_rows);
+    }
+    free(snaps);
+    free(snap_of);
+    snaps = 0;
+    snap_of = 0;
+    snap_count = 0;
+}
+
+/**
+ * Plays back the events of a computation in the windows
+ * The cipher has already run, so the pace is entirely up to the renderer
+ * and seeking only means restoring a snapshot and replaying the few
+ * events after it without showing them
+ * log: events recorded while the cipher ran
+ * input: plaintext shown in the parameters window
+ * key: key shown in the parameters window
+ * start: index of the first event to animate
+ */
+void replay_events (const struct event_log_s *log, const char *input,
+                    const char *key, size_t start) {
+    const struct snap_s *snap;
+    int ch;
+
+    replay_log = log;
+    replay_input = input;
+    replay_key = key;
+    replay_round = -1;
+    replay_word = -1;
+    op_pos = -1;
+    show_params();
+    show_speed();
+    snap_build(log);
+
+    jump_to = start;
+    for (;;) {
+        /* Jump where asked to, through a snapshot unless it is just ahead */
+        if (jump_to >= 0) {
+            snap = snaps + *(snap_of + jump_to);
+            if ((size_t) jump_to < replay_pos || snap->pos > replay_pos) {
+                snap_restore(snap);
+            }
+            seek_to = jump_to;
+            jump_to = -1;
+        }
+
+        if (replay_pos < log->count) {
+            play_event(log->events + replay_pos);
+            replay_pos++;
+            continue;
+        }
+
+        /* All played, the controls still step back, any other key quits */
+        op_pos = log->count;
+        flush_frame(1);
+        if (recording) {
+            break;
+        }
+        timeout(-1);
+        do {
+            ch = getch();
+        } while (handle_key(ch) && jump_to < 0);
+        if (jump_to < 0) {
+            break;
+        }
+    }
+    snap_free();
+}
+
+/**
+ * Shade of a heatmap cell, color pair 1 + level or an attribute without
+ * colors
+ */
+static const attr_t heat_attrs [HEAT_LEVELS] = {
+    A_DIM, A_NORMAL, A_NORMAL, A_BOLD, A_STANDOUT | A_BOLD
+};
+
+/**
+ * Shades the s-box window by how slow the first round lookup of each
+ * index was, and shows the numbers for the position in a side window
+ * l: timings to show
+ * pos: byte position, LEAK_ALL for all of them
+ * info: window for the numbers
+ */
+void draw_leak (const struct leak_s *l, unsigned int pos,
+                struct window_s *info) {
+    double max = 0;
+    double dev;
+    double spread;
+    double ratio;
+    unsigned int slow = 0;
+    unsigned int fast = 0;
+    unsigned int level;
+    unsigned int cx;
+
+    for (cx = 0; cx < 256; cx++) {
+        dev = leak_dev(l, pos, cx);
+        max = MAX(max, (dev < 0) ? -dev : dev);
+        slow = (dev > leak_dev(l, pos, slow)) ? cx : slow;
+        fast = (dev < leak_dev(l, pos, fast)) ? cx : fast;
+    }
+    for (cx = 0; cx < 256; cx++) {
+        dev = leak_dev(l, pos, cx);
+        level = (max > 0)
+                ? (unsigned int) (((dev / max) + 1) / 2 * (HEAT_LEVELS - 1)
+                                  + 0.5)
+                : HEAT_LEVELS / 2;
+        mvwchgat(s_box_win.win, 3 + ((cx >> 4) * 2), 4 + ((cx & 0x0f) * 3),
+                 2, has_colors() ? A_NORMAL : *(heat_attrs + level),
+                 has_colors() ? 1 + level : 0, 0);
+    }
+
+    spread = leak_spread(l, pos, &ratio);
+    werase(info->win);
+    wborder(info->win, 0, 0, 0, 0, 0, 0, 0, 0);
+    mvwprintw(info->win, 0, 1, "%s", info->title);
+    mvwprintw(info->win, 1, 1, "Target:   %s", l->target);
+    mvwprintw(info->win, 2, 1, "Samples:  %lu", l->samples);
+    mvwprintw(info->win, 3, 1, "Median:   %llu %s", l->median, l->unit);
+    if (pos == LEAK_ALL) {
+        mvwprintw(info->win, 5, 1, "Position: all");
+    } else {
+        mvwprintw(info->win, 5, 1, "Position: %u", pos);
+    }
+    mvwprintw(info->win, 6, 1, "Spread:   %.3f", spread);
+    mvwprintw(info->win, 7, 1, "Ratio:    %.2f", ratio);
+    mvwprintw(info->win, 8, 1, "Slowest:  %02x %+.3f", slow,
+              leak_dev(l, pos, slow));
+    mvwprintw(info->win, 9, 1, "Fastest:  %02x %+.3f", fast,
+              leak_dev(l, pos, fast));
+
+    /* Legend, from the fastest shade to the slowest */
+    mvwprintw(info->win, 11, 1, "Faster");
+    for (cx = 0; cx < HEAT_LEVELS; cx++) {
+        mvwprintw(info->win, 11, 8 + (cx * 3), "  ");
+        mvwchgat(info->win, 11, 8 + (cx * 3), 2,
+                 has_colors() ? A_NORMAL : *(heat_attrs + cx) | A_REVERSE,
+                 has_colors() ? 1 + cx : 0, 0);
+    }
+    mvwprintw(info->win, 11, 8 + (HEAT_LEVELS * 3), "Slower");
+    mvwprintw(info->win, 13, 1, "Ratio near 1 is noise");
+    mvwprintw(info->win, 15, 1, "Left/right: position");
+    mvwprintw(info->win, 16, 1, "a: all positions");
+    mvwprintw(info->win, 17, 1, "q: quit");
+
     update_panels();
     doupdate();
 }
+
+/**
+ * Shows the timings of a cache-timing run as a heatmap over the s-box,
+ * one byte position at a time, until q is pressed
+ * l: timings to show
+ */
+void show_leak (const struct leak_s *l) {
+    struct window_s info;
+    unsigned int pos = LEAK_ALL;
+    int ch;
+
+    initscr();
+    cbreak();
+    noecho();
+    keypad(stdscr, TRUE);
+    curs_bu = curs_set(CURSOR_HIDE);
+    refresh();
+    if (has_colors()) {
+        start_color();
+        use_default_colors();
+        init_pair(1, COLOR_BLACK, COLOR_BLUE);
+        init_pair(2, COLOR_BLACK, COLOR_CYAN);
+        init_pair(3, -1, -1);
+        init_pair(4, COLOR_BLACK, COLOR_YELLOW);
+        init_pair(5, COLOR_BLACK, COLOR_RED);
+    }
+
+    init_win(&s_box_win,
+             50 + 2, 33 + 2,
+             (COLS - (50 + 2)) / 2, (LINES - (33 + 2)) / 2,
+             "S-Box lookup timing");
+    pop_sbox_win();
+    init_win(&info,
+             30, 33 + 2,
+             MAX((int) s_box_win.x - 30, 0), s_box_win.y,
+             "Cache timing");
+
+    for (;;) {
+        draw_leak(l, pos, &info);
+        ch = getch();
+        if (ch == 'q' || ch == ERR) {
+            break;
+        } else if (ch == KEY_LEFT || ch == 'h') {
+            pos = (pos + LEAK_POSITIONS) % (LEAK_POSITIONS + 1);
+        } else if (ch == KEY_RIGHT || ch == 'l') {
+            pos = (pos + 1) % (LEAK_POSITIONS + 1);
+        } else if (ch == 'a') {
+            pos = LEAK_ALL;
+        }
+    }
+
+    remove_win(&info);
+    remove_win(&s_box_win);
+    curs_set(curs_bu);
+    endwin();
+}
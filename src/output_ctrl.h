@@ -4,6 +4,11 @@
 #include <curses.h>
 #include <panel.h>
 
+#include "aesvars.h"
+#include "events.h"
+#include "leak.h"
+#include "record.h"
+
 /* struct that defines a window and associated elements */
 struct window_s {
     WINDOW *win;
@@ -15,9 +20,14 @@ struct window_s {
     unsigned int y;
 };
 
+/* Longest delay per animation step in milliseconds */
+#define DELAY_MAX 5000
+
 extern int use_ncurses;
-extern const int DELAY_MS;
+extern int delay_ms;
+extern int decrypt_mode;
 extern const char *ops [];
+extern struct rec_s *recording;
 
 extern struct window_s key_sched_win;
 extern struct window_s state_win;
@@ -31,25 +41,15 @@ extern struct window_s desc_win;
 extern unsigned int key_sched_top;
 extern unsigned int key_sched_count;
 
-extern int NO_OP;
-extern int COPY_INIT_KEY_OP;
-extern int GET_PREV_KEY_OP;
-extern int SHIFT_ROW_OP;
-extern int SUB_ROW_OP;
-extern int ADD_ROUND_CONST_OP;
-extern int ADD_EQUIV_KEY_OP;
-extern int SAVE_KEY_OP;
-extern int COPY_INTO_STATE_OP;
-extern int SUB_BYTES_OP;
-extern int MIX_COLS_OP;
-extern int ADD_ROUND_KEY_OP;
-
 void init_ncurses ();
 void leave_ncurses ();
-void update_schedule ();
+void update_schedule (struct aes_ctx_s *ctx);
 void highlight_op (int op);
 void update_step (const char *str);
-void update_state ();
+void update_state (struct aes_ctx_s *ctx);
 void clear_ops_desc ();
+void replay_events (const struct event_log_s *log, const char *input,
+                    const char *key, size_t start);
+void show_leak (const struct leak_s *l);
 
 #endif /* OUTPUT_CTRL_H_20200528_224855 */
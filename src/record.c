@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "record.h"
+
+/**
+ * Starts a recording, writing the header line
+ * r: recording to set up
+ * out: stream the recording goes to, left open by rec_close
+ * width: columns of the recorded terminal
+ * height: lines of the recorded terminal
+ * Returns 0 on success, -1 if the header could not be written
+ */
+int rec_open (struct rec_s *r, FILE *out, unsigned int width,
+              unsigned int height) {
+    r->out = out;
+    r->err = fprintf(out, "{\"version\": 2, \"width\": %u, \"height\": %u, "
+                     "\"timestamp\": %ld, \"env\": {\"TERM\": \"xterm\"}}\n",
+                     width, height, (long) time(0)) < 0;
+    return r->err ? -1 : 0;
+}
+
+/**
+ * Adds what was written to the terminal as one output event
+ * Everything that isn't printable ASCII is escaped, so the file stays
+ * valid JSON whatever the terminal was sent
+ * r: recording to add to
+ * ms: time of the output since the start, in milliseconds
+ * data: bytes written to the terminal
+ * len: number of bytes
+ */
+void rec_output (struct rec_s *r, long ms, const char *data, size_t len) {
+    unsigned char c;
+    size_t cx;
+
+    if (!len) {
+        return;
+    }
+    fprintf(r->out, "[%ld.%03ld, \"o\", \"", ms / 1000, ms % 1000);
+    for (cx = 0; cx < len; cx++) {
+        c = *(data + cx);
+        if (c == '"' || c == '\\') {
+            fputc('\\', r->out);
+            fputc(c, r->out);
+        } else if (c < 0x20 || c >= 0x7f) {
+            fprintf(r->out, "\\u%04x", c);
+        } else {
+            fputc(c, r->out);
+        }
+    }
+    if (fputs("\"]\n", r->out) < 0) {
+        r->err = 1;
+    }
+}
+
+/**
+ * Finishes a recording
+ * Returns 0 on success, -1 if anything could not be written
+ */
+int rec_close (struct rec_s *r) {
+    if (ferror(r->out) || fflush(r->out)) {
+        r->err = 1;
+    }
+    return r->err ? -1 : 0;
+}
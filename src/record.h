@@ -0,0 +1,19 @@
+#ifndef RECORD_H_20261017_203856
+#define RECORD_H_20261017_203856
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* An asciicast v2 recording being written */
+struct rec_s {
+    FILE *out;
+    /* Set once a write has failed */
+    int err;
+};
+
+int rec_open (struct rec_s *r, FILE *out, unsigned int width,
+              unsigned int height);
+void rec_output (struct rec_s *r, long ms, const char *data, size_t len);
+int rec_close (struct rec_s *r);
+
+#endif /* RECORD_H_20261017_203856 */
@@ -0,0 +1,124 @@
+#include <stdio.h>
+
+#include "stats.h"
+
+#ifdef AES_STATS
+
+/* Names of the stages in reports */
+static const char *stage_names[] = {
+    "key_expand",
+    "sub_bytes",
+    "shift_rows",
+    "mix_columns",
+    "add_round_key",
+    "inv_shift_rows",
+    "inv_sub_bytes",
+    "inv_mix_columns",
+    "engine_expand",
+    "engine_blocks"
+};
+
+unsigned long long stats_t0;
+
+/* Time and calls of every stage by round, whole runs go in round 0 */
+static unsigned long long ticks [STATS_STAGES][STATS_ROUNDS];
+static unsigned long calls [STATS_STAGES][STATS_ROUNDS];
+
+/* Unit of the counters */
+#ifdef STATS_TSC
+static const char unit[] = "cycles";
+#else
+static const char unit[] = "ns";
+#endif
+
+/**
+ * Adds one timed call to a stage
+ * stage: stage timed
+ * round: round it belongs to, 0 for stages outside the rounds
+ * t: time it took, in the unit of the counters
+ */
+void stats_add (enum stats_stage_e stage, unsigned int round,
+                unsigned long long t) {
+    if (round >= STATS_ROUNDS) {
+        round = STATS_ROUNDS - 1;
+    }
+    *(*(ticks + stage) + round) += t;
+    *(*(calls + stage) + round) += 1;
+}
+
+/**
+ * Prints the totals of every stage that ran, then the stages of the
+ * round loop round by round
+ * out: stream to print to
+ * Returns 0, or -1 if the counters were compiled out
+ */
+int stats_print (FILE *out) {
+    unsigned long long total [STATS_STAGES] = {0};
+    unsigned long count [STATS_STAGES] = {0};
+    unsigned int last_round = 0;
+    unsigned int stage;
+    unsigned int round;
+
+    for (stage = 0; stage < STATS_STAGES; stage++) {
+        for (round = 0; round < STATS_ROUNDS; round++) {
+            *(total + stage) += *(*(ticks + stage) + round);
+            *(count + stage) += *(*(calls + stage) + round);
+            if (stage > STATS_KEY_EXPAND && stage < STATS_ENGINE_EXPAND
+                && *(*(calls + stage) + round) && round > last_round) {
+                last_round = round;
+            }
+        }
+    }
+
+    fprintf(out, "%-16s %12s %16s %16s\n", "Stage", "Calls", unit,
+            "per call");
+    for (stage = 0; stage < STATS_STAGES; stage++) {
+        if (*(count + stage)) {
+            fprintf(out, "%-16s %12lu %16llu %16.1f\n",
+                    *(stage_names + stage), *(count + stage),
+                    *(total + stage),
+                    (double) *(total + stage) / *(count + stage));
+        }
+    }
+
+    /* Only the stages of the round loop have rounds */
+    if (!last_round) {
+        return 0;
+    }
+    fprintf(out, "\nPer round, %s\n%-5s", unit, "Round");
+    for (stage = STATS_SUB_BYTES; stage < STATS_ENGINE_EXPAND; stage++) {
+        if (*(count + stage)) {
+            fprintf(out, " %16s", *(stage_names + stage));
+        }
+    }
+    fprintf(out, "\n");
+    for (round = 0; round <= last_round; round++) {
+        fprintf(out, "%5u", round);
+        for (stage = STATS_SUB_BYTES; stage < STATS_ENGINE_EXPAND;
+             stage++) {
+            if (!*(count + stage)) {
+                continue;
+            }
+            if (*(*(calls + stage) + round)) {
+                fprintf(out, " %16llu", *(*(ticks + stage) + round));
+            } else {
+                fprintf(out, " %16s", "-");
+            }
+        }
+        fprintf(out, "\n");
+    }
+    return 0;
+}
+
+#else
+
+/**
+ * Stands in for the counters in builds without them
+ * Returns -1, there is nothing to print
+ */
+int stats_print (FILE *out) {
+    (void) out;
+    return -1;
+}
+
+#endif /* AES_STATS */
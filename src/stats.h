@@ -0,0 +1,74 @@
+#ifndef STATS_H_20261017_194210
+#define STATS_H_20261017_194210
+
+#include <stdio.h>
+
+/* Stages counted, in the order they are reported */
+enum stats_stage_e {
+    STATS_KEY_EXPAND,
+    STATS_SUB_BYTES,
+    STATS_SHIFT_ROWS,
+    STATS_MIX_COLS,
+    STATS_ADD_ROUND_KEY,
+    STATS_INV_SHIFT_ROWS,
+    STATS_INV_SUB_BYTES,
+    STATS_INV_MIX_COLS,
+    /* Schedules expanded by an engine, through the key cache */
+    STATS_ENGINE_EXPAND,
+    /* Blocks run through an engine by batch and single block runs */
+    STATS_ENGINE_BLOCKS,
+    STATS_STAGES
+};
+
+/* Rounds counted separately, room for AES-256 */
+#define STATS_ROUNDS 15
+
+/**
+ * The counters only exist in builds with AES_STATS defined, make STATS=1,
+ * everywhere else the macros below leave nothing behind
+ */
+#ifdef AES_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define STATS_TSC 1
+#else
+#include <time.h>
+#endif
+
+/* Start of the stage being timed, stages never nest */
+extern unsigned long long stats_t0;
+
+/**
+ * Time stamp counter, or nanoseconds where there is none
+ */
+static inline unsigned long long stats_now () {
+#ifdef STATS_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void stats_add (enum stats_stage_e stage, unsigned int round,
+                unsigned long long t);
+
+/* Starts timing a stage */
+#define STATS_BEGIN() (stats_t0 = stats_now())
+/* Adds the time since STATS_BEGIN to a stage of a round */
+#define STATS_END(stage, round) \
+    stats_add((stage), (round), stats_now() - stats_t0)
+
+#else
+
+#define STATS_BEGIN()
+#define STATS_END(stage, round)
+
+#endif /* AES_STATS */
+
+int stats_print (FILE *out);
+
+#endif /* STATS_H_20261017_194210 */
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesvars.h"
+#include "cipher.h"
+#include "hex.h"
+#include "trace.h"
+
+/* Bytes buffered before they are written out */
+#define TRACE_BUF_SIZE (1 << 20)
+/* Most a single call adds to the buffer, a whole AES-256 schedule */
+#define TRACE_ENTRY_MAX 1024
+
+/* Headings of the text format, by stage */
+static const char *headings[] = {
+    "State:",
+    "After S-Box:",
+    "After Row Shifts:",
+    "After Mix Columns:",
+    "Round key:",
+    "After Inv Row Shifts:",
+    "After Inv S-Box:",
+    "After Inv Mix Columns:",
+    "Final State:"
+};
+
+/* Stage names of the JSON format */
+static const char *stage_names[] = {
+    "state",
+    "sub_bytes",
+    "shift_rows",
+    "mix_columns",
+    "round_key",
+    "inv_shift_rows",
+    "inv_sub_bytes",
+    "inv_mix_columns",
+    "final"
+};
+
+/**
+ * Parses a trace format name
+ * str: one of text, json or binary
+ * Returns the format, TRACE_NONE if the name is unknown
+ */
+enum trace_fmt_e trace_fmt_from_str (const char *str) {
+    if (!strcmp(str, "text")) {
+        return TRACE_TEXT;
+    } else if (!strcmp(str, "json")) {
+        return TRACE_JSON;
+    } else if (!strcmp(str, "binary")) {
+        return TRACE_BINARY;
+    }
+    return TRACE_NONE;
+}
+
+/**
+ * Writes out what has been buffered
+ */
+static void trace_flush (struct trace_s *t) {
+    if (t->len && fwrite(t->buf, 1, t->len, t->out) != t->len) {
+        t->err = 1;
+    }
+    t->len = 0;
+}
+
+/**
+ * Makes room for one entry
+ * Returns where the entry goes, the caller adds what it wrote to t->len
+ */
+static char *trace_reserve (struct trace_s *t) {
+    if (t->len + TRACE_ENTRY_MAX > TRACE_BUF_SIZE) {
+        trace_flush(t);
+    }
+    return t->buf + t->len;
+}
+
+/**
+ * Copies the state out column by column, the order of the input bytes
+ * dst: pointer to unsigned char[BLOCK_SIZE]
+ * state: pointer to char[BLOCK_SIZE], row by row
+ */
+static void state_bytes (unsigned char *dst, const char *state) {
+    unsigned int cx;
+    unsigned int cx2;
+
+    for (cx = 0; cx < NB; cx++) {
+        for (cx2 = 0; cx2 < BPW; cx2++) {
+            *(dst + (cx * BPW) + cx2) = *(state + (cx2 * NB) + cx);
+        }
+    }
+}
+
+/**
+ * Starts a trace
+ * t: trace to set up
+ * out: stream the trace goes to, left open by trace_close
+ * fmt: format to write
+ * Returns 0 on success, -1 if the buffer could not be allocated
+ */
+int trace_open (struct trace_s *t, FILE *out, enum trace_fmt_e fmt) {
+    t->buf = malloc(TRACE_BUF_SIZE);
+    if (!t->buf) {
+        return -1;
+    }
+    t->out = out;
+    t->fmt = fmt;
+    t->len = 0;
+    t->block = 0;
+    t->round = 0;
+    t->err = 0;
+    return 0;
+}
+
+/**
+ * Writes out the rest of a trace and frees its buffer
+ * Returns 0 on success, -1 if anything could not be written
+ */
+int trace_close (struct trace_s *t) {
+    trace_flush(t);
+    if (fflush(t->out)) {
+        t->err = 1;
+    }
+    free(t->buf);
+    t->buf = 0;
+    return t->err ? -1 : 0;
+}
+
+/**
+ * Traces the key schedule, one word per line
+ * Only the text and JSON formats have it, the binary one has the round
+ * keys as they are added
+ * t: trace to write to, null for none
+ * ctx: context holding the expanded schedule
+ */
+void trace_schedule (struct trace_s *t, const struct aes_ctx_s *ctx) {
+    unsigned int words = NB * (NR + 1);
+    unsigned int cx;
+    char *p;
+
+    if (!t || t->fmt == TRACE_BINARY) {
+        return;
+    }
+    p = trace_reserve(t);
+    if (t->fmt == TRACE_TEXT) {
+        p += sprintf(p, "Key schedule:\n");
+        for (cx = 0; cx < words; cx++, p += BPW * 2 + 1) {
+            hex_encode(p, (const unsigned char *) *(ctx->schedule + cx), BPW);
+            *(p + (BPW * 2)) = '\n';
+        }
+    } else {
+        p += sprintf(p, "{\"block\":%lu,\"schedule\":[", t->block);
+        for (cx = 0; cx < words; cx++, p += BPW * 2 + 3) {
+            *p = '"';
+            hex_encode(p + 1, (const unsigned char *) *(ctx->schedule + cx),
+                       BPW);
+            *(p + (BPW * 2) + 1) = '"';
+            *(p + (BPW * 2) + 2) = (cx + 1 < words) ? ',' : ']';
+        }
+        p += sprintf(p, "}\n");
+    }
+    t->len = p - t->buf;
+}
+
+/**
+ * Starts a round, the records that follow belong to it
+ * t: trace to write to, null for none
+ * round: round number
+ */
+void trace_round (struct trace_s *t, unsigned int round) {
+    if (!t) {
+        return;
+    }
+    t->round = round;
+    if (t->fmt == TRACE_TEXT) {
+        t->len += sprintf(trace_reserve(t), "Round %u\n========\n", round);
+    }
+}
+
+/**
+ * Traces a state
+ * t: trace to write to, null for none
+ * stage: what the state is
+ * state: pointer to char[BLOCK_SIZE], the state row by row
+ */
+void trace_state (struct trace_s *t, enum trace_stage_e stage,
+                  const char *state) {
+    struct trace_record_s rec;
+    unsigned char bytes [BLOCK_SIZE];
+    unsigned int cx;
+    unsigned int cx2;
+    char *p;
+
+    if (!t) {
+        return;
+    }
+    p = trace_reserve(t);
+    switch (t->fmt) {
+    case TRACE_TEXT:
+        p += sprintf(p, "%s\n", *(headings + stage));
+        for (cx = 0; cx < NB; cx++) {
+            for (cx2 = 0; cx2 < BPW; cx2++, p += 3) {
+                hex_encode(p, (const unsigned char *) state + (cx * NB) + cx2,
+                           1);
+                *(p + 2) = ' ';
+            }
+            *p++ = '\n';
+        }
+        break;
+    case TRACE_JSON:
+        state_bytes(bytes, state);
+        p += sprintf(p, "{\"block\":%lu,\"round\":%u,\"stage\":\"%s\","
+                     "\"state\":\"", t->block, t->round,
+                     *(stage_names + stage));
+        hex_encode(p, bytes, BLOCK_SIZE);
+        p += BLOCK_SIZE * 2;
+        p += sprintf(p, "\"}\n");
+        break;
+    default:
+        for (cx = 0; cx < sizeof(rec.block); cx++) {
+            *(rec.block + cx) = (unsigned char) (t->block >> (cx * 8));
+        }
+        rec.round = t->round;
+        rec.stage = stage;
+        memset(rec.reserved, 0, sizeof(rec.reserved));
+        state_bytes(rec.state, state);
+        memcpy(p, &rec, sizeof(rec));
+        p += sizeof(rec);
+        break;
+    }
+    t->len = p - t->buf;
+}
+
+/**
+ * Traces a round key the way it is added to the state
+ * t: trace to write to, null for none
+ * ctx: context holding the schedule
+ * key_round: round of the key in the schedule
+ */
+void trace_round_key (struct trace_s *t, const struct aes_ctx_s *ctx,
+                      unsigned int key_round) {
+    char key [BLOCK_SIZE];
+    unsigned int cx;
+    unsigned int cx2;
+
+    if (!t) {
+        return;
+    }
+    /* Words of the schedule are columns of the state */
+    for (cx = 0; cx < NB; cx++) {
+        for (cx2 = 0; cx2 < BPW; cx2++) {
+            *(key + (cx * NB) + cx2) = *(*(ctx->schedule + (key_round * NB)
+                                           + cx2) + cx);
+        }
+    }
+    trace_state(t, TRACE_ROUND_KEY, key);
+}
+
+/**
+ * Ends a round or the final state, a blank line in the text format
+ * t: trace to write to, null for none
+ */
+void trace_end (struct trace_s *t) {
+    if (t && t->fmt == TRACE_TEXT) {
+        *trace_reserve(t) = '\n';
+        t->len++;
+    }
+}
+
+/**
+ * Traces the result of a block and moves on to the next block
+ * t: trace to write to, null for none
+ * input: hex string of the input block
+ * key: hex string of the key
+ * ctx: context holding the final state
+ * decrypt: nonzero if the block was decrypted
+ */
+void trace_result (struct trace_s *t, const char *input, const char *key,
+                   const struct aes_ctx_s *ctx, int decrypt) {
+    unsigned char bytes [BLOCK_SIZE];
+    char *p;
+
+    if (!t) {
+        return;
+    }
+    state_bytes(bytes, *ctx->state);
+    p = trace_reserve(t);
+    if (t->fmt == TRACE_TEXT) {
+        p += sprintf(p, "%s %s\nKey:        %s\n%s ",
+                     decrypt ? "Ciphertext:" : "Plaintext: ", input, key,
+                     decrypt ? "Plaintext: " : "Ciphertext:");
+        hex_encode(p, bytes, BLOCK_SIZE);
+        p += BLOCK_SIZE * 2;
+        *p++ = '\n';
+    } else if (t->fmt == TRACE_JSON) {
+        p += sprintf(p, "{\"block\":%lu,\"input\":\"%s\",\"key\":\"%s\","
+                     "\"output\":\"", t->block, input, key);
+        hex_encode(p, bytes, BLOCK_SIZE);
+        p += BLOCK_SIZE * 2;
+        p += sprintf(p, "\"}\n");
+    }
+    t->len = p - t->buf;
+    t->block++;
+}
@@ -0,0 +1,79 @@
+#ifndef TRACE_H_20261017_174405
+#define TRACE_H_20261017_174405
+
+#include <stdio.h>
+
+#include "aesvars.h"
+
+/* Formats the headless trace is written in */
+enum trace_fmt_e {
+    TRACE_NONE = 0,
+    /* The human readable dump */
+    TRACE_TEXT,
+    /* One JSON object per line */
+    TRACE_JSON,
+    /* One trace_record_s per state, nothing else */
+    TRACE_BINARY
+};
+
+/**
+ * What a traced state is, the stage field of the records
+ * The values are part of the binary format, only ever append
+ */
+enum trace_stage_e {
+    /* State at the start of a round */
+    TRACE_START,
+    TRACE_SUB_BYTES,
+    TRACE_SHIFT_ROWS,
+    TRACE_MIX_COLS,
+    /* Round key added at the end of the round, laid out like the state */
+    TRACE_ROUND_KEY,
+    TRACE_INV_SHIFT_ROWS,
+    TRACE_INV_SUB_BYTES,
+    TRACE_INV_MIX_COLS,
+    /* State after the last round */
+    TRACE_FINAL
+};
+
+/**
+ * Record of the binary format, 20 bytes without padding
+ * block: block number from 0, little endian
+ * round: round the state belongs to
+ * stage: trace_stage_e
+ * state: the 16 bytes in input order, column by column
+ */
+struct trace_record_s {
+    unsigned char block [4];
+    unsigned char round;
+    unsigned char stage;
+    unsigned char reserved [2];
+    unsigned char state [16];
+};
+
+/* A trace being written, formatted into one large buffer */
+struct trace_s {
+    FILE *out;
+    enum trace_fmt_e fmt;
+    char *buf;
+    size_t len;
+    /* Block and round the next records belong to */
+    unsigned long block;
+    unsigned int round;
+    /* Set once a write has failed */
+    int err;
+};
+
+enum trace_fmt_e trace_fmt_from_str (const char *str);
+int trace_open (struct trace_s *t, FILE *out, enum trace_fmt_e fmt);
+int trace_close (struct trace_s *t);
+void trace_schedule (struct trace_s *t, const struct aes_ctx_s *ctx);
+void trace_round (struct trace_s *t, unsigned int round);
+void trace_state (struct trace_s *t, enum trace_stage_e stage,
+                  const char *state);
+void trace_round_key (struct trace_s *t, const struct aes_ctx_s *ctx,
+                      unsigned int key_round);
+void trace_end (struct trace_s *t);
+void trace_result (struct trace_s *t, const char *input, const char *key,
+                   const struct aes_ctx_s *ctx, int decrypt);
+
+#endif /* TRACE_H_20261017_174405 */
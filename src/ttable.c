@@ -0,0 +1,152 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aesvars.h"
+#include "cipher.h"
+#include "ttable.h"
+
+/* Load a column word, row 0 in the lowest byte */
+#define LOAD32(P) ((uint32_t) *(P) \
+                 | ((uint32_t) *((P) + 1) << 8) \
+                 | ((uint32_t) *((P) + 2) << 16) \
+                 | ((uint32_t) *((P) + 3) << 24))
+/* Store a column word, row 0 from the lowest byte */
+#define STORE32(P,W) do { \
+        *(P) = (unsigned char) (W); \
+        *((P) + 1) = (unsigned char) ((W) >> 8); \
+        *((P) + 2) = (unsigned char) ((W) >> 16); \
+        *((P) + 3) = (unsigned char) ((W) >> 24); \
+    } while (0)
+#define ROTL32(W,N) (((W) << (N)) | ((W) >> (32 - (N))))
+/* Multiplication by x in the finite field on a byte held in a word */
+#define XTIME32(S) ((((S) << 1) ^ (((S) & 0x80) ? 0x1b : 0x00)) & 0xff)
+
+/**
+ * Combined substitute bytes, shift rows and mix columns tables
+ * te0[x] is the column {02}s, s, s, {03}s for s = SBOX[x], te1..te3 are
+ * the same column rotated down by one to three rows
+ */
+static uint32_t te0 [256];
+static uint32_t te1 [256];
+static uint32_t te2 [256];
+static uint32_t te3 [256];
+/* The s-box flattened for the last round */
+static uint32_t sbox [256];
+
+/**
+ * The same for the equivalent inverse cipher
+ * td0[x] is the column {0e}s, {09}s, {0d}s, {0b}s for s = INV_SBOX[x]
+ */
+static uint32_t td0 [256];
+static uint32_t td1 [256];
+static uint32_t td2 [256];
+static uint32_t td3 [256];
+/* The inverse s-box flattened for the last round */
+static uint32_t inv_sbox [256];
+
+/**
+ * Generates the tables from the s-box
+ * Returns 0, the tables are always available
+ */
+static int ttable_setup () {
+    static int done = 0;
+    unsigned int cx;
+    uint32_t s;
+    uint32_t s2;
+    uint32_t s4;
+    uint32_t s8;
+
+    if (done) {
+        return 0;
+    }
+    gen_inv_sbox();
+    for (cx = 0; cx < 256; cx++) {
+        s = (unsigned char) *(*(SBOX + (cx >> 4)) + (cx & 0x0f));
+        s2 = XTIME32(s);
+
+        *(sbox + cx) = s;
+        *(te0 + cx) = s2 | (s << 8) | (s << 16) | ((s2 ^ s) << 24);
+        *(te1 + cx) = ROTL32(*(te0 + cx), 8);
+        *(te2 + cx) = ROTL32(*(te0 + cx), 16);
+        *(te3 + cx) = ROTL32(*(te0 + cx), 24);
+
+        s = (unsigned char) *(*(INV_SBOX + (cx >> 4)) + (cx & 0x0f));
+        s2 = XTIME32(s);
+        s4 = XTIME32(s2);
+        s8 = XTIME32(s4);
+
+        *(inv_sbox + cx) = s;
+        *(td0 + cx) = (s8 ^ s4 ^ s2) | ((s8 ^ s) << 8)
+                    | ((s8 ^ s4 ^ s) << 16) | ((s8 ^ s2 ^ s) << 24);
+        *(td1 + cx) = ROTL32(*(td0 + cx), 8);
+        *(td2 + cx) = ROTL32(*(td0 + cx), 16);
+        *(td3 + cx) = ROTL32(*(td0 + cx), 24);
+    }
+    done = 1;
+    return 0;
+}
+
+/* Encryption and decryption written out for every key size */
+#define TT_NR 10
+#define TT_NAME(N) N ## _128
+#include "ttable_kern.h"
+#undef TT_NAME
+#undef TT_NR
+
+#define TT_NR 12
+#define TT_NAME(N) N ## _192
+#include "ttable_kern.h"
+#undef TT_NAME
+#undef TT_NR
+
+#define TT_NR 14
+#define TT_NAME(N) N ## _256
+#include "ttable_kern.h"
+#undef TT_NAME
+#undef TT_NR
+
+/**
+ * Encrypts blocks with the code for the key size of the schedule
+ */
+static void ttable_encrypt (const struct aes_ctx_s *ctx, unsigned char *out,
+                            const unsigned char *in, size_t blocks) {
+    switch (ctx->nr) {
+    case 12:
+        ttable_enc_192(CTX_SCHED(ctx), out, in, blocks);
+        break;
+    case 14:
+        ttable_enc_256(CTX_SCHED(ctx), out, in, blocks);
+        break;
+    default:
+        ttable_enc_128(CTX_SCHED(ctx), out, in, blocks);
+        break;
+    }
+}
+
+/**
+ * Decrypts blocks with the code for the key size of the schedule
+ */
+static void ttable_decrypt (const struct aes_ctx_s *ctx, unsigned char *out,
+                            const unsigned char *in, size_t blocks) {
+    switch (ctx->nr) {
+    case 12:
+        ttable_dec_192(CTX_DEC_SCHED(ctx), out, in, blocks);
+        break;
+    case 14:
+        ttable_dec_256(CTX_DEC_SCHED(ctx), out, in, blocks);
+        break;
+    default:
+        ttable_dec_128(CTX_DEC_SCHED(ctx), out, in, blocks);
+        break;
+    }
+}
+
+/* Table driven engine */
+const struct engine_s ttable_engine = {
+    "ttable",
+    ttable_setup,
+    expand_key,
+    ttable_encrypt,
+    expand_dec_key,
+    ttable_decrypt
+};
@@ -0,0 +1,8 @@
+#ifndef TTABLE_H_20261017_101542
+#define TTABLE_H_20261017_101542
+
+#include "cipher.h"
+
+extern const struct engine_s ttable_engine;
+
+#endif /* TTABLE_H_20261017_101542 */
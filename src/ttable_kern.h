@@ -0,0 +1,138 @@
+/**
+ * T-table encryption and decryption, included by ttable.c once per key
+ * size
+ * The includer defines TT_NR (number of rounds as a literal) and TT_NAME
+ * (suffix for every name defined here). Every round is written out, so
+ * nothing loops over rounds or looks at the key size
+ */
+
+#define ttable_enc TT_NAME(ttable_enc)
+#define ttable_dec TT_NAME(ttable_dec)
+
+/* Full encryption round R, row r of column c comes from column c + r */
+#define ENC_ROUND(R) \
+    t0 = *(te0 + (s0 & 0xff)) ^ *(te1 + ((s1 >> 8) & 0xff)) \
+       ^ *(te2 + ((s2 >> 16) & 0xff)) ^ *(te3 + (s3 >> 24)) \
+       ^ LOAD32(sched + ((R) * BLOCK_SIZE)); \
+    t1 = *(te0 + (s1 & 0xff)) ^ *(te1 + ((s2 >> 8) & 0xff)) \
+       ^ *(te2 + ((s3 >> 16) & 0xff)) ^ *(te3 + (s0 >> 24)) \
+       ^ LOAD32(sched + ((R) * BLOCK_SIZE) + 4); \
+    t2 = *(te0 + (s2 & 0xff)) ^ *(te1 + ((s3 >> 8) & 0xff)) \
+       ^ *(te2 + ((s0 >> 16) & 0xff)) ^ *(te3 + (s1 >> 24)) \
+       ^ LOAD32(sched + ((R) * BLOCK_SIZE) + 8); \
+    t3 = *(te0 + (s3 & 0xff)) ^ *(te1 + ((s0 >> 8) & 0xff)) \
+       ^ *(te2 + ((s1 >> 16) & 0xff)) ^ *(te3 + (s2 >> 24)) \
+       ^ LOAD32(sched + ((R) * BLOCK_SIZE) + 12); \
+    s0 = t0; \
+    s1 = t1; \
+    s2 = t2; \
+    s3 = t3;
+
+/* Full decryption round R, row r of column c comes from column c - r */
+#define DEC_ROUND(R) \
+    t0 = *(td0 + (s0 & 0xff)) ^ *(td1 + ((s3 >> 8) & 0xff)) \
+       ^ *(td2 + ((s2 >> 16) & 0xff)) ^ *(td3 + (s1 >> 24)) \
+       ^ LOAD32(dec + ((R) * BLOCK_SIZE)); \
+    t1 = *(td0 + (s1 & 0xff)) ^ *(td1 + ((s0 >> 8) & 0xff)) \
+       ^ *(td2 + ((s3 >> 16) & 0xff)) ^ *(td3 + (s2 >> 24)) \
+       ^ LOAD32(dec + ((R) * BLOCK_SIZE) + 4); \
+    t2 = *(td0 + (s2 & 0xff)) ^ *(td1 + ((s1 >> 8) & 0xff)) \
+       ^ *(td2 + ((s0 >> 16) & 0xff)) ^ *(td3 + (s3 >> 24)) \
+       ^ LOAD32(dec + ((R) * BLOCK_SIZE) + 8); \
+    t3 = *(td0 + (s3 & 0xff)) ^ *(td1 + ((s2 >> 8) & 0xff)) \
+       ^ *(td2 + ((s1 >> 16) & 0xff)) ^ *(td3 + (s0 >> 24)) \
+       ^ LOAD32(dec + ((R) * BLOCK_SIZE) + 12); \
+    s0 = t0; \
+    s1 = t1; \
+    s2 = t2; \
+    s3 = t3;
+
+/**
+ * Encrypts blocks with 16 table lookups per round
+ * sched: pointer to unsigned char[(TT_NR + 1) * BLOCK_SIZE]
+ * out: pointer to unsigned char[blocks * BLOCK_SIZE], may equal in
+ * in: pointer to unsigned char[blocks * BLOCK_SIZE]
+ * blocks: number of blocks
+ */
+static void ttable_enc (const unsigned char *sched, unsigned char *out,
+                        const unsigned char *in, size_t blocks) {
+    const unsigned char *rk = sched + (TT_NR * BLOCK_SIZE);
+    uint32_t s0, s1, s2, s3;
+    uint32_t t0, t1, t2, t3;
+
+    for (; blocks > 0; blocks--, in += BLOCK_SIZE, out += BLOCK_SIZE) {
+        /* Round 0 only adds key */
+        s0 = LOAD32(in) ^ LOAD32(sched);
+        s1 = LOAD32(in + 4) ^ LOAD32(sched + 4);
+        s2 = LOAD32(in + 8) ^ LOAD32(sched + 8);
+        s3 = LOAD32(in + 12) ^ LOAD32(sched + 12);
+
+        FULL_ROUNDS(TT_NR)(ENC_ROUND)
+
+        /* Last round has no mix columns */
+        t0 = *(sbox + (s0 & 0xff)) ^ (*(sbox + ((s1 >> 8) & 0xff)) << 8)
+           ^ (*(sbox + ((s2 >> 16) & 0xff)) << 16) ^ (*(sbox + (s3 >> 24)) << 24)
+           ^ LOAD32(rk);
+        t1 = *(sbox + (s1 & 0xff)) ^ (*(sbox + ((s2 >> 8) & 0xff)) << 8)
+           ^ (*(sbox + ((s3 >> 16) & 0xff)) << 16) ^ (*(sbox + (s0 >> 24)) << 24)
+           ^ LOAD32(rk + 4);
+        t2 = *(sbox + (s2 & 0xff)) ^ (*(sbox + ((s3 >> 8) & 0xff)) << 8)
+           ^ (*(sbox + ((s0 >> 16) & 0xff)) << 16) ^ (*(sbox + (s1 >> 24)) << 24)
+           ^ LOAD32(rk + 8);
+        t3 = *(sbox + (s3 & 0xff)) ^ (*(sbox + ((s0 >> 8) & 0xff)) << 8)
+           ^ (*(sbox + ((s1 >> 16) & 0xff)) << 16) ^ (*(sbox + (s2 >> 24)) << 24)
+           ^ LOAD32(rk + 12);
+        STORE32(out, t0);
+        STORE32(out + 4, t1);
+        STORE32(out + 8, t2);
+        STORE32(out + 12, t3);
+    }
+}
+
+/**
+ * Decrypts blocks with the equivalent inverse cipher, 16 table lookups
+ * per round like encryption
+ * dec: pointer to unsigned char[(TT_NR + 1) * BLOCK_SIZE]
+ * out: pointer to unsigned char[blocks * BLOCK_SIZE], may equal in
+ * in: pointer to unsigned char[blocks * BLOCK_SIZE]
+ * blocks: number of blocks
+ */
+static void ttable_dec (const unsigned char *dec, unsigned char *out,
+                        const unsigned char *in, size_t blocks) {
+    const unsigned char *rk = dec + (TT_NR * BLOCK_SIZE);
+    uint32_t s0, s1, s2, s3;
+    uint32_t t0, t1, t2, t3;
+
+    for (; blocks > 0; blocks--, in += BLOCK_SIZE, out += BLOCK_SIZE) {
+        s0 = LOAD32(in) ^ LOAD32(dec);
+        s1 = LOAD32(in + 4) ^ LOAD32(dec + 4);
+        s2 = LOAD32(in + 8) ^ LOAD32(dec + 8);
+        s3 = LOAD32(in + 12) ^ LOAD32(dec + 12);
+
+        FULL_ROUNDS(TT_NR)(DEC_ROUND)
+
+        /* Last round has no inverse mix columns */
+        t0 = *(inv_sbox + (s0 & 0xff)) ^ (*(inv_sbox + ((s3 >> 8) & 0xff)) << 8)
+           ^ (*(inv_sbox + ((s2 >> 16) & 0xff)) << 16)
+           ^ (*(inv_sbox + (s1 >> 24)) << 24) ^ LOAD32(rk);
+        t1 = *(inv_sbox + (s1 & 0xff)) ^ (*(inv_sbox + ((s0 >> 8) & 0xff)) << 8)
+           ^ (*(inv_sbox + ((s3 >> 16) & 0xff)) << 16)
+           ^ (*(inv_sbox + (s2 >> 24)) << 24) ^ LOAD32(rk + 4);
+        t2 = *(inv_sbox + (s2 & 0xff)) ^ (*(inv_sbox + ((s1 >> 8) & 0xff)) << 8)
+           ^ (*(inv_sbox + ((s0 >> 16) & 0xff)) << 16)
+           ^ (*(inv_sbox + (s3 >> 24)) << 24) ^ LOAD32(rk + 8);
+        t3 = *(inv_sbox + (s3 & 0xff)) ^ (*(inv_sbox + ((s2 >> 8) & 0xff)) << 8)
+           ^ (*(inv_sbox + ((s1 >> 16) & 0xff)) << 16)
+           ^ (*(inv_sbox + (s0 >> 24)) << 24) ^ LOAD32(rk + 12);
+        STORE32(out, t0);
+        STORE32(out + 4, t1);
+        STORE32(out + 8, t2);
+        STORE32(out + 12, t3);
+    }
+}
+
+#undef ENC_ROUND
+#undef DEC_ROUND
+
+#undef ttable_enc
+#undef ttable_dec